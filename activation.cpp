@@ -0,0 +1,141 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "activation.h"
+#include <cmath>
+#include <stdexcept>
+
+std::function<double(double)> activationFunction(Activation id) {
+    switch (id) {
+        case Activation::Identity:
+            return [](double x) { return x; };
+        case Activation::Sigmoid:
+            return [](double x) { return 1.0 / (1.0 + std::exp(-x)); };
+        case Activation::ReLU:
+            return [](double x) { return x > 0 ? x : 0.0; };
+        case Activation::Tanh:
+            return [](double x) { return std::tanh(x); };
+        default:
+            throw std::invalid_argument("No function for a custom activation");
+    }
+}
+
+std::function<double(double)> activationDerivative(Activation id) {
+    // y is the output of the activation, not its input
+    switch (id) {
+        case Activation::Identity:
+            return [](double) { return 1.0; };
+        case Activation::Sigmoid:
+            return [](double y) { return y * (1.0 - y); };
+        case Activation::ReLU:
+            return [](double y) { return y > 0 ? 1.0 : 0.0; };
+        case Activation::Tanh:
+            return [](double y) { return 1.0 - y * y; };
+        default:
+            throw std::invalid_argument("No derivative for a custom activation");
+    }
+}
+
+namespace {
+
+template <typename F>
+void applyRow(const double* in, double* out, size_t n, double bias, F f) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = f(in[i] + bias);
+    }
+}
+
+template <typename F>
+void backwardRow(const double* y, const double* grad, double* delta, size_t n, F derivative) {
+    for (size_t i = 0; i < n; ++i) {
+        delta[i] = derivative(y[i]) * grad[i];
+    }
+}
+
+}
+
+void activateRow(Activation id, const double* in, double* out, size_t n, double bias) {
+    // The same formulas as activationFunction, so both give the same values
+    switch (id) {
+        case Activation::Identity:
+            applyRow(in, out, n, bias, [](double x) { return x; });
+            break;
+        case Activation::Sigmoid:
+            applyRow(in, out, n, bias, [](double x) { return 1.0 / (1.0 + std::exp(-x)); });
+            break;
+        case Activation::ReLU:
+            applyRow(in, out, n, bias, [](double x) { return x > 0 ? x : 0.0; });
+            break;
+        case Activation::Tanh:
+            applyRow(in, out, n, bias, [](double x) { return std::tanh(x); });
+            break;
+        default:
+            throw std::invalid_argument("No function for a custom activation");
+    }
+}
+
+void activationBackward(Activation id, const double* y, const double* grad, double* delta, size_t n) {
+    switch (id) {
+        case Activation::Identity:
+            backwardRow(y, grad, delta, n, [](double) { return 1.0; });
+            break;
+        case Activation::Sigmoid:
+            backwardRow(y, grad, delta, n, [](double y) { return y * (1.0 - y); });
+            break;
+        case Activation::ReLU:
+            backwardRow(y, grad, delta, n, [](double y) { return y > 0 ? 1.0 : 0.0; });
+            break;
+        case Activation::Tanh:
+            backwardRow(y, grad, delta, n, [](double y) { return 1.0 - y * y; });
+            break;
+        default:
+            throw std::invalid_argument("No derivative for a custom activation");
+    }
+}
+
+std::string activationName(Activation id) {
+    switch (id) {
+        case Activation::Identity: return "identity";
+        case Activation::Sigmoid: return "sigmoid";
+        case Activation::ReLU: return "relu";
+        case Activation::Tanh: return "tanh";
+        default: return "custom";
+    }
+}
+
+Activation activationFromName(const std::string& name) {
+    if (name == "identity") return Activation::Identity;
+    if (name == "sigmoid") return Activation::Sigmoid;
+    if (name == "relu") return Activation::ReLU;
+    if (name == "tanh") return Activation::Tanh;
+    throw std::invalid_argument("Unknown activation : " + name);
+}
+
+std::function<double(double, double)> costFunction(Cost id) {
+    if (id == Cost::MSE) {
+        return [](double y_pred, double y_true) { return 0.5 * (y_pred - y_true) * (y_pred - y_true); };
+    }
+    throw std::invalid_argument("No function for a custom cost");
+}
+
+std::function<double(double, double)> costDerivative(Cost id) {
+    if (id == Cost::MSE) {
+        return [](double y_pred, double y_true) { return y_pred - y_true; };
+    }
+    throw std::invalid_argument("No derivative for a custom cost");
+}
+
+double costRow(Cost id, const double* y_pred, const double* y_true, double* grad, size_t n) {
+    // The same formulas as costFunction and costDerivative, summed in the same order
+    if (id == Cost::MSE) {
+        double sum = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            double error = y_pred[i] - y_true[i];
+            sum += 0.5 * error * error;
+            grad[i] = error;
+        }
+        return sum;
+    }
+    throw std::invalid_argument("No function for a custom cost");
+}
@@ -0,0 +1,76 @@
+//
+// This file is part of a simple neural network library for C++.
+// It gives an id to the activation and cost functions the library knows about, so a Network
+// can be saved to a file and rebuilt from it (see Network::save and Network::load).
+//
+// This file is released under the MIT License.
+//
+
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// The values are stored in model files, they must never change
+enum class Activation : uint32_t {
+    Identity = 0,
+    Sigmoid = 1,
+    ReLU = 2,
+    Tanh = 3,
+    // A function given by the user, it can't be saved
+    Custom = 0xFFFFFFFF
+};
+
+enum class Cost : uint32_t {
+    MSE = 0,
+    Custom = 0xFFFFFFFF
+};
+
+// Returns the activation function for an id
+//
+// Throws std::invalid_argument for Activation::Custom
+std::function<double(double)> activationFunction(Activation id);
+
+// Returns the derivative of an activation function
+// Layer::backward calls it with the output of the layer, so the derivative is written in terms of
+// the activated value y = f(x) : for example y * (1 - y) for the sigmoid
+//
+// Throws std::invalid_argument for Activation::Custom
+std::function<double(double)> activationDerivative(Activation id);
+
+// Applies an activation to a row of values, after adding a bias to each of them : out[i] = f(in[i] + bias)
+// The loop is written out for each activation, so it makes no call per value and the compiler can vectorize it
+// in and out may be the same row
+//
+// Throws std::invalid_argument for Activation::Custom
+void activateRow(Activation id, const double* in, double* out, size_t n, double bias = 0.0);
+
+// Backward pass of an activation over a row : delta[i] = f'(y[i]) * grad[i], y being the activated values
+// Like activationDerivative, but without a call per value
+//
+// Throws std::invalid_argument for Activation::Custom
+void activationBackward(Activation id, const double* y, const double* grad, double* delta, size_t n);
+
+// Name of an activation ("sigmoid", "relu"...) and the other way around
+//
+// activationFromName throws std::invalid_argument if the name is unknown
+std::string activationName(Activation id);
+Activation activationFromName(const std::string& name);
+
+// Cost function and its derivative, called with (predicted, target)
+//
+// Throws std::invalid_argument for Cost::Custom
+std::function<double(double, double)> costFunction(Cost id);
+std::function<double(double, double)> costDerivative(Cost id);
+
+// The cost of a row of predictions and its gradient : grad[i] = cost'(y_pred[i], y_true[i])
+// Like costFunction and costDerivative, but without a call per value
+// output : the sum of the costs of the row
+//
+// Throws std::invalid_argument for Cost::Custom
+double costRow(Cost id, const double* y_pred, const double* y_true, double* grad, size_t n);
+
+#endif //ACTIVATION_H
@@ -0,0 +1,100 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "activation_layer.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+ActivationLayer::ActivationLayer(size_t size, Activation activation)
+    : size(size), activation_id(activation), outputs(nullptr)
+{
+    if (size == 0) {
+        throw std::invalid_argument("The size of an activation layer must not be 0");
+    }
+    if (activation == Activation::Custom) {
+        throw std::invalid_argument("An activation layer needs an activation chosen by id");
+    }
+}
+
+void ActivationLayer::forwardInto(const Matrix& input, Matrix& output) {
+    checkForward(input, output);
+    outputs = &output;
+    activateRow(activation_id, input.data(), output.data(), input.size());
+}
+
+void ActivationLayer::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    checkBackward(dLoss_dOutput, dLoss_dInput, outputs ? outputs->numCols() : 0);
+    if (dLoss_dInput) {
+        activationBackward(activation_id, outputs->data(), dLoss_dOutput.data(), dLoss_dInput->data(), outputs->size());
+    }
+}
+
+LayerSpec ActivationLayer::spec() const {
+    return LayerSpec::activate(size, activation_id);
+}
+
+Softmax::Softmax(size_t size) : size(size), outputs(nullptr) {
+    if (size == 0) {
+        throw std::invalid_argument("The size of a softmax layer must not be 0");
+    }
+}
+
+void Softmax::forwardInto(const Matrix& input, Matrix& output) {
+    checkForward(input, output);
+    outputs = &output;
+
+    // A sample is a column, so the reductions run over the rows, each row updating the values of every sample
+    const size_t n = input.numCols();
+    const double* in = input.data();
+    double* out = output.data();
+    column_max.assign(in, in + n);
+    column_sum.assign(n, 0.0);
+    for (size_t i = 1; i < size; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            column_max[j] = std::max(column_max[j], in[i * n + j]);
+        }
+    }
+    for (size_t i = 0; i < size; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            out[i * n + j] = std::exp(in[i * n + j] - column_max[j]);
+            column_sum[j] += out[i * n + j];
+        }
+    }
+    for (size_t j = 0; j < n; ++j) {
+        column_sum[j] = 1.0 / column_sum[j];
+    }
+    for (size_t i = 0; i < size; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            out[i * n + j] *= column_sum[j];
+        }
+    }
+}
+
+void Softmax::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    const size_t n = outputs ? outputs->numCols() : 0;
+    checkBackward(dLoss_dOutput, dLoss_dInput, n);
+    if (!dLoss_dInput) {
+        return;
+    }
+
+    const double* y = outputs->data();
+    const double* grad = dLoss_dOutput.data();
+    double* in_grad = dLoss_dInput->data();
+    column_sum.assign(n, 0.0);
+    for (size_t i = 0; i < size; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            column_sum[j] += grad[i * n + j] * y[i * n + j];
+        }
+    }
+    for (size_t i = 0; i < size; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            in_grad[i * n + j] = y[i * n + j] * (grad[i * n + j] - column_sum[j]);
+        }
+    }
+}
+
+LayerSpec Softmax::spec() const {
+    return LayerSpec::softmax(size);
+}
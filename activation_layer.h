@@ -0,0 +1,71 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the layers that only transform their input value by value or sample by sample :
+// ActivationLayer applies an activation (see activation.h) to every value, Softmax turns every sample into
+// probabilities. An ActivationLayer after a Dense or a Conv2D is fused into it by the execution plan (see plan.h).
+//
+// This file is released under the MIT License.
+//
+
+#ifndef ACTIVATION_LAYER_H
+#define ACTIVATION_LAYER_H
+
+#include <vector>
+#include "layer.h"
+
+class ActivationLayer : public Layer {
+private:
+    size_t size;
+    Activation activation_id;
+
+    // The output of the last forward pass, the derivative is written in terms of it
+    const Matrix* outputs;
+
+public:
+    // Parameters :
+    // size : number of values of a sample
+    // activation : the activation, chosen by id
+    //
+    // Throws std::invalid_argument if size is 0 or activation is Custom
+    ActivationLayer(size_t size, Activation activation);
+
+    size_t inputSize() const override { return size; }
+    size_t outputSize() const override { return size; }
+    Activation activation() const { return activation_id; }
+
+    void forwardInto(const Matrix& input, Matrix& output) override;
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+    bool keepsOutput() const override { return true; }
+    LayerSpec spec() const override;
+};
+
+class Softmax : public Layer {
+private:
+    size_t size;
+    const Matrix* outputs;
+
+    // One value per sample : the largest input, then the sum of the exponentials (forward),
+    // or the dot product of the gradient with the output (backward)
+    std::vector<double> column_max;
+    std::vector<double> column_sum;
+
+public:
+    // Parameters :
+    // size : number of values of a sample
+    //
+    // Throws std::invalid_argument if size is 0
+    explicit Softmax(size_t size);
+
+    size_t inputSize() const override { return size; }
+    size_t outputSize() const override { return size; }
+
+    // out = exp(in - max) / sum(exp(in - max)) for every sample, the max keeps the exponentials from overflowing
+    void forwardInto(const Matrix& input, Matrix& output) override;
+
+    // dLoss/dInput = out * (dLoss/dOutput - sum(dLoss/dOutput * out)) for every sample
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+    bool keepsOutput() const override { return true; }
+    LayerSpec spec() const override;
+};
+
+#endif //ACTIVATION_LAYER_H
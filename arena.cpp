@@ -0,0 +1,107 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "arena.h"
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+size_t Arena::padded(size_t n) {
+    constexpr size_t per_line = alignment / sizeof(double);
+    return (n + per_line - 1) / per_line * per_line;
+}
+
+Arena::Arena(size_t count)
+    : values(nullptr), count(count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // The size is padded so the block is a whole number of cache lines
+    values = static_cast<double*>(::operator new(padded(count) * sizeof(double), std::align_val_t(alignment)));
+    zero();
+}
+
+Arena::~Arena() {
+    release();
+}
+
+void Arena::release() {
+    // Wrapped memory is freed by its owner when the last reference goes away
+    if (values != nullptr && !owner) {
+        ::operator delete(values, std::align_val_t(alignment));
+    }
+    values = nullptr;
+    count = 0;
+    owner.reset();
+}
+
+Arena::Arena(Arena&& other) noexcept
+    : values(other.values), count(other.count), owner(std::move(other.owner))
+{
+    other.values = nullptr;
+    other.count = 0;
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        release();
+        values = other.values;
+        count = other.count;
+        owner = std::move(other.owner);
+        other.values = nullptr;
+        other.count = 0;
+    }
+    return *this;
+}
+
+Arena Arena::wrap(double* values, size_t count, std::shared_ptr<void> owner) {
+    if (reinterpret_cast<uintptr_t>(values) % alignment != 0) {
+        throw std::invalid_argument("Wrapped arena memory must be aligned");
+    }
+
+    Arena arena;
+    arena.values = values;
+    arena.count = count;
+    arena.owner = std::move(owner);
+    return arena;
+}
+
+void Arena::zero() {
+    if (count != 0) {
+        std::memset(values, 0, count * sizeof(double));
+    }
+}
+
+void Arena::axpy(double a, const Arena& x) {
+    if (x.count != count) {
+        throw std::invalid_argument("Arena sizes must match for axpy");
+    }
+
+    // Plain loop on restrict pointers, the compiler vectorizes it
+    double* __restrict y = values;
+    const double* __restrict xs = x.values;
+    for (size_t i = 0; i < count; ++i) {
+        y[i] += a * xs[i];
+    }
+}
+
+void Arena::copyFrom(const Arena& other) {
+    if (other.count != count) {
+        throw std::invalid_argument("Arena sizes must match for copy");
+    }
+    if (count != 0) {
+        std::memcpy(values, other.values, count * sizeof(double));
+    }
+}
+
+double Arena::squaredNorm() const {
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += values[i] * values[i];
+    }
+    return sum;
+}
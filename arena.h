@@ -0,0 +1,84 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides an Arena class, a single aligned block of doubles that holds every parameter
+// (or every gradient) of a Network, so whole-model operations are one sweep over one buffer.
+// The layers only keep views (see Matrix::view) into the arena.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+
+class Arena {
+private:
+    double* values;
+    size_t count;
+    // Set when the values belong to someone else (for example a mapped model file), which the arena keeps alive
+    std::shared_ptr<void> owner;
+
+    void release();
+
+public:
+    // Alignment of the arena in bytes, a cache line so every tensor can start on its own line
+    static constexpr size_t alignment = 64;
+
+    // Number of doubles needed to store n values so that the next tensor stays aligned
+    //
+    // Parameters :
+    // n : number of doubles of a tensor
+    // output : n rounded up to a multiple of alignment / sizeof(double)
+    static size_t padded(size_t n);
+
+    // Allocates an aligned arena of count doubles, all set to zero
+    //
+    // Parameters :
+    // count : number of doubles in the arena
+    explicit Arena(size_t count = 0);
+    ~Arena();
+
+    // An arena is the owner of the memory viewed by the layers, it can be moved but not copied
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+
+    // Creates an arena over memory it does not allocate
+    //
+    // Parameters :
+    // values : pointer to count doubles, aligned on Arena::alignment bytes
+    // count : number of doubles
+    // owner : whatever keeps the memory alive, the arena holds a reference to it
+    //
+    // Throws std::invalid_argument if values is not aligned
+    static Arena wrap(double* values, size_t count, std::shared_ptr<void> owner);
+
+    double* data() { return values; }
+    const double* data() const { return values; }
+    size_t size() const { return count; }
+
+    // Sets every value of the arena to zero
+    void zero();
+
+    // Computes this = this + a * x, in a single pass over both arenas
+    //
+    // Parameters :
+    // a : the scale applied to x
+    // x : the other arena, must have the same size
+    //
+    // Throws std::invalid_argument if the sizes do not match
+    void axpy(double a, const Arena& x);
+
+    // Copies the values of another arena of the same size
+    //
+    // Throws std::invalid_argument if the sizes do not match
+    void copyFrom(const Arena& other);
+
+    // Returns the sum of the squares of all the values (the squared L2 norm)
+    double squaredNorm() const;
+};
+
+#endif //ARENA_H
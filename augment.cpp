@@ -0,0 +1,228 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "augment.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+constexpr double pi = 3.14159265358979323846;
+
+// The displacement field is drawn and smoothed on a grid of one point every elastic_step pixels, then
+// interpolated : smoothed over several pixels it is almost linear from one pixel to the next anyway,
+// and it costs elastic_step^3 times less to smooth
+constexpr size_t elastic_step = 2;
+
+// Number of samples augmented by a task at least, an image takes a few tens of microseconds
+constexpr size_t samples_per_task = 2;
+
+// A small generator for the random stream of one sample (splitmix64)
+// The standard distributions give different values from one library to another, these do not
+class SampleRng {
+private:
+    uint64_t state;
+
+public:
+    explicit SampleRng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [-1, 1)
+    double symmetric() {
+        return static_cast<double>(next() >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+    }
+
+    // Close to a standard normal : the sum of the four 16 bit uniforms of one draw, centered and scaled
+    // (Irwin-Hall), much cheaper than Box-Muller for a noise drawn for every pixel
+    double normal() {
+        uint64_t bits = next();
+        double sum = static_cast<double>((bits & 0xffff) + ((bits >> 16) & 0xffff)
+                                         + ((bits >> 32) & 0xffff) + (bits >> 48));
+        return (sum / 65536.0 - 2.0) * 1.7320508075688772;
+    }
+};
+
+}
+
+Augmenter::Augmenter(const AugmentOptions& options, size_t width, size_t height)
+    : options(options), width(width), height(height), epoch_key(0)
+{
+    // The grid of the displacement field covers the image, with one more point to interpolate the last pixels
+    grid_width = (width - 1) / elastic_step + 2;
+    grid_height = (height - 1) / elastic_step + 2;
+
+    // The gaussian kernel of the elastic distortion, in grid points, cut at 3 sigma and normalized
+    if (options.elastic_alpha > 0.0 && options.elastic_sigma > 0.0) {
+        double sigma = options.elastic_sigma / elastic_step;
+        int radius = static_cast<int>(std::ceil(3.0 * sigma));
+        double sum = 0.0;
+        for (int i = -radius; i <= radius; ++i) {
+            double w = std::exp(-0.5 * i * i / (sigma * sigma));
+            kernel.push_back(w);
+            sum += w;
+        }
+        for (double& w : kernel) {
+            w /= sum;
+        }
+    }
+}
+
+void Augmenter::smooth(double* field, double* scratch) const {
+    // The gaussian is separable : the rows are blurred into scratch, then the columns of scratch back into field
+    // Outside the grid the field is taken as zero. Both passes run along whole rows, so they vectorize.
+    const size_t radius = kernel.size() / 2;
+    const size_t w = grid_width;
+    const size_t h = grid_height;
+
+    thread_local std::vector<double> row;
+    row.assign(w + 2 * radius, 0.0);
+    for (size_t y = 0; y < h; ++y) {
+        std::copy(field + y * w, field + (y + 1) * w, row.begin() + radius);
+        double* out = scratch + y * w;
+        std::fill(out, out + w, 0.0);
+        for (size_t i = 0; i < kernel.size(); ++i) {
+            const double k = kernel[i];
+            const double* in = row.data() + i;
+            for (size_t x = 0; x < w; ++x) {
+                out[x] += k * in[x];
+            }
+        }
+    }
+    for (size_t y = 0; y < h; ++y) {
+        size_t lo = y < radius ? radius - y : 0;
+        size_t hi = std::min(kernel.size(), h + radius - y);
+        double* out = field + y * w;
+        std::fill(out, out + w, 0.0);
+        for (size_t i = lo; i < hi; ++i) {
+            const double k = kernel[i];
+            const double* in = scratch + (y + i - radius) * w;
+            for (size_t x = 0; x < w; ++x) {
+                out[x] += k * in[x];
+            }
+        }
+    }
+}
+
+void Augmenter::apply(Matrix& inputs, const size_t* keys, size_t n) const {
+    if (inputs.numRows() != width * height || inputs.numCols() < n) {
+        throw std::invalid_argument("The batch must hold one image of width * height values per column");
+    }
+
+    const size_t w = width;
+    const size_t h = height;
+    const size_t batch = inputs.numCols();
+    const bool elastic = !kernel.empty();
+    const uint64_t key = epoch_key;
+
+    // The source image is padded with zeros (1 on the top and left, 2 on the bottom and right), so the bilinear
+    // sampling never has to check its coordinates : they are clamped to [-1, size], where it reads only zeros
+    const size_t pw = w + 3;
+    const size_t grid_size = grid_width * grid_height;
+
+    // A smoothed field drawn on the coarser grid is larger than one drawn on the pixels (it averages
+    // fewer values), this brings it back to the size of the displacements of the original method
+    const double alpha = kernel.empty() ? 0.0 : options.elastic_alpha / elastic_step;
+
+    const double cx = (static_cast<double>(w) - 1.0) / 2.0;
+    const double cy = (static_cast<double>(h) - 1.0) / 2.0;
+
+    // The samples are spread over the threads of the scheduler, a few at a time : each one draws from its own
+    // random stream, so the result does not depend on which thread augments it
+    parallelFor(0, n, samples_per_task, [&](size_t first, size_t last) {
+        // The buffers are kept from one call to the next, one set per thread
+        thread_local std::vector<double> padded;
+        thread_local std::vector<double> dx;
+        thread_local std::vector<double> dy;
+        thread_local std::vector<double> scratch;
+        thread_local std::vector<double> grid_dx;
+        thread_local std::vector<double> grid_dy;
+        padded.assign(pw * (h + 3), 0.0);
+        dx.assign(w * h, 0.0);
+        dy.assign(w * h, 0.0);
+        scratch.resize(grid_size);
+        grid_dx.resize(grid_size);
+        grid_dy.resize(grid_size);
+
+        for (size_t j = first; j < last; ++j) {
+            double* column = inputs.data() + j;
+            for (size_t y = 0; y < h; ++y) {
+                for (size_t x = 0; x < w; ++x) {
+                    padded[(y + 1) * pw + x + 1] = column[(y * w + x) * batch];
+                }
+            }
+
+            // The random stream of the sample : its key mixed with the epoch key
+            SampleRng rng(key ^ (keys[j] * 0xd1b54a32d192ed03ull));
+            double angle = rng.symmetric() * options.max_rotation * pi / 180.0;
+            double shift_x = rng.symmetric() * options.max_shift;
+            double shift_y = rng.symmetric() * options.max_shift;
+            double c = std::cos(angle);
+            double s = std::sin(angle);
+
+            if (elastic) {
+                for (size_t i = 0; i < grid_size; ++i) {
+                    grid_dx[i] = rng.symmetric();
+                    grid_dy[i] = rng.symmetric();
+                }
+                smooth(grid_dx.data(), scratch.data());
+                smooth(grid_dy.data(), scratch.data());
+
+                // Bilinear interpolation of the grid at every pixel
+                for (size_t y = 0; y < h; ++y) {
+                    size_t gy = y / elastic_step;
+                    double ty = static_cast<double>(y % elastic_step) / elastic_step;
+                    for (size_t x = 0; x < w; ++x) {
+                        size_t gx = x / elastic_step;
+                        double tx = static_cast<double>(x % elastic_step) / elastic_step;
+                        size_t g = gy * grid_width + gx;
+                        dx[y * w + x] = (1.0 - ty) * ((1.0 - tx) * grid_dx[g] + tx * grid_dx[g + 1])
+                                      + ty * ((1.0 - tx) * grid_dx[g + grid_width] + tx * grid_dx[g + grid_width + 1]);
+                        dy[y * w + x] = (1.0 - ty) * ((1.0 - tx) * grid_dy[g] + tx * grid_dy[g + 1])
+                                      + ty * ((1.0 - tx) * grid_dy[g + grid_width] + tx * grid_dy[g + grid_width + 1]);
+                    }
+                }
+            }
+
+            // Each pixel of the result is read from where the shift, the rotation and the displacement field send it
+            for (size_t y = 0; y < h; ++y) {
+                for (size_t x = 0; x < w; ++x) {
+                    const size_t p = y * w + x;
+                    double rx = static_cast<double>(x) - cx;
+                    double ry = static_cast<double>(y) - cy;
+                    double sx = c * rx - s * ry + cx + shift_x + alpha * dx[p];
+                    double sy = s * rx + c * ry + cy + shift_y + alpha * dy[p];
+                    sx = std::clamp(sx, -1.0, static_cast<double>(w));
+                    sy = std::clamp(sy, -1.0, static_cast<double>(h));
+
+                    double fx = std::floor(sx);
+                    double fy = std::floor(sy);
+                    double tx = sx - fx;
+                    double ty = sy - fy;
+                    const double* q = padded.data() + static_cast<size_t>(fy + 1.0) * pw + static_cast<size_t>(fx + 1.0);
+                    double value = (1.0 - ty) * ((1.0 - tx) * q[0] + tx * q[1])
+                                 + ty * ((1.0 - tx) * q[pw] + tx * q[pw + 1]);
+
+                    if (options.noise > 0.0) {
+                        value += options.noise * rng.normal();
+                    }
+                    column[p * batch] = std::clamp(value, 0.0, 1.0);
+                }
+            }
+        }
+    });
+}
+
+BatchLoader::Transform Augmenter::transform() const {
+    return [this](Matrix& inputs, const size_t* indices, size_t n) {
+        apply(inputs, indices, n);
+    };
+}
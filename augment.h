@@ -0,0 +1,70 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides an Augmenter that distorts the images of a batch on the fly : a random sub-pixel shift,
+// a small rotation, an elastic distortion (a smoothed random displacement field, as in Simard et al. 2003)
+// and some noise, all resampled in one bilinear pass.
+// It runs as the transform of a BatchLoader, so it overlaps with the training, and spreads the samples of a batch
+// over the threads of the scheduler (see scheduler.h).
+// Every sample draws from its own random stream, made from the epoch key and the index of the sample,
+// so the augmented batches do not depend on the number of threads or on the order they run in.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef AUGMENT_H
+#define AUGMENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "loader.h"
+#include "matrix.h"
+
+// How strong the distortions are, a zero turns one off
+struct AugmentOptions {
+    double max_shift = 2.0;       // largest shift, in pixels, in each direction
+    double max_rotation = 15.0;   // largest rotation, in degrees, either way
+    double elastic_alpha = 6.0;   // scale of the elastic displacements, in pixels
+    double elastic_sigma = 4.0;   // smoothness of the elastic displacements, in pixels
+    double noise = 0.05;          // standard deviation of the gaussian noise added to the normalized pixels
+};
+
+class Augmenter {
+private:
+    AugmentOptions options;
+    size_t width;
+    size_t height;
+    size_t grid_width;
+    size_t grid_height;
+    std::vector<double> kernel;
+    std::atomic<uint64_t> epoch_key;
+
+    // Blurs a field of grid_width x grid_height points with the gaussian kernel, in place
+    void smooth(double* field, double* scratch) const;
+
+public:
+    // Parameters :
+    // options : the strength of the distortions
+    // width, height : size of the images, a sample holds width * height values stored row by row
+    Augmenter(const AugmentOptions& options, size_t width = 28, size_t height = 28);
+
+    // Sets the key mixed with the sample indices to make their random streams, a new one for every epoch
+    // gives new distortions. It must not change while batches are being augmented.
+    void setEpochKey(uint64_t key) { epoch_key = key; }
+
+    // Augments a batch in place
+    //
+    // Parameters :
+    // inputs : the batch, of size (width * height, n), one normalized image per column
+    // keys : for each sample, the number its random stream is made from (its index in the dataset)
+    // n : number of samples of the batch
+    //
+    // Throws std::invalid_argument if the batch does not hold images of width * height values
+    void apply(Matrix& inputs, const size_t* keys, size_t n) const;
+
+    // The augmenter as the transform of a BatchLoader, it must outlive the loader
+    BatchLoader::Transform transform() const;
+};
+
+#endif //AUGMENT_H
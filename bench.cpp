@@ -0,0 +1,256 @@
+//
+// This file is part of a simple neural network library for C++.
+// It runs the micro-benchmarks of the library : the matrix products at the shapes of the networks of main.cpp
+// and at larger sizes, the matrix operations, the activations, one forward / backward / update of single layers,
+// and whole training steps. Every result gets its median and 99th percentile time, and its GFLOP/s or GB/s.
+//
+// Usage : bench [--filter <text>] [--json <path>] [--min-time <seconds>] [--batch <size>]
+// --filter <text>      : only runs the benchmarks whose name contains the text, for example gemm/ or layer/conv
+// --json <path>        : writes the results as JSON (see Benchmark::writeJson), bench.json by default
+// --min-time <seconds> : time spent timing each benchmark, 0.25 by default
+// --batch <size>       : number of samples of the batches, 32 by default (as in main.cpp)
+//
+// This file is released under the MIT License.
+//
+
+#include "benchmark.h"
+#include "gemm.h"
+#include "matrix.h"
+#include "network.h"
+#include "optimizer.h"
+#include <iostream>
+#include <random>
+
+namespace {
+
+struct BenchOptions {
+    std::string filter;
+    std::string json_path = "bench.json";
+    double min_time = 0.25;
+    size_t batch_size = 32;
+};
+
+BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--filter") {
+            options.filter = value();
+        } else if (arg == "--json") {
+            options.json_path = value();
+        } else if (arg == "--min-time") {
+            options.min_time = std::stod(value());
+        } else if (arg == "--batch") {
+            options.batch_size = std::stoul(value());
+            if (options.batch_size == 0) {
+                throw std::invalid_argument("The batch size must be at least 1");
+            }
+        } else {
+            throw std::invalid_argument("Unknown option : " + arg);
+        }
+    }
+    return options;
+}
+
+// The models of main.cpp (see modelSpecs there)
+std::vector<LayerSpec> mlpSpecs() {
+    return {LayerSpec::dense(784, 128, Activation::Sigmoid),
+            LayerSpec::dense(128, 64, Activation::Sigmoid),
+            LayerSpec::dense(64, 10, Activation::ReLU)};
+}
+
+std::vector<LayerSpec> cnnSpecs() {
+    return {LayerSpec::conv2d(1, 28, 28, 8, 5, 1, 2, Activation::ReLU),
+            LayerSpec::maxPool2d(8, 28, 28, 2, 2),
+            LayerSpec::conv2d(8, 14, 14, 16, 5, 1, 2, Activation::ReLU),
+            LayerSpec::maxPool2d(16, 14, 14, 2, 2),
+            LayerSpec::dense(16 * 7 * 7, 10, Activation::Sigmoid)};
+}
+
+std::mt19937 rng(42);
+
+Matrix randomMatrix(size_t rows, size_t cols) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    Matrix m(rows, cols);
+    for (size_t i = 0; i < m.size(); ++i) {
+        m.data()[i] = dist(rng);
+    }
+    return m;
+}
+
+// Floating point operations of the matrix product of a forward pass of a layer, 0 for the layers without one
+// The backward pass does the same product twice : for the gradient of the weights and for the one of the input
+double forwardFlops(const LayerSpec& spec, const Layer& layer, size_t n) {
+    if (spec.kind == LayerKind::Dense) {
+        return 2.0 * spec.in_size * spec.out_size * n;
+    }
+    if (spec.kind == LayerKind::Conv2D) {
+        return 2.0 * layer.outputSize() * spec.channels * spec.window * spec.window * n;
+    }
+    return 0.0;
+}
+
+std::string shape(size_t m, size_t n, size_t k) {
+    return std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k);
+}
+
+// C = op(A) * op(B) of size m x n, with the inner dimension k
+void benchGemm(Benchmark& bench, const std::string& name, bool trans_a, bool trans_b, size_t m, size_t n, size_t k) {
+    Matrix a = trans_a ? randomMatrix(k, m) : randomMatrix(m, k);
+    Matrix b = trans_b ? randomMatrix(n, k) : randomMatrix(k, n);
+    Matrix c(m, n);
+    std::string flags = std::string(trans_a ? "T" : "N") + (trans_b ? "T" : "N");
+    bench.run("gemm/" + name + "/" + flags + "/" + shape(m, n, k), 2.0 * m * n * k, 8.0 * (m * k + k * n + m * n), [&] {
+        gemm(trans_a, trans_b, m, n, k, 1.0, a.data(), a.numCols(), b.data(), b.numCols(), 0.0, c.data(), n);
+    });
+}
+
+void benchMatrices(Benchmark& bench, size_t batch) {
+    for (size_t size : {256, 512, 1024}) {
+        benchGemm(bench, "square", false, false, size, size, size);
+    }
+
+    // Matrix times vector : the forward pass of one sample, with the same kernel
+    benchGemm(bench, "gemv", false, false, 128, 1, 784);
+    benchGemm(bench, "gemv", false, false, 1024, 1, 1024);
+
+    // The operators, which allocate their result
+    for (size_t size : {256, 1024}) {
+        Matrix a = randomMatrix(size, size);
+        Matrix b = randomMatrix(size, size);
+        std::string square = std::to_string(size) + "x" + std::to_string(size);
+        double bytes = 8.0 * size * size;
+        bench.run("matrix/multiply/" + square, 2.0 * size * size * size, 3 * bytes, [&] { Matrix c = a * b; });
+        bench.run("matrix/transpose/" + square, 0.0, 2 * bytes, [&] { Matrix t = a.transpose(); });
+        bench.run("matrix/add/" + square, size * size, 3 * bytes, [&] { Matrix c = a + b; });
+        bench.run("matrix/add_in_place/" + square, size * size, 3 * bytes, [&] { a += b; });
+    }
+    Matrix batch_values = randomMatrix(784, batch);
+    bench.run("matrix/transpose/784x" + std::to_string(batch), 0.0, 16.0 * batch_values.size(),
+              [&] { Matrix t = batch_values.transpose(); });
+}
+
+// The products of the training steps of the networks : forward, gradient of the weights, gradient of the input
+void benchNetworkGemms(Benchmark& bench, size_t batch) {
+    for (const LayerSpec& spec : mlpSpecs()) {
+        size_t in = spec.in_size;
+        size_t out = spec.out_size;
+        benchGemm(bench, "dense", false, false, out, batch, in);
+        benchGemm(bench, "dense", false, true, out, in, batch);
+        benchGemm(bench, "dense", true, false, in, batch, out);
+    }
+    for (const LayerSpec& spec : cnnSpecs()) {
+        if (spec.kind != LayerKind::Conv2D) {
+            continue;
+        }
+        size_t patch = spec.channels * spec.window * spec.window;
+        size_t pixels = spec.height * spec.width * batch;
+        benchGemm(bench, "conv", false, false, spec.filters, pixels, patch);
+        benchGemm(bench, "conv", false, true, spec.filters, patch, pixels);
+        benchGemm(bench, "conv", true, false, patch, pixels, spec.filters);
+    }
+}
+
+void benchActivations(Benchmark& bench) {
+    const size_t n = 1 << 16;
+    Matrix in = randomMatrix(1, n);
+    Matrix grad = randomMatrix(1, n);
+    Matrix out(1, n);
+    Matrix delta(1, n);
+    for (Activation id : {Activation::Identity, Activation::Sigmoid, Activation::ReLU, Activation::Tanh}) {
+        std::string name = "activation/" + activationName(id);
+        bench.run(name + "/forward/" + std::to_string(n), 0.0, 16.0 * n,
+                  [&] { activateRow(id, in.data(), out.data(), n, 0.5); });
+        bench.run(name + "/backward/" + std::to_string(n), 0.0, 24.0 * n,
+                  [&] { activationBackward(id, out.data(), grad.data(), delta.data(), n); });
+    }
+}
+
+// One layer on its own : forward, backward, and the update of its parameters by the optimizers
+void benchLayers(Benchmark& bench, size_t batch) {
+    std::vector<LayerSpec> specs = {mlpSpecs()[0], cnnSpecs()[0], cnnSpecs()[1], cnnSpecs()[2]};
+    const char* names[] = {"dense/784x128", "conv/1x28x28-8x5x5", "maxpool/8x28x28-2x2", "conv/8x14x14-16x5x5"};
+    for (size_t l = 0; l < specs.size(); ++l) {
+        std::unique_ptr<Layer> layer = makeLayer(specs[l]);
+        Matrix input = randomMatrix(layer->inputSize(), batch);
+        Matrix grad = randomMatrix(layer->outputSize(), batch);
+        double flops = forwardFlops(specs[l], *layer, batch);
+        std::string name = std::string("layer/") + names[l] + "/" + std::to_string(batch);
+        bench.run(name + "/forward", flops, 8.0 * (input.size() + grad.size()), [&] { layer->forward(input); });
+        layer->forward(input);
+        bench.run(name + "/backward", 2 * flops, 8.0 * (input.size() + 2 * grad.size()), [&] { layer->backward(grad); });
+
+        if (layer->parameterCount() == 0) {
+            continue;
+        }
+        size_t count = layer->parameterCount();
+        Arena params(count);
+        Arena grads(count);
+        for (const char* optimizer : {"sgd", "adam"}) {
+            std::unique_ptr<Optimizer> opt = makeOptimizer(optimizer, 1e-6);
+            std::vector<Arena*> states = opt->stateBuffers(count);
+            double bytes = 8.0 * count * (3 + 2 * states.size());
+            bench.run(name + "/update_" + optimizer, 0.0, bytes, [&] { opt->step(params, grads); });
+        }
+    }
+}
+
+// Whole training steps : forward, backward and SGD step of a network on one batch
+void benchTraining(Benchmark& bench, size_t batch) {
+    for (const auto& [model, specs] : {std::pair{"mlp", mlpSpecs()}, std::pair{"cnn", cnnSpecs()}}) {
+        Network net(specs, Cost::MSE, 1e-6);
+        Matrix inputs = randomMatrix(784, batch);
+        Matrix targets(10, batch);
+        for (size_t j = 0; j < batch; ++j) {
+            targets(j % 10, j) = 1.0;
+        }
+
+        // Three products per layer, except that the first layer does not compute the gradient of its input
+        double forward_flops = 0.0;
+        double step_flops = 0.0;
+        for (size_t l = 0; l < specs.size(); ++l) {
+            double forward = forwardFlops(specs[l], *net.getLayers()[l], batch);
+            forward_flops += forward;
+            step_flops += l == 0 ? 2 * forward : 3 * forward;
+        }
+        std::string name = std::string("train/") + model + "/" + std::to_string(batch);
+        bench.run(name + "/forward", forward_flops, 0.0, [&] { net.forward(inputs); });
+        bench.run(name + "/step", step_flops, 0.0, [&] { net.train(inputs, targets); });
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
+    }
+
+    Benchmark bench(options.filter, 0.05, options.min_time);
+    benchMatrices(bench, options.batch_size);
+    benchNetworkGemms(bench, options.batch_size);
+    benchActivations(bench);
+    benchLayers(bench, options.batch_size);
+    benchTraining(bench, options.batch_size);
+
+    bench.print(std::cout);
+    try {
+        bench.writeJson(options.json_path);
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Results written to " << options.json_path << std::endl;
+    return 0;
+}
@@ -0,0 +1,217 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+
+// A sample shorter than this is dominated by the clock, fast functions are called several times per sample
+constexpr double min_sample_time = 20e-6;
+
+// Stops a benchmark that takes its minimum time in too many samples, for the very fast functions
+constexpr size_t max_samples = 100000;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The value at a fraction of sorted values, rounding up (the p99 of 20 samples is the largest one)
+double percentile(const std::vector<double>& sorted, double fraction) {
+    size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+}
+
+Benchmark::Benchmark(std::string filter, double warmup_time, double min_time, size_t min_samples)
+    : filter(std::move(filter)), warmup_time(warmup_time), min_time(min_time), min_samples(min_samples)
+{
+    if (min_samples == 0 || warmup_time < 0.0 || min_time < 0.0) {
+        throw std::invalid_argument("A benchmark needs at least one sample and times that are not negative");
+    }
+}
+
+const BenchmarkResult* Benchmark::run(const std::string& name, double flops, double bytes,
+                                      const std::function<void()>& function) {
+    if (!filter.empty() && name.find(filter) == std::string::npos) {
+        return nullptr;
+    }
+
+    // Warm-up, which also tells how long a call takes
+    size_t warmup_calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        function();
+        ++warmup_calls;
+    } while (secondsSince(start) < warmup_time);
+    double call_time = secondsSince(start) / warmup_calls;
+    size_t calls = call_time >= min_sample_time ? 1 : static_cast<size_t>(min_sample_time / std::max(call_time, 1e-9)) + 1;
+
+    std::vector<double> samples;
+    start = std::chrono::steady_clock::now();
+    while ((samples.size() < min_samples || secondsSince(start) < min_time) && samples.size() < max_samples) {
+        auto sample_start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < calls; ++c) {
+            function();
+        }
+        samples.push_back(secondsSince(sample_start) / calls);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result;
+    result.name = name;
+    result.samples = samples.size();
+    result.calls_per_sample = calls;
+    result.median = percentile(samples, 0.5);
+    result.p99 = percentile(samples, 0.99);
+    result.min = samples.front();
+    result.flops = flops;
+    result.bytes = bytes;
+    results.push_back(result);
+    return &results.back();
+}
+
+void Benchmark::print(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    out << std::left << std::setw(44) << "benchmark" << std::right
+        << std::setw(12) << "median us" << std::setw(12) << "p99 us"
+        << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::setw(10) << "samples" << "\n";
+    out << std::fixed;
+    for (const BenchmarkResult& r : results) {
+        out << std::left << std::setw(44) << r.name << std::right << std::setprecision(2)
+            << std::setw(12) << r.median * 1e6 << std::setw(12) << r.p99 * 1e6;
+        if (r.flops > 0.0) {
+            out << std::setw(10) << r.gflops();
+        } else {
+            out << std::setw(10) << "-";
+        }
+        if (r.bytes > 0.0) {
+            out << std::setw(10) << r.gbytes();
+        } else {
+            out << std::setw(10) << "-";
+        }
+        out << std::setw(10) << r.samples << "\n";
+    }
+    out.flags(flags);
+}
+
+void Benchmark::writeJson(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't write the benchmark results to " + path);
+    }
+
+    file << std::setprecision(9);
+    file << "{\n";
+    file << "  \"host\": " << jsonString(hostName()) << ",\n";
+#ifdef __VERSION__
+    file << "  \"compiler\": " << jsonString(__VERSION__) << ",\n";
+#endif
+    file << "  \"date\": " << jsonString(currentDate()) << ",\n";
+    file << "  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        file << (i == 0 ? "\n" : ",\n");
+        file << "    {\"name\": " << jsonString(r.name)
+             << ", \"samples\": " << r.samples
+             << ", \"calls_per_sample\": " << r.calls_per_sample
+             << ", \"median_s\": " << r.median
+             << ", \"p99_s\": " << r.p99
+             << ", \"min_s\": " << r.min
+             << ", \"flops\": " << r.flops
+             << ", \"bytes\": " << r.bytes
+             << ", \"gflops\": " << r.gflops()
+             << ", \"gbytes\": " << r.gbytes() << "}";
+    }
+    file << "\n  ]\n}\n";
+    if (!file) {
+        throw std::runtime_error("Can't write the benchmark results to " + path);
+    }
+}
+
+std::vector<BenchmarkResult> Benchmark::readJson(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't open " + path);
+    }
+
+    // writeJson puts every benchmark on its own line, the fields are found by their key
+    std::vector<BenchmarkResult> read;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.find("{\"name\": ") == std::string::npos) {
+            continue;
+        }
+        auto field = [&](const std::string& key) {
+            size_t at = line.find("\"" + key + "\": ");
+            if (at == std::string::npos) {
+                throw std::runtime_error(path + " is not a benchmark file, " + key + " is missing");
+            }
+            return at + key.size() + 4;
+        };
+        BenchmarkResult result;
+        size_t name_start = field("name") + 1;
+        size_t name_end = line.find('"', name_start);
+        if (name_end == std::string::npos) {
+            throw std::runtime_error(path + " is not a benchmark file, a name is not closed");
+        }
+        result.name = line.substr(name_start, name_end - name_start);
+        try {
+            result.samples = std::stoul(line.substr(field("samples")));
+            result.calls_per_sample = std::stoul(line.substr(field("calls_per_sample")));
+            result.median = std::stod(line.substr(field("median_s")));
+            result.p99 = std::stod(line.substr(field("p99_s")));
+            result.min = std::stod(line.substr(field("min_s")));
+            result.flops = std::stod(line.substr(field("flops")));
+            result.bytes = std::stod(line.substr(field("bytes")));
+        } catch (const std::logic_error&) {
+            throw std::runtime_error(path + " is not a benchmark file, a value of " + result.name + " is not a number");
+        }
+        read.push_back(result);
+    }
+    return read;
+}
+
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::string hostName() {
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "unknown";
+    }
+    return name;
+}
+
+std::string currentDate() {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    return date;
+}
+
+size_t peakMemory() {
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // Linux gives it in kilobytes
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
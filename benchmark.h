@@ -0,0 +1,90 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the timing harness of the benchmarks : a function is warmed up, then timed over many samples,
+// and the median and the 99th percentile of the samples are kept with the work they did (FLOPs and bytes),
+// so GFLOP/s and GB/s come with every result. The results are written as JSON to compare runs over time.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The measure of one benchmark, times are for one call of the function, in seconds
+struct BenchmarkResult {
+    std::string name;
+    size_t samples = 0;
+    size_t calls_per_sample = 0;
+    double median = 0.0;
+    double p99 = 0.0;
+    double min = 0.0;
+    double flops = 0.0;
+    double bytes = 0.0;
+
+    // Work per second at the median time, 0 when the benchmark did not count that work
+    double gflops() const { return median > 0.0 ? flops / median * 1e-9 : 0.0; }
+    double gbytes() const { return median > 0.0 ? bytes / median * 1e-9 : 0.0; }
+};
+
+class Benchmark {
+private:
+    std::string filter;
+    double warmup_time;
+    double min_time;
+    size_t min_samples;
+    std::vector<BenchmarkResult> results;
+
+public:
+    // Parameters :
+    // filter : only the benchmarks whose name contains it are run, all of them if empty
+    // warmup_time : seconds the function runs before being timed (caches, page faults, frequency scaling)
+    // min_time : seconds spent timing each benchmark, at least min_samples samples are taken anyway
+    // min_samples : number of samples the median and the percentiles are computed from, at least
+    //
+    // Throws std::invalid_argument if min_samples is 0 or a time is negative
+    explicit Benchmark(std::string filter = "", double warmup_time = 0.05, double min_time = 0.25, size_t min_samples = 20);
+
+    // Times a function, unless the filter skips it
+    // Fast functions are called several times per sample, so that a sample is long enough for the clock
+    //
+    // Parameters :
+    // name : name of the benchmark, in the form group/what/shape
+    // flops, bytes : floating point operations and bytes read or written by one call, 0 if not counted
+    // function : the work to time, called many times, it must be repeatable
+    // output : the result, also kept in results(), or nullptr if the benchmark was skipped
+    const BenchmarkResult* run(const std::string& name, double flops, double bytes, const std::function<void()>& function);
+
+    const std::vector<BenchmarkResult>& getResults() const { return results; }
+
+    // Prints the results as a table, one benchmark per line
+    void print(std::ostream& out) const;
+
+    // Writes the results as JSON : the host, the compiler, the date, then one object per benchmark
+    //
+    // Throws std::runtime_error if the file can't be written
+    void writeJson(const std::string& path) const { writeJson(path, results); }
+    static void writeJson(const std::string& path, const std::vector<BenchmarkResult>& results);
+
+    // Reads the results of a file written by writeJson
+    //
+    // Throws std::runtime_error if the file can't be read or was not written by writeJson
+    static std::vector<BenchmarkResult> readJson(const std::string& path);
+};
+
+// What the records of runs share with the benchmark results
+// jsonString : the text between quotes, with its quotes and backslashes escaped
+// hostName : the name of the machine, "unknown" if it can't be read
+// currentDate : the current UTC date and time, in ISO 8601
+// peakMemory : the largest resident memory of the process so far, in bytes, 0 if it can't be read
+std::string jsonString(const std::string& text);
+std::string hostName();
+std::string currentDate();
+size_t peakMemory();
+
+#endif //BENCHMARK_H
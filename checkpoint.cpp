@@ -0,0 +1,226 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "checkpoint.h"
+#include "mapped_file.h"
+#include "trace.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// Layout of a checkpoint file :
+// CheckpointHeader, the optimizer name, the generator state, then the parameters and each optimizer buffer
+// (param_count doubles each). Everything is written in the byte order of the machine.
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t epoch;
+    uint64_t batch;
+    uint64_t optimizer_steps;
+    uint64_t param_count;
+    uint32_t state_count;
+    uint32_t name_length;
+    uint32_t rng_length;
+    uint32_t reserved;
+};
+
+constexpr char checkpoint_magic[8] = {'D', 'M', 'B', 'R', 'C', 'K', 'P', 'T'};
+constexpr uint32_t checkpoint_version = 1;
+constexpr uint32_t checkpoint_byte_order = 0x01020304;
+
+// Copies an arena into a snapshot buffer, allocated on the first checkpoint and reused afterwards
+void copyInto(Arena& to, const Arena& from) {
+    if (to.size() != from.size()) {
+        to = Arena(from.size());
+    }
+    to.copyFrom(from);
+}
+
+void readExactly(std::ifstream& in, void* to, size_t bytes, const std::string& path) {
+    in.read(static_cast<char*>(to), static_cast<std::streamsize>(bytes));
+    if (!in.good()) {
+        throw std::runtime_error(path + " is a truncated checkpoint");
+    }
+}
+
+}
+
+Checkpointer::Checkpointer(std::string path)
+    : path(std::move(path)), pending(-1), writing(-1), stopping(false), written(0)
+{
+    writer = std::thread(&Checkpointer::writerLoop, this);
+}
+
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake_writer.notify_one();
+    writer.join();
+}
+
+void Checkpointer::snapshot(Network& net, const TrainingPosition& position) {
+    int slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+
+        // Fill the slot the writer is not busy with. A snapshot still waiting in it is replaced by this one,
+        // and it is taken out of the queue so the writer can't pick it up half filled.
+        slot = writing == -1 ? (pending == -1 ? 0 : pending) : 1 - writing;
+        pending = -1;
+    }
+
+    TRACE_SCOPE("checkpoint", "snapshot");
+    Snapshot& s = slots[slot];
+    Optimizer& optimizer = net.getOptimizer();
+    std::vector<Arena*> state = optimizer.stateBuffers(net.parameters().size());
+
+    s.position = position;
+    s.optimizer_name = optimizer.name();
+    s.optimizer_steps = optimizer.getSteps();
+    copyInto(s.params, net.parameters());
+    s.optimizer_state.resize(state.size());
+    for (size_t i = 0; i < state.size(); ++i) {
+        copyInto(s.optimizer_state[i], *state[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = slot;
+    }
+    wake_writer.notify_one();
+}
+
+void Checkpointer::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake_waiters.wait(lock, [this] { return (pending == -1 && writing == -1) || !error.empty(); });
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+size_t Checkpointer::count() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+void Checkpointer::writerLoop() {
+    TRACE_THREAD("checkpoint writer");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake_writer.wait(lock, [this] { return pending != -1 || stopping; });
+        if (pending == -1) {
+            // Stopping with nothing left to write
+            break;
+        }
+
+        writing = pending;
+        pending = -1;
+        lock.unlock();
+
+        std::string failure;
+        try {
+            TRACE_SCOPE("checkpoint", "write checkpoint");
+            writeSnapshot(slots[writing], path);
+        } catch (const std::exception& e) {
+            failure = e.what();
+        }
+
+        lock.lock();
+        writing = -1;
+        if (failure.empty()) {
+            ++written;
+        } else {
+            error = failure;
+        }
+        wake_waiters.notify_all();
+    }
+}
+
+void Checkpointer::writeSnapshot(const Snapshot& snapshot, const std::string& path) {
+    CheckpointHeader header {};
+    std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+    header.version = checkpoint_version;
+    header.byte_order = checkpoint_byte_order;
+    header.epoch = snapshot.position.epoch;
+    header.batch = snapshot.position.batch;
+    header.optimizer_steps = snapshot.optimizer_steps;
+    header.param_count = snapshot.params.size();
+    header.state_count = static_cast<uint32_t>(snapshot.optimizer_state.size());
+    header.name_length = static_cast<uint32_t>(snapshot.optimizer_name.size());
+    header.rng_length = static_cast<uint32_t>(snapshot.position.rng_state.size());
+
+    // Written next to the checkpoint then renamed over it, so a crash never leaves a half written checkpoint
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Can't open " + tmp_path + " for writing");
+        }
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(snapshot.optimizer_name.data(), header.name_length);
+        out.write(snapshot.position.rng_state.data(), header.rng_length);
+        out.write(reinterpret_cast<const char*>(snapshot.params.data()), snapshot.params.size() * sizeof(double));
+        for (const Arena& buffer : snapshot.optimizer_state) {
+            out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(double));
+        }
+
+        out.flush();
+        if (!out.good()) {
+            throw std::runtime_error("Can't write the checkpoint to " + tmp_path);
+        }
+    }
+
+    replaceFile(tmp_path, path);
+}
+
+TrainingPosition Checkpointer::restore(const std::string& path, Network& net) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Can't open " + path);
+    }
+
+    CheckpointHeader header {};
+    readExactly(in, &header, sizeof(header), path);
+    if (std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    if (header.byte_order != checkpoint_byte_order || header.version != checkpoint_version) {
+        throw std::runtime_error(path + " has an unsupported checkpoint version or byte order");
+    }
+
+    Optimizer& optimizer = net.getOptimizer();
+    std::vector<Arena*> state = optimizer.stateBuffers(net.parameters().size());
+    if (header.param_count != net.parameters().size()) {
+        throw std::runtime_error(path + " was taken from a network with another topology");
+    }
+
+    std::string name(header.name_length, '\0');
+    readExactly(in, name.data(), name.size(), path);
+    if (name != optimizer.name() || header.state_count != state.size()) {
+        throw std::runtime_error(path + " was taken with the optimizer " + name + ", not " + optimizer.name());
+    }
+
+    TrainingPosition position;
+    position.epoch = header.epoch;
+    position.batch = header.batch;
+    position.rng_state.resize(header.rng_length);
+    readExactly(in, position.rng_state.data(), position.rng_state.size(), path);
+
+    readExactly(in, net.parameters().data(), header.param_count * sizeof(double), path);
+    for (Arena* buffer : state) {
+        readExactly(in, buffer->data(), header.param_count * sizeof(double), path);
+    }
+    optimizer.setSteps(header.optimizer_steps);
+
+    return position;
+}
@@ -0,0 +1,102 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides training checkpoints : the parameters, the optimizer state, the position in the training
+// (epoch and batch) and the state of the random generator used to shuffle the data.
+// Taking a checkpoint only copies the state into one of two snapshot buffers, a background thread writes
+// it to disk while the training goes on, so the training loop never waits for the disk.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "network.h"
+
+// Where the training is : the next batch to train is batch of epoch
+// rng_state is the state of the shuffling generator at the start of the epoch (as written by operator<<),
+// so shuffling again from it gives back the order of the epoch
+struct TrainingPosition {
+    uint64_t epoch = 0;
+    uint64_t batch = 0;
+    std::string rng_state;
+};
+
+class Checkpointer {
+private:
+    struct Snapshot {
+        TrainingPosition position;
+        std::string optimizer_name;
+        uint64_t optimizer_steps = 0;
+        Arena params;
+        std::vector<Arena> optimizer_state;
+    };
+
+    std::string path;
+    Snapshot slots[2];
+
+    // Index of the slot waiting to be written and of the slot being written, -1 when there is none
+    int pending;
+    int writing;
+    bool stopping;
+    size_t written;
+    std::string error;
+
+    std::mutex mutex;
+    std::condition_variable wake_writer;
+    std::condition_variable wake_waiters;
+    std::thread writer;
+
+    void writerLoop();
+    static void writeSnapshot(const Snapshot& snapshot, const std::string& path);
+
+public:
+    // Starts the background writer
+    //
+    // Parameters :
+    // path : the checkpoint file, it is replaced atomically each time a checkpoint is written
+    explicit Checkpointer(std::string path);
+
+    // Waits for the last checkpoint to be written, then stops the writer
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // Takes a checkpoint of the network and its optimizer
+    // Only the copy into a snapshot buffer is done here, the write happens in the background.
+    // If a checkpoint is still waiting to be written, it is replaced by this newer one.
+    //
+    // Parameters :
+    // net : the network being trained
+    // position : where the training is
+    //
+    // Throws std::runtime_error if a previous checkpoint could not be written
+    void snapshot(Network& net, const TrainingPosition& position);
+
+    // Waits until every checkpoint taken so far is on disk
+    //
+    // Throws std::runtime_error if a checkpoint could not be written
+    void flush();
+
+    // Number of checkpoints written so far
+    size_t count();
+
+    // Restores a checkpoint into a network with the same topology and the same optimizer
+    //
+    // Parameters :
+    // path : the checkpoint file
+    // net : the network to restore, its parameters and optimizer state are overwritten
+    // output : the position to resume the training from
+    //
+    // Throws std::runtime_error if the file can't be read or does not match the network
+    static TrainingPosition restore(const std::string& path, Network& net);
+};
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,235 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "conv.h"
+#include "arena.h"
+#include "gemm.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+Conv2D::Conv2D(size_t channels, size_t height, size_t width, size_t filters, size_t window,
+               size_t stride, size_t padding, Activation activation)
+    : channels(channels), height(height), width(width), filters(filters), window(window),
+      stride(stride), padding(padding), out_height(0), out_width(0),
+      weights(filters, channels * window * window),
+      biases(filters, 1, 0.0),
+      grad_weights(filters, channels * window * window, 0.0),
+      grad_biases(filters, 1, 0.0),
+      patches(0, 0),
+      patch_grads(0, 0),
+      outputs(nullptr),
+      deltas(0, 0),
+      activation_id(activation),
+      fused(Activation::Identity)
+{
+    if (activation == Activation::Custom) {
+        throw std::invalid_argument("A convolution needs an activation chosen by id");
+    }
+    if (channels == 0 || height == 0 || width == 0 || filters == 0 || window == 0 || stride == 0) {
+        throw std::invalid_argument("The sizes of a convolution must not be 0");
+    }
+    if (window > height + 2 * padding || window > width + 2 * padding) {
+        throw std::invalid_argument("The kernel of a convolution must fit in the padded images");
+    }
+    out_height = (height + 2 * padding - window) / stride + 1;
+    out_width = (width + 2 * padding - window) / stride + 1;
+
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    initialize(gen);
+}
+
+void Conv2D::unroll(const Matrix& input) {
+    // Every value of a patch is a whole row of n values of the input (one pixel of every sample),
+    // so the patches are made of contiguous copies, and of zeros where the kernel is over the padding
+    const size_t n = input.numCols();
+    const size_t positions = out_height * out_width;
+    const double* in = input.data();
+    double* out = patches.data();
+
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t ky = 0; ky < window; ++ky) {
+            for (size_t kx = 0; kx < window; ++kx) {
+                const size_t r = (c * window + ky) * window + kx;
+                for (size_t oy = 0; oy < out_height; ++oy) {
+                    double* dst = out + (r * positions + oy * out_width) * n;
+                    const size_t iy = oy * stride + ky;
+                    if (iy < padding || iy >= height + padding) {
+                        std::fill(dst, dst + out_width * n, 0.0);
+                        continue;
+                    }
+                    const double* src_row = in + (c * height + iy - padding) * width * n;
+                    for (size_t ox = 0; ox < out_width; ++ox) {
+                        const size_t ix = ox * stride + kx;
+                        if (ix < padding || ix >= width + padding) {
+                            std::fill(dst + ox * n, dst + (ox + 1) * n, 0.0);
+                        } else {
+                            const double* src = src_row + (ix - padding) * n;
+                            std::copy(src, src + n, dst + ox * n);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Conv2D::fold(Matrix& grads) const {
+    // The reverse of unroll : a pixel under several positions of the kernel gets the sum of their gradients
+    const size_t n = grads.numCols();
+    const size_t positions = out_height * out_width;
+    const double* in = patch_grads.data();
+    double* out = grads.data();
+    std::fill(out, out + grads.size(), 0.0);
+
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t ky = 0; ky < window; ++ky) {
+            for (size_t kx = 0; kx < window; ++kx) {
+                const size_t r = (c * window + ky) * window + kx;
+                for (size_t oy = 0; oy < out_height; ++oy) {
+                    const size_t iy = oy * stride + ky;
+                    if (iy < padding || iy >= height + padding) {
+                        continue;
+                    }
+                    const double* src = in + (r * positions + oy * out_width) * n;
+                    double* dst_row = out + (c * height + iy - padding) * width * n;
+                    for (size_t ox = 0; ox < out_width; ++ox) {
+                        const size_t ix = ox * stride + kx;
+                        if (ix < padding || ix >= width + padding) {
+                            continue;
+                        }
+                        double* dst = dst_row + (ix - padding) * n;
+                        const double* g = src + ox * n;
+                        for (size_t j = 0; j < n; ++j) {
+                            dst[j] += g[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Conv2D::forwardInto(const Matrix& input, Matrix& output) {
+    checkForward(input, output);
+
+    const size_t n = input.numCols();
+    const size_t k = weights.numCols();
+    const size_t columns = out_height * out_width * n;
+
+    outputs = &output;
+    resizeFor(patches, k, columns);
+
+    // Z = W * patches, for every filter, every output pixel and every sample at once
+    unroll(input);
+    gemm(false, false, filters, columns, k, 1.0, weights.data(), k, patches.data(), columns, 0.0, output.data(), columns);
+
+    // Add the bias of each filter to its output channel and apply the activation function
+    for (size_t f = 0; f < filters; ++f) {
+        double* row = output.data() + f * columns;
+        activateRow(applied(), row, row, columns, biases(f, 0));
+    }
+}
+
+void Conv2D::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    const size_t n = outputs ? outputs->numCols() : 0;
+    checkBackward(dLoss_dOutput, dLoss_dInput, n);
+
+    const size_t k = weights.numCols();
+    const size_t columns = out_height * out_width * n;
+
+    // deltas = dActivation(outputs) * dLoss/dOutput, element by element
+    resizeFor(deltas, outputs->numRows(), n);
+    double* delta = deltas.data();
+    activationBackward(applied(), outputs->data(), dLoss_dOutput.data(), delta, deltas.size());
+
+    // dLoss/dWeights = deltas * patches^T, summed over every output pixel of every sample
+    // dLoss/dBiases = the sum of the deltas of each output channel
+    gemm(false, true, filters, k, columns, 1.0, delta, columns, patches.data(), columns, 0.0, grad_weights.data(), k);
+    for (size_t f = 0; f < filters; ++f) {
+        double sum = 0.0;
+        const double* row = delta + f * columns;
+        for (size_t j = 0; j < columns; ++j) {
+            sum += row[j];
+        }
+        grad_biases(f, 0) = sum;
+    }
+
+    // dLoss/dPatches = weights^T * deltas, then folded back onto the pixels of the input
+    if (dLoss_dInput) {
+        resizeFor(patch_grads, k, columns);
+        gemm(true, false, k, columns, filters, 1.0, weights.data(), k, delta, columns, 0.0, patch_grads.data(), columns);
+        fold(*dLoss_dInput);
+    }
+}
+
+OpCost Conv2D::forwardCost(size_t n) const {
+    const double k = weights.numCols();
+    const double columns = static_cast<double>(out_height * out_width * n);
+    // im2col, Z = W * patches, then the bias and the activation of every output
+    return {2.0 * filters * k * columns + 2.0 * filters * columns,
+            8.0 * (inputSize() * n + 2.0 * k * columns + filters * k + filters + 2.0 * filters * columns)};
+}
+
+OpCost Conv2D::backwardCost(size_t n, bool input_gradient) const {
+    const double k = weights.numCols();
+    const double columns = static_cast<double>(out_height * out_width * n);
+    // The deltas, dLoss/dWeights = deltas * patches^T and the sums of the deltas,
+    // then dLoss/dPatches = W^T * deltas folded back onto the input (col2im)
+    OpCost cost{2.0 * filters * k * columns + 2.0 * filters * columns,
+                8.0 * (3.0 * filters * columns + k * columns + filters * k + filters)};
+    if (input_gradient) {
+        cost.flops += 2.0 * filters * k * columns + k * columns;
+        cost.bytes += 8.0 * (filters * k + 2.0 * k * columns + inputSize() * n);
+    }
+    return cost;
+}
+
+bool Conv2D::fuseActivation(Activation id) {
+    if (activation_id != Activation::Identity || id == Activation::Custom) {
+        return id == Activation::Identity;
+    }
+    fused = id;
+    return true;
+}
+
+size_t Conv2D::parameterCount() const {
+    return Arena::padded(weights.size()) + Arena::padded(biases.size());
+}
+
+void Conv2D::bind(double* params, double* grads, bool copy_values) {
+    // Same layout as Dense : the biases start right after the (padded) filters, in both arenas
+    size_t biases_offset = Arena::padded(weights.size());
+
+    Matrix new_weights = Matrix::view(params, weights.numRows(), weights.numCols());
+    Matrix new_biases = Matrix::view(params + biases_offset, biases.numRows(), biases.numCols());
+    if (copy_values) {
+        new_weights = weights;
+        new_biases = biases;
+    }
+    weights.swap(new_weights);
+    biases.swap(new_biases);
+
+    Matrix new_grad_weights = Matrix::view(grads, weights.numRows(), weights.numCols());
+    Matrix new_grad_biases = Matrix::view(grads + biases_offset, biases.numRows(), biases.numCols());
+    grad_weights.swap(new_grad_weights);
+    grad_biases.swap(new_grad_biases);
+    std::fill(grad_weights.data(), grad_weights.data() + grad_weights.size(), 0.0);
+    std::fill(grad_biases.data(), grad_biases.data() + grad_biases.size(), 0.0);
+}
+
+void Conv2D::initialize(std::mt19937& gen) {
+    double limit = std::sqrt(6.0 / static_cast<double>(channels * window * window));
+    std::uniform_real_distribution<> dist(-limit, limit);
+    for (size_t i = 0; i < weights.size(); ++i) {
+        weights.data()[i] = dist(gen);
+    }
+    std::fill(biases.data(), biases.data() + biases.size(), 0.0);
+}
+
+LayerSpec Conv2D::spec() const {
+    return LayerSpec::conv2d(channels, height, width, filters, window, stride, padding, activation_id);
+}
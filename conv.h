@@ -0,0 +1,96 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a Conv2D class, a 2D convolution layer over images, lowered onto the matrix product (im2col) :
+// the patches of the images under every position of the kernel are unrolled into the columns of a matrix,
+// the convolution of the whole batch is then one product of the filters with that matrix, done by gemm.
+// The patches are laid out so the product lands straight in the layout of the outputs, one sample per column.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef CONV_H
+#define CONV_H
+
+#include "layer.h"
+
+class Conv2D : public Layer {
+private:
+    size_t channels;
+    size_t height;
+    size_t width;
+    size_t filters;
+    size_t window;
+    size_t stride;
+    size_t padding;
+    size_t out_height;
+    size_t out_width;
+
+    // Filters are stored as a matrix of size (filters, channels * window * window), one filter per row,
+    // and biases of size (filters, 1), one per output channel
+    // For a batch of n samples, the unrolled patches are of size (channels * window * window, out_height * out_width * n) :
+    // the column of the patch at output pixel p of sample s is p * n + s, so filters * patches is a
+    // (filters, out_height * out_width * n) matrix which is exactly the (filters * out_height * out_width, n) output
+    // The outputs, deltas, gradients and activations work like the ones of Dense
+    // Backward only needs the patches, not the inputs
+    Matrix weights;
+    Matrix biases;
+    Matrix grad_weights;
+    Matrix grad_biases;
+    Matrix patches;
+    Matrix patch_grads;
+    const Matrix* outputs;
+    Matrix deltas;
+
+    Activation activation_id;
+    Activation fused;
+
+    Activation applied() const { return activation_id == Activation::Identity ? fused : activation_id; }
+
+    // Unrolls the patches of a batch into patches (im2col)
+    void unroll(const Matrix& input);
+
+    // Adds the gradients of the patches back to the pixels they were taken from (col2im)
+    void fold(Matrix& grads) const;
+
+public:
+    // Parameters :
+    // channels, height, width : the input images, a sample is a column of channels * height * width values
+    // filters : number of filters, which is the number of output channels
+    // window : size of the square kernel of the filters
+    // stride : number of pixels the kernel moves by
+    // padding : number of zeros added on every side of the images
+    // activation : the activation applied to the outputs
+    //
+    // Throws std::invalid_argument if a size is 0 or the kernel does not fit in the padded images
+    Conv2D(size_t channels, size_t height, size_t width, size_t filters, size_t window,
+           size_t stride, size_t padding, Activation activation);
+
+    size_t inputSize() const override { return channels * height * width; }
+    size_t outputSize() const override { return filters * out_height * out_width; }
+    size_t outputHeight() const { return out_height; }
+    size_t outputWidth() const { return out_width; }
+
+    void forwardInto(const Matrix& input, Matrix& output) override;
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+    bool keepsOutput() const override { return applied() != Activation::Identity; }
+    bool fuseActivation(Activation id) override;
+
+    // The products of the filters with the unrolled patches, with the patches written by im2col and read back
+    OpCost forwardCost(size_t n) const override;
+    OpCost backwardCost(size_t n, bool input_gradient) const override;
+
+    // The filters, then the biases, each of them padded so it starts on its own cache line
+    size_t parameterCount() const override;
+    void bind(double* params, double* grads, bool copy_values = true) override;
+
+    // He initialization, uniform : the variance of the outputs stays the same from one ReLU layer to the next
+    // The biases start at zero
+    void initialize(std::mt19937& gen) override;
+
+    LayerSpec spec() const override;
+
+    const Matrix& getWeights() const { return weights; }
+    const Matrix& getBiases() const { return biases; }
+};
+
+#endif //CONV_H
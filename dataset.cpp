@@ -0,0 +1,505 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "dataset.h"
+#include "mapped_file.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+// Layout of a binary dataset file :
+// DatasetHeader, then count labels at labels_offset, then count * features values at pixels_offset
+// Both offsets are multiples of 64. The source fields describe the CSV a cache was made from, they are zero otherwise.
+struct DatasetHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t count;
+    uint64_t features;
+    uint64_t labels_offset;
+    uint64_t pixels_offset;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+};
+
+constexpr char dataset_magic[8] = {'D', 'M', 'B', 'R', 'D', 'S', 'E', 'T'};
+constexpr uint32_t dataset_version = 1;
+constexpr uint32_t dataset_byte_order = 0x01020304;
+
+uint64_t alignUp(uint64_t n, uint64_t alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Asks the CPU to start loading the cache line holding p, for a read, without waiting for it
+inline void prefetch(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p, 0, 3);
+#else
+    (void)p;
+#endif
+}
+
+// FNV-1a hash of a whole file, used to check a cache against its CSV by content
+uint64_t hashFile(const std::string& path) {
+    MappedFile file(path);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint8_t* bytes = file.data();
+    for (size_t i = 0; i < file.size(); ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void writeDatasetFile(const Dataset& dataset, const std::string& path, DatasetHeader header) {
+    std::memcpy(header.magic, dataset_magic, sizeof(dataset_magic));
+    header.version = dataset_version;
+    header.byte_order = dataset_byte_order;
+    header.count = dataset.size();
+    header.features = dataset.numFeatures();
+    header.labels_offset = alignUp(sizeof(header), 64);
+    header.pixels_offset = alignUp(header.labels_offset + header.count, 64);
+
+    // Written next to the file then renamed over it, so a reader never maps a half written file
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Can't open " + tmp_path + " for writing");
+        }
+
+        std::vector<char> padding(64, 0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(padding.data(), header.labels_offset - sizeof(header));
+        out.write(reinterpret_cast<const char*>(dataset.labelData()), header.count);
+        out.write(padding.data(), header.pixels_offset - header.labels_offset - header.count);
+        out.write(reinterpret_cast<const char*>(dataset.pixelData()), header.count * header.features);
+
+        out.flush();
+        if (!out.good()) {
+            throw std::runtime_error("Can't write the dataset to " + tmp_path);
+        }
+    }
+
+    replaceFile(tmp_path, path);
+}
+
+// Reads a big-endian 32 bits integer, as stored in IDX headers
+uint32_t readBigEndian(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// Checks the header of a uint8 IDX file and returns its dimensions
+// The magic number is two zero bytes, the type of the values (0x08 for uint8) and the number of dimensions
+std::vector<uint64_t> idxDimensions(const MappedFile& file, const std::string& path) {
+    const uint8_t* bytes = file.data();
+    if (file.size() < 4 || bytes[0] != 0 || bytes[1] != 0) {
+        throw std::runtime_error(path + " is not an IDX file");
+    }
+    if (bytes[2] != 0x08) {
+        throw std::runtime_error(path + " does not hold uint8 values");
+    }
+
+    size_t ndims = bytes[3];
+    if (ndims == 0 || file.size() < 4 + 4 * ndims) {
+        throw std::runtime_error(path + " has a truncated IDX header");
+    }
+
+    // The number of values can't wrap around : a crafted header would then pass for a short file
+    // and the views on it would read past the mapping
+    std::vector<uint64_t> dims(ndims);
+    uint64_t total = 1;
+    bool overflow = false;
+    for (size_t i = 0; i < ndims; ++i) {
+        dims[i] = readBigEndian(bytes + 4 + 4 * i);
+        overflow = overflow || __builtin_mul_overflow(total, dims[i], &total);
+    }
+    const uint64_t header = 4 + 4 * ndims;
+    if (overflow || total > file.size() - header) {
+        throw std::runtime_error(path + " is a truncated IDX file");
+    }
+    return dims;
+}
+
+// A line-aligned piece of a CSV file, and the rows it fills in the dataset
+struct Chunk {
+    const char* begin;
+    const char* end;
+    size_t first_row;
+};
+
+// Returns the start of the line after the one p is in, or end
+const char* nextLine(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', end - p);
+    return newline ? static_cast<const char*>(newline) + 1 : end;
+}
+
+// End of the content of the line starting at p : before the '\n' and the '\r' of Windows files
+const char* lineEnd(const char* p, const char* next) {
+    const char* e = next;
+    while (e > p && (e[-1] == '\n' || e[-1] == '\r')) {
+        --e;
+    }
+    return e;
+}
+
+size_t countRows(const char* begin, const char* end) {
+    size_t rows = 0;
+    for (const char* p = begin; p < end; ) {
+        const char* next = nextLine(p, end);
+        // Empty lines (usually at the end of the file) are not rows
+        if (lineEnd(p, next) != p) {
+            ++rows;
+        }
+        p = next;
+    }
+    return rows;
+}
+
+void parseRows(const Chunk& chunk, size_t features, uint8_t* pixels, uint8_t* labels) {
+    size_t row = chunk.first_row;
+    for (const char* p = chunk.begin; p < chunk.end; ) {
+        const char* next = nextLine(p, chunk.end);
+        const char* e = lineEnd(p, next);
+        if (e == p) {
+            p = next;
+            continue;
+        }
+
+        // The label comes first, then the features values, each written straight into the dataset
+        uint8_t* out = pixels + row * features;
+        for (size_t col = 0; col <= features; ++col) {
+            unsigned value = 0;
+            auto [ptr, ec] = std::from_chars(p, e, value);
+            if (ec != std::errc() || value > 255) {
+                throw std::runtime_error("Row " + std::to_string(row + 1) + ", column " + std::to_string(col + 1)
+                                         + " is not an integer in [0, 255]");
+            }
+            if (col == 0) {
+                labels[row] = static_cast<uint8_t>(value);
+            } else {
+                out[col - 1] = static_cast<uint8_t>(value);
+            }
+
+            p = ptr;
+            if (col < features) {
+                if (p == e || *p != ',') {
+                    throw std::runtime_error("Row " + std::to_string(row + 1) + " has less than "
+                                             + std::to_string(features + 1) + " values");
+                }
+                ++p;
+            }
+        }
+        if (p != e) {
+            throw std::runtime_error("Row " + std::to_string(row + 1) + " has more than "
+                                     + std::to_string(features + 1) + " values");
+        }
+
+        ++row;
+        p = next;
+    }
+}
+
+}
+
+Dataset::Dataset()
+    : count(0), features(0), pixels(nullptr), labels(nullptr)
+{
+}
+
+Dataset::Dataset(size_t count, size_t features)
+    : count(count), features(features),
+      pixel_storage(count * features, 0), label_storage(count, 0),
+      pixels(pixel_storage.data()), labels(label_storage.data())
+{
+}
+
+void Dataset::gather(const size_t* indices, size_t n, Matrix& out, double scale) const {
+    for (size_t j = 0; j < n; ++j) {
+        if (indices[j] >= count) {
+            throw std::out_of_range("Sample index out of the dataset");
+        }
+    }
+    if (out.numRows() != features || out.numCols() != n) {
+        out = Matrix(features, n);
+    }
+
+    // Each row of the batch is one feature of every sample. The samples are taken 8 at a time, so every
+    // feature read from the 8 rows of the dataset gives 8 contiguous values of the batch.
+    // The rows of a shuffled batch are scattered over the dataset, so while a block of 8 samples is converted
+    // the rows of the next block are prefetched, one cache line of each every 64 features
+    double* values = out.data();
+    size_t j0 = 0;
+    for (; j0 + 8 <= n; j0 += 8) {
+        const uint8_t* src[8];
+        const uint8_t* next[8];
+        size_t next_count = std::min<size_t>(8, n - j0 - 8);
+        for (size_t k = 0; k < 8; ++k) {
+            src[k] = sample(indices[j0 + k]);
+            next[k] = k < next_count ? sample(indices[j0 + 8 + k]) : src[k];
+        }
+        for (size_t f = 0; f < features; ++f) {
+            if (f % 64 == 0) {
+                for (size_t k = 0; k < next_count; ++k) {
+                    prefetch(next[k] + f);
+                }
+            }
+            double* row = values + f * n + j0;
+            for (size_t k = 0; k < 8; ++k) {
+                row[k] = src[k][f] * scale;
+            }
+        }
+    }
+    for (; j0 < n; ++j0) {
+        const uint8_t* src = sample(indices[j0]);
+        for (size_t f = 0; f < features; ++f) {
+            values[f * n + j0] = src[f] * scale;
+        }
+    }
+}
+
+void Dataset::gatherTargets(const size_t* indices, size_t n, size_t classes, Matrix& out) const {
+    if (out.numRows() != classes || out.numCols() != n) {
+        out = Matrix(classes, n);
+    }
+
+    double* values = out.data();
+    std::fill(values, values + classes * n, 0.0);
+    for (size_t j = 0; j < n; ++j) {
+        if (indices[j] >= count || labels[indices[j]] >= classes) {
+            throw std::out_of_range("Sample index out of the dataset or label out of the classes");
+        }
+        values[labels[indices[j]] * n + j] = 1.0;
+    }
+}
+
+uint8_t* Dataset::mutablePixelData() {
+    if (owner) {
+        throw std::logic_error("A mapped dataset is read only");
+    }
+    return pixel_storage.data();
+}
+
+uint8_t* Dataset::mutableLabelData() {
+    if (owner) {
+        throw std::logic_error("A mapped dataset is read only");
+    }
+    return label_storage.data();
+}
+
+Dataset Dataset::loadCsv(const std::string& path, size_t threads) {
+    MappedFile file(path);
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+
+    // Skip the header, if the first line does not start with a number
+    const char* data = begin;
+    if (data < end && (*data < '0' || *data > '9')) {
+        data = nextLine(data, end);
+    }
+    if (data == end) {
+        return Dataset();
+    }
+
+    // The first row gives the number of columns : the label then the features
+    const char* first_end = lineEnd(data, nextLine(data, end));
+    size_t features = static_cast<size_t>(std::count(data, first_end, ','));
+    if (features == 0) {
+        throw std::runtime_error(path + " has no feature column");
+    }
+
+    // Split the file into chunks of at least 1 MB, each one starting at the beginning of a line
+    if (threads == 0) {
+        threads = Scheduler::instance().numThreads();
+    }
+    const size_t min_chunk = size_t(1) << 20;
+    size_t n = std::clamp<size_t>((end - data) / min_chunk, 1, threads);
+
+    std::vector<Chunk> chunks(n);
+    for (size_t i = 0; i < n; ++i) {
+        const char* b = data + (end - data) * i / n;
+        chunks[i].begin = i == 0 ? data : nextLine(b - 1, end);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        chunks[i].end = i + 1 < n ? chunks[i + 1].begin : end;
+    }
+
+    // First pass : count the rows of each chunk, so every chunk knows where its rows go in the dataset
+    std::vector<size_t> rows(n);
+    parallelFor(0, n, 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            rows[i] = countRows(chunks[i].begin, chunks[i].end);
+        }
+    });
+
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        chunks[i].first_row = total;
+        total += rows[i];
+    }
+
+    // Second pass : parse every chunk straight into the preallocated dataset
+    Dataset dataset(total, features);
+    uint8_t* pixels = dataset.pixel_storage.data();
+    uint8_t* labels = dataset.label_storage.data();
+    try {
+        parallelFor(0, n, 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                parseRows(chunks[i], features, pixels, labels);
+            }
+        });
+    } catch (const std::exception& e) {
+        throw std::runtime_error(path + " : " + e.what());
+    }
+
+    return dataset;
+}
+
+void Dataset::saveBinary(const std::string& path) const {
+    writeDatasetFile(*this, path, DatasetHeader {});
+}
+
+namespace {
+
+// Checks the header of a binary dataset file of size bytes
+void checkHeader(const DatasetHeader& header, uint64_t size, const std::string& path) {
+    if (std::memcmp(header.magic, dataset_magic, sizeof(dataset_magic)) != 0) {
+        throw std::runtime_error(path + " is not a dataset file");
+    }
+    if (header.byte_order != dataset_byte_order || header.version != dataset_version) {
+        throw std::runtime_error(path + " has an unsupported dataset version or byte order");
+    }
+    // Nothing is added up : a crafted header could wrap a sum around and pass for a short file,
+    // the views on it would then read past the mapping
+    uint64_t pixels = 0;
+    bool overflow = __builtin_mul_overflow(header.count, header.features, &pixels);
+    if (overflow || header.labels_offset > size || header.count > size - header.labels_offset
+        || header.pixels_offset > size || pixels > size - header.pixels_offset) {
+        throw std::runtime_error(path + " is a truncated dataset file");
+    }
+}
+
+}
+
+Dataset Dataset::loadBinary(const std::string& path) {
+    auto file = std::make_shared<MappedFile>(path);
+
+    DatasetHeader header {};
+    if (file->size() < sizeof(header)) {
+        throw std::runtime_error(path + " is too small to be a dataset file");
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    checkHeader(header, file->size(), path);
+
+    // The dataset points into the mapping, and keeps it alive
+    Dataset dataset;
+    dataset.count = header.count;
+    dataset.features = header.features;
+    dataset.labels = file->data() + header.labels_offset;
+    dataset.pixels = file->data() + header.pixels_offset;
+    dataset.owner = file;
+    return dataset;
+}
+
+DatasetFileInfo Dataset::readBinaryInfo(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Can't open " + path);
+    }
+
+    DatasetHeader header {};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good()) {
+        throw std::runtime_error(path + " is too small to be a dataset file");
+    }
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        throw std::runtime_error("Can't read the size of " + path);
+    }
+    checkHeader(header, size, path);
+
+    return {header.count, header.features, header.labels_offset, header.pixels_offset};
+}
+
+Dataset Dataset::loadCached(const std::string& path, CacheCheck check, size_t threads) {
+    namespace fs = std::filesystem;
+    std::string cache_path = path + ".cache";
+
+    std::error_code ec;
+    uint64_t source_size = fs::file_size(path, ec);
+    if (ec) {
+        throw std::runtime_error("Can't open " + path);
+    }
+    int64_t source_mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+
+    // Use the cache if its header still describes the CSV
+    std::ifstream cache(cache_path, std::ios::binary);
+    if (cache.is_open()) {
+        DatasetHeader header {};
+        cache.read(reinterpret_cast<char*>(&header), sizeof(header));
+        bool valid = cache.good()
+                     && std::memcmp(header.magic, dataset_magic, sizeof(dataset_magic)) == 0
+                     && header.source_size == source_size
+                     && header.source_mtime == source_mtime
+                     && (check == CacheCheck::Metadata || header.source_hash == hashFile(path));
+        cache.close();
+
+        if (valid) {
+            try {
+                return loadBinary(cache_path);
+            } catch (const std::exception&) {
+                // A broken cache is rebuilt below
+            }
+        }
+    }
+
+    Dataset dataset = loadCsv(path, threads);
+
+    DatasetHeader header {};
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.source_hash = hashFile(path);
+    try {
+        writeDatasetFile(dataset, cache_path, header);
+    } catch (const std::exception& e) {
+        std::cerr << "Warning : " << e.what() << ", the dataset will be parsed again next time" << std::endl;
+    }
+
+    return dataset;
+}
+
+Dataset Dataset::loadIdx(const std::string& images_path, const std::string& labels_path) {
+    auto images = std::make_shared<MappedFile>(images_path);
+    auto labels = std::make_shared<MappedFile>(labels_path);
+
+    std::vector<uint64_t> image_dims = idxDimensions(*images, images_path);
+    std::vector<uint64_t> label_dims = idxDimensions(*labels, labels_path);
+    if (image_dims.size() < 2) {
+        throw std::runtime_error(images_path + " must have a dimension for the samples and one for their values");
+    }
+    if (label_dims.size() != 1 || label_dims[0] != image_dims[0]) {
+        throw std::runtime_error(labels_path + " does not hold one label per sample of " + images_path);
+    }
+
+    // The values start right after the header, the dataset points straight into both mappings
+    // and keeps them alive together
+    Dataset dataset;
+    dataset.count = image_dims[0];
+    dataset.features = 1;
+    for (size_t i = 1; i < image_dims.size(); ++i) {
+        dataset.features *= image_dims[i];
+    }
+    dataset.pixels = images->data() + 4 + 4 * image_dims.size();
+    dataset.labels = labels->data() + 4 + 4 * label_dims.size();
+    dataset.owner = std::make_shared<std::pair<std::shared_ptr<MappedFile>, std::shared_ptr<MappedFile>>>(images, labels);
+    return dataset;
+}
@@ -0,0 +1,167 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a Dataset class holding labelled samples (for example MNIST images) in one contiguous
+// row-major block of uint8 values, with one uint8 label per sample, about 8 times smaller than doubles.
+// Batches are gathered from it into the (features, batch) matrices the Network works on.
+// It also provides the loaders : the CSV loader maps the file in memory and parses line-aligned
+// chunks of it in parallel, straight into the preallocated block. A parsed dataset can be kept in a
+// compact binary cache file, which later runs map in memory instead of parsing the CSV again.
+// The IDX files of the original MNIST distribution are mapped and used as they are, without any copy.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "matrix.h"
+
+// How a cache file is checked against the CSV it was made from
+// Metadata compares the size and the modification time of the CSV, Content also hashes the whole CSV
+enum class CacheCheck {
+    Metadata,
+    Content
+};
+
+// Where the samples of a binary dataset file are, as read from its header
+struct DatasetFileInfo {
+    uint64_t count;
+    uint64_t features;
+    uint64_t labels_offset;
+    uint64_t pixels_offset;
+};
+
+class Dataset {
+private:
+    size_t count;
+    size_t features;
+
+    // The samples either live in the storage vectors, or in memory kept alive by owner (a mapped file)
+    std::vector<uint8_t> pixel_storage;
+    std::vector<uint8_t> label_storage;
+    std::shared_ptr<void> owner;
+    const uint8_t* pixels;
+    const uint8_t* labels;
+
+public:
+    // Creates an empty dataset
+    Dataset();
+
+    // Creates a dataset of count samples of features values each, all set to zero
+    //
+    // Parameters :
+    // count : number of samples
+    // features : number of values per sample (784 for MNIST)
+    Dataset(size_t count, size_t features);
+
+    // The sample pointers may point into the storage of the dataset, so it can be moved but not copied
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
+    Dataset(Dataset&&) = default;
+    Dataset& operator=(Dataset&&) = default;
+
+    size_t size() const { return count; }
+    size_t numFeatures() const { return features; }
+
+    // Returns the features values of the ith sample, without bounds checking
+    const uint8_t* sample(size_t i) const { return pixels + i * features; }
+
+    // Returns the label of the ith sample, without bounds checking
+    uint8_t label(size_t i) const { return labels[i]; }
+
+    // Raw access to all the samples (size() * numFeatures() values) and all the labels (size() values)
+    const uint8_t* pixelData() const { return pixels; }
+    const uint8_t* labelData() const { return labels; }
+
+    // Gathers a batch of samples into a matrix of size (numFeatures(), n), one column per sample,
+    // converting the uint8 values to doubles multiplied by scale in the same pass
+    //
+    // Parameters :
+    // indices : the indices of the n samples, in the order of the columns (for example a slice of a shuffled order)
+    // n : number of samples in the batch
+    // out : the batch, resized if it does not have the right size
+    // scale : factor applied to every value, 1 / 255 by default to normalize the pixels to [0, 1]
+    //
+    // Throws std::out_of_range if an index is not a sample of the dataset
+    void gather(const size_t* indices, size_t n, Matrix& out, double scale = 1.0 / 255.0) const;
+
+    // Gathers the labels of a batch as one-hot targets : a matrix of size (classes, n) where
+    // the column of each sample is 1.0 on the row of its label and 0.0 elsewhere
+    //
+    // Parameters :
+    // indices : the indices of the n samples, in the order of the columns
+    // n : number of samples in the batch
+    // classes : number of classes (10 for MNIST)
+    // out : the targets, resized if it does not have the right size
+    //
+    // Throws std::out_of_range if an index is not a sample of the dataset or a label is not below classes
+    void gatherTargets(const size_t* indices, size_t n, size_t classes, Matrix& out) const;
+
+    // Write access, only for datasets owning their samples (not mapped ones)
+    //
+    // Throws std::logic_error if the dataset does not own its samples
+    uint8_t* mutablePixelData();
+    uint8_t* mutableLabelData();
+
+    // Loads a CSV file where each line is a label followed by the feature values, all integers in [0, 255]
+    // A first line that is not numeric (a header) is skipped. The file is mapped in memory, split into
+    // line-aligned chunks, and the chunks are parsed in parallel (on the scheduler, see scheduler.h) with std::from_chars.
+    //
+    // Parameters :
+    // path : the CSV file
+    // threads : number of chunks parsed in parallel, 0 for one per thread of the scheduler
+    //
+    // Throws std::runtime_error if the file can't be read, has lines with another number of values,
+    // or values that are not integers in [0, 255]
+    static Dataset loadCsv(const std::string& path, size_t threads = 0);
+
+    // Writes the dataset to a binary file : a header, the labels, then the samples, as uint8 values
+    //
+    // Parameters :
+    // path : the file to write, replaced atomically
+    //
+    // Throws std::runtime_error if the file can't be written
+    void saveBinary(const std::string& path) const;
+
+    // Maps a binary file written by saveBinary, the samples are read straight from the mapped pages
+    //
+    // Throws std::runtime_error if the file can't be read or is not a dataset file
+    static Dataset loadBinary(const std::string& path);
+
+    // Reads only the header of a binary file written by saveBinary (for example a CSV cache), to read its
+    // samples piece by piece instead of mapping the whole file (see ShardStream)
+    //
+    // Throws std::runtime_error if the file can't be read or is not a dataset file
+    static DatasetFileInfo readBinaryInfo(const std::string& path);
+
+    // Loads a CSV file through its binary cache, path + ".cache"
+    // If the cache exists and still matches the CSV, it is mapped. Otherwise the CSV is parsed with loadCsv
+    // and the cache is written for the next time (a cache that can't be written is not an error).
+    //
+    // Parameters :
+    // path : the CSV file
+    // check : how the cache is checked against the CSV, see CacheCheck
+    // threads : number of chunks parsed in parallel if the CSV has to be parsed, 0 for one per thread of the scheduler
+    //
+    // Throws std::runtime_error if the CSV has to be parsed and can't be (see loadCsv)
+    static Dataset loadCached(const std::string& path, CacheCheck check = CacheCheck::Metadata, size_t threads = 0);
+
+    // Maps a pair of IDX files (the format of the original MNIST files, for example train-images-idx3-ubyte
+    // and train-labels-idx1-ubyte). The dataset is a read only view of the mapped files, nothing is copied.
+    // The images file holds uint8 values with at least 2 dimensions (count, then the dimensions of a sample,
+    // which are flattened), the labels file holds count uint8 values. The header is big-endian.
+    //
+    // Parameters :
+    // images_path : the IDX file of the samples
+    // labels_path : the IDX file of the labels
+    //
+    // Throws std::runtime_error if the files can't be read, are not uint8 IDX files, or do not have the same count
+    static Dataset loadIdx(const std::string& images_path, const std::string& labels_path);
+};
+
+#endif //DATASET_H
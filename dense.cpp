@@ -0,0 +1,179 @@
+//
+// Created by Mazen Messai on 09/06/2025.
+//
+// This file is released under the MIT License.
+//
+
+#include "dense.h"
+#include "arena.h"
+#include "gemm.h"
+#include <algorithm>
+#include <random>
+
+// Bias and weights are initialized, the gradients are initialized to zero
+Dense::Dense(size_t in_size, size_t out_size,
+             std::function<double(double)> activation,
+             std::function<double(double)> activation_deriv)
+    : weights(out_size, in_size),
+      biases(out_size, 1, 0.0),
+      grad_weights(out_size, in_size, 0.0),
+      grad_biases(out_size, 1, 0.0),
+      inputs(nullptr),
+      outputs(nullptr),
+      deltas(out_size, 1, 0.0),
+      activation(activation),
+      activation_deriv(activation_deriv),
+      activation_id(Activation::Custom),
+      fused(Activation::Identity)
+{
+    // Initialize weights with random values in the range [-1, 1]
+    // Using a random device and Mersenne Twister for better randomness
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    initialize(gen);
+}
+
+Dense::Dense(size_t in_size, size_t out_size, Activation activation)
+    : Dense(in_size, out_size, activationFunction(activation), activationDerivative(activation))
+{
+    activation_id = activation;
+}
+
+void Dense::forwardInto(const Matrix& input, Matrix& output) {
+    // Just some checks to ensure the input is a batch of columns of the correct size
+    checkForward(input, output);
+
+    const size_t in_size = weights.numCols();
+    const size_t out_size = weights.numRows();
+    const size_t n = input.numCols();
+
+    // Keep track of the inputs, backward needs them for the gradient of the weights
+    inputs = &input;
+    outputs = &output;
+
+    // Compute the linear combination of inputs and weights, for every sample of the batch at once
+    // In other words, it computes Z = W * X, then adds the biases to every column
+    gemm(false, false, out_size, n, in_size, 1.0, weights.data(), in_size, input.data(), n, 0.0, output.data(), n);
+
+    // Add the bias and apply the activation function to each element of the outputs
+    // A softmax is a layer of its own (see activation_layer.h), the activation here is applied element-wise
+    const Activation id = applied();
+    for (size_t i = 0; i < out_size; ++i) {
+        double b = biases(i, 0);
+        double* row = output.data() + i * n;
+        if (id == Activation::Custom) {
+            for (size_t j = 0; j < n; ++j) {
+                row[j] = activation(row[j] + b);
+            }
+        } else {
+            activateRow(id, row, row, n, b);
+        }
+    }
+}
+
+void Dense::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    const size_t in_size = weights.numCols();
+    const size_t out_size = weights.numRows();
+    const size_t n = outputs ? outputs->numCols() : 0;
+    checkBackward(dLoss_dOutput, dLoss_dInput, n);
+
+    // Compute the deltas for the layer
+    // deltas = dActivation(outputs) * dLoss/dOutput, element by element
+    resizeFor(deltas, out_size, n);
+    const double* out = outputs->data();
+    const double* grad = dLoss_dOutput.data();
+    double* delta = deltas.data();
+    if (applied() == Activation::Custom) {
+        for (size_t i = 0; i < out_size * n; ++i) {
+            delta[i] = activation_deriv(out[i]) * grad[i];
+        }
+    } else {
+        activationBackward(applied(), out, grad, delta, out_size * n);
+    }
+
+    // Compute the gradient of the loss with respect to the weights and biases, summed over the batch
+    // dLoss/dWeights = deltas * inputs^T and dLoss/dBiases = the sum of the columns of deltas
+    // They are kept in grad_weights and grad_biases, which may be views into the gradient arena of the network
+    gemm(false, true, out_size, in_size, n, 1.0, delta, n, inputs->data(), n, 0.0, grad_weights.data(), in_size);
+    for (size_t i = 0; i < out_size; ++i) {
+        double sum = 0.0;
+        for (size_t j = 0; j < n; ++j) {
+            sum += delta[i * n + j];
+        }
+        grad_biases(i, 0) = sum;
+    }
+
+    // Compute the gradient of the loss with respect to the inputs, for the previous layer
+    // dLoss/dInput = weights^T * deltas
+    if (dLoss_dInput) {
+        gemm(true, false, in_size, n, out_size, 1.0, weights.data(), in_size, delta, n, 0.0, dLoss_dInput->data(), n);
+    }
+}
+
+bool Dense::fuseActivation(Activation id) {
+    if (activation_id != Activation::Identity || id == Activation::Custom) {
+        return id == Activation::Identity;
+    }
+    fused = id;
+    return true;
+}
+
+OpCost Dense::forwardCost(size_t n) const {
+    const double in_size = weights.numCols();
+    const double out_size = weights.numRows();
+    // Z = W * X, then the bias and the activation of every output
+    return {2.0 * out_size * in_size * n + 2.0 * out_size * n,
+            8.0 * (out_size * in_size + out_size + in_size * n + out_size * n)};
+}
+
+OpCost Dense::backwardCost(size_t n, bool input_gradient) const {
+    const double in_size = weights.numCols();
+    const double out_size = weights.numRows();
+    // The deltas, dLoss/dWeights = deltas * X^T, the sums of the deltas, and dLoss/dInput = W^T * deltas
+    OpCost cost{2.0 * out_size * in_size * n + 2.0 * out_size * n,
+                8.0 * (3.0 * out_size * n + in_size * n + out_size * in_size + out_size)};
+    if (input_gradient) {
+        cost.flops += 2.0 * out_size * in_size * n;
+        cost.bytes += 8.0 * (out_size * in_size + in_size * n);
+    }
+    return cost;
+}
+
+size_t Dense::parameterCount() const {
+    return Arena::padded(weights.size()) + Arena::padded(biases.size());
+}
+
+void Dense::bind(double* params, double* grads, bool copy_values) {
+    // The biases start right after the (padded) weights, in both arenas
+    size_t biases_offset = Arena::padded(weights.size());
+
+    Matrix new_weights = Matrix::view(params, weights.numRows(), weights.numCols());
+    Matrix new_biases = Matrix::view(params + biases_offset, biases.numRows(), biases.numCols());
+    if (copy_values) {
+        new_weights = weights;
+        new_biases = biases;
+    }
+
+    // Assigning to a view would write through it, so the new views are swapped in instead
+    weights.swap(new_weights);
+    biases.swap(new_biases);
+
+    Matrix new_grad_weights = Matrix::view(grads, weights.numRows(), weights.numCols());
+    Matrix new_grad_biases = Matrix::view(grads + biases_offset, biases.numRows(), biases.numCols());
+    grad_weights.swap(new_grad_weights);
+    grad_biases.swap(new_grad_biases);
+    std::fill(grad_weights.data(), grad_weights.data() + grad_weights.size(), 0.0);
+    std::fill(grad_biases.data(), grad_biases.data() + grad_biases.size(), 0.0);
+}
+
+void Dense::initialize(std::mt19937& gen) {
+    std::uniform_real_distribution<> dist(-1.0, 1.0);
+    for (size_t i = 0; i < weights.size(); ++i) {
+        weights.data()[i] = dist(gen);
+    }
+    std::fill(biases.data(), biases.data() + biases.size(), 0.0);
+}
+
+LayerSpec Dense::spec() const {
+    return LayerSpec::dense(weights.numCols(), weights.numRows(), activation_id);
+}
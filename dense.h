@@ -0,0 +1,107 @@
+//
+// Created by mazen on 09/06/2025.
+// This file is part of a simple neural network library for C++.
+// It provides a Dense class that represents a single fully connected layer in a neural network.
+// The Dense class supports forward and backward passes and uses activation functions (the weights are updated by the optimizer).
+// The library is designed to be easy to use and extend, with a focus on educational purposes.
+// I wrote it to practice C++ and have fun with machine learning concepts.
+// It is just a simple implementation of a neural network layer, not optimized for performance or memory usage.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef DENSE_H
+#define DENSE_H
+
+#include <vector>
+#include <functional>
+#include "layer.h"
+
+
+
+class Dense : public Layer {
+private:
+    // Weights and biases are stored as matrices
+    // Weights are of size (out_size, in_size) and biases are of size (out_size, 1)
+    // The layer works on batches : each column of a matrix is a sample, so for a batch of n samples
+    // outputs are of size (out_size, n) and inputs are of size (in_size, n)
+    // Deltas are of size (out_size, n) and are used for backpropagation
+    // Activation functions are stored as function pointers
+    // Activation is a function that takes a double and returns a double
+    // The gradients of the weights and biases have the same sizes and are filled by backward
+    // Once the layer is bound to a Network, weights, biases and their gradients are views into the network arenas
+    // The inputs and outputs are not copied : the layer keeps pointers to the ones of the last forward pass,
+    // which are buffers of the execution plan of the network (see plan.h)
+    Matrix weights;
+    Matrix biases;
+    Matrix grad_weights;
+    Matrix grad_biases;
+    const Matrix* inputs;
+    const Matrix* outputs;
+    Matrix deltas;
+
+    // The activation runs through the specialized loops of activateRow unless it is a user function
+    // fused is the activation a plan asked the layer to apply, when it has none of its own
+    std::function<double(double)> activation;
+    std::function<double(double)> activation_deriv;
+    Activation activation_id;
+    Activation fused;
+
+    // The activation the layer applies : its own one, or the fused one
+    Activation applied() const { return activation_id == Activation::Identity ? fused : activation_id; }
+
+public:
+    // Constructor to initialize the layer with given sizes and activation functions
+    //
+    // Parameters :
+    // in_size : number of input neurons
+    // out_size : number of output neurons
+    // activation : activation function to be used in the layer
+    // activation_deriv : derivative of the activation function
+    Dense(size_t in_size, size_t out_size,
+          std::function<double(double)> activation,
+          std::function<double(double)> activation_deriv);
+
+    // Same as above, with the activation chosen by id (see activation.h)
+    Dense(size_t in_size, size_t out_size, Activation activation);
+
+    size_t inputSize() const override { return weights.numCols(); }
+    size_t outputSize() const override { return weights.numRows(); }
+
+    // Forward pass through the layer (see Layer::forwardInto)
+    // It computes activation(weights * input + biases), for the whole batch with one matrix product
+    void forwardInto(const Matrix& input, Matrix& output) override;
+
+    // Backward pass through the layer (see Layer::backwardInto)
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+
+    // The gradient of the weights needs the inputs, the derivative of the activation needs the outputs
+    bool keepsInput() const override { return true; }
+    bool keepsOutput() const override { return applied() != Activation::Identity; }
+    bool fuseActivation(Activation id) override;
+
+    // The three products of the weights with a batch, and the passes over the outputs around them
+    OpCost forwardCost(size_t n) const override;
+    OpCost backwardCost(size_t n, bool input_gradient) const override;
+
+    // Number of doubles the layer needs in a parameter arena : the weights, then the biases,
+    // each of them padded so it starts on its own cache line (see Arena::padded)
+    size_t parameterCount() const override;
+
+    // Moves the weights, biases and their gradients into the arenas of a Network (see Layer::bind)
+    void bind(double* params, double* grads, bool copy_values = true) override;
+
+    // Weights uniform in [-1, 1], biases at zero
+    void initialize(std::mt19937& gen) override;
+
+    LayerSpec spec() const override;
+
+    // Getters for the weights, biases and deltas
+    const Matrix& getDelta() const { return deltas; }
+    const Matrix& getWeights() const { return weights; }
+    const Matrix& getBiases() const { return biases; }
+};
+
+
+
+#endif //DENSE_H
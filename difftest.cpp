@@ -0,0 +1,630 @@
+//
+// This file is part of a simple neural network library for C++.
+// It runs the differential tests : every optimized kernel of the library against the reference backend
+// (see reference.h), on random shapes, with many odd, prime and degenerate sizes, padded rows, transposed
+// operands, and every kind of layer. The results must agree within the rounding errors of the computation :
+// a few ULPs for what is computed value by value, a bound that grows with the length of the sums otherwise.
+// The gradients of whole networks are also checked against finite differences of their loss.
+// The scheduler runs with at least 4 threads, so the parallel GEMM is tested on any machine, and its parallel
+// loops are checked to cover their ranges exactly once, nested or not, and to pass on the exceptions.
+//
+// Usage : difftest [--seed <value>] [--rounds <count>]
+// --seed <value>   : seed of the random shapes and values, a failure prints the seed that reproduces it
+// --rounds <count> : number of random cases of each test, 200 by default
+//
+// This file is released under the MIT License.
+//
+
+#include "gemm.h"
+#include "network.h"
+#include "reference.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+
+namespace {
+
+constexpr double eps = std::numeric_limits<double>::epsilon();
+
+// The values computed one at a time, by the same formula, may only differ by the rounding of the math library
+constexpr uint64_t max_ulps = 4;
+
+// The sizes the shapes are drawn from most of the time : degenerate, small odd and prime ones,
+// powers of two and their neighbours (the edges of the blocks of the kernels)
+constexpr size_t edge_sizes[] = {0, 1, 2, 3, 4, 5, 7, 8, 13, 16, 17, 31, 32, 33, 61, 64, 65, 97, 127, 128, 131, 257};
+
+std::mt19937 rng;
+
+size_t randomSize(size_t max, bool allow_zero = true) {
+    for (;;) {
+        size_t size = std::uniform_int_distribution<size_t>(0, 3)(rng) == 0
+                      ? std::uniform_int_distribution<size_t>(1, max)(rng)
+                      : edge_sizes[std::uniform_int_distribution<size_t>(0, std::size(edge_sizes) - 1)(rng)];
+        if (size <= max && (allow_zero || size > 0)) {
+            return size;
+        }
+    }
+}
+
+double randomValue() {
+    return std::uniform_real_distribution<double>(-1.0, 1.0)(rng);
+}
+
+Matrix randomMatrix(size_t rows, size_t cols) {
+    Matrix m(rows, cols);
+    for (size_t i = 0; i < m.size(); ++i) {
+        m.data()[i] = randomValue();
+    }
+    return m;
+}
+
+// Number of doubles between two values, 0 when they are equal, the largest value for a NaN
+uint64_t ulps(double a, double b) {
+    if (a == b) {
+        return 0;
+    }
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    // The bits of a double, turned into integers that are ordered as the doubles are
+    auto ordered = [](double x) {
+        int64_t bits = std::bit_cast<int64_t>(x);
+        return bits < 0 ? std::numeric_limits<int64_t>::min() - bits : bits;
+    };
+    int64_t ia = ordered(a);
+    int64_t ib = ordered(b);
+    return ia > ib ? static_cast<uint64_t>(ia) - static_cast<uint64_t>(ib) : static_cast<uint64_t>(ib) - static_cast<uint64_t>(ia);
+}
+
+// Counts the failed checks, and prints the first ones
+struct Checker {
+    size_t checks = 0;
+    size_t failures = 0;
+
+    bool check(bool ok, const std::string& what) {
+        ++checks;
+        if (!ok && ++failures <= 20) {
+            std::cout << "  FAILED : " << what << "\n";
+        }
+        return ok;
+    }
+
+    // Every value within max_ulps of the reference
+    void sameValues(const double* values, const double* expected, size_t count, const std::string& what) {
+        for (size_t i = 0; i < count; ++i) {
+            if (ulps(values[i], expected[i]) > max_ulps) {
+                check(false, what + ", value " + std::to_string(i) + " : " + std::to_string(values[i]) + " instead of "
+                             + std::to_string(expected[i]));
+                return;
+            }
+        }
+        check(true, what);
+    }
+
+    // The largest difference with the reference, relative to its largest value, within the rounding errors
+    // of sums of length terms
+    void close(const Matrix& values, const Matrix& expected, size_t length, const std::string& what) {
+        if (!check(values.numRows() == expected.numRows() && values.numCols() == expected.numCols(), what + " (sizes)")) {
+            return;
+        }
+        double error = 0.0;
+        double scale = 0.0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            error = std::max(error, std::fabs(values.data()[i] - expected.data()[i]));
+            scale = std::max(scale, std::fabs(expected.data()[i]));
+        }
+        double bound = 16.0 * (length + 1) * eps * std::max(scale, 1e-300);
+        check(error <= bound, what + " : error " + std::to_string(error) + " for values up to " + std::to_string(scale));
+    }
+};
+
+// gemm against its definition, with the default configuration or a random one : every value of C within
+// the rounding errors of its own dot product,
+// and the padding of the rows of C untouched
+void testGemm(Checker& checker, size_t rounds) {
+    std::cout << "gemm\n";
+    for (size_t round = 0; round < rounds; ++round) {
+        size_t m = randomSize(200);
+        size_t n = randomSize(200);
+        size_t k = randomSize(300);
+        bool trans_a = rng() & 1;
+        bool trans_b = rng() & 1;
+        size_t lda = (trans_a ? m : k) + randomSize(3);
+        size_t ldb = (trans_b ? k : n) + randomSize(3);
+        size_t ldc = n + randomSize(3);
+        const double alphas[] = {1.0, -1.0, 0.5, randomValue()};
+        const double betas[] = {0.0, 1.0, randomValue()};
+        double alpha = alphas[rng() % 4];
+        double beta = betas[rng() % 3];
+
+        std::vector<double> a((trans_a ? k : m) * lda + 1);
+        std::vector<double> b((trans_b ? n : k) * ldb + 1);
+        for (double& v : a) v = randomValue();
+        for (double& v : b) v = randomValue();
+
+        // When beta is 0, C does not need to be initialized : NaNs in it must not come out
+        const double padding = 12345.0;
+        std::vector<double> c(m * ldc + 1, padding);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                c[i * ldc + j] = beta == 0.0 ? std::numeric_limits<double>::quiet_NaN() : randomValue();
+            }
+        }
+        std::vector<double> expected = c;
+        std::vector<double> magnitude(c.size(), 0.0);
+
+        // Half of the products run with a random configuration, as a tuning could give them
+        GemmConfig config;
+        bool tuned = rng() & 1;
+        if (tuned) {
+            const auto& kernel_shapes = gemmKernelShapes();
+            const auto& kernel = kernel_shapes[rng() % kernel_shapes.size()];
+            config.mr = kernel.first;
+            config.nr = kernel.second;
+            config.mc = 1 + randomSize(100);
+            config.kc = 1 + randomSize(300);
+            config.nc = 1 + randomSize(300);
+            config.tiles_per_thread = 1 + randomSize(8);
+            gemm(config, trans_a, trans_b, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+        } else {
+            gemm(trans_a, trans_b, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc);
+        }
+        reference::gemm(trans_a, trans_b, m, n, k, alpha, a.data(), lda, b.data(), ldb, beta, expected.data(), ldc,
+                        magnitude.data());
+
+        std::string what = std::string("gemm ") + (trans_a ? "T" : "N") + (trans_b ? "T" : "N") + " m=" + std::to_string(m)
+                           + " n=" + std::to_string(n) + " k=" + std::to_string(k) + " lda=" + std::to_string(lda)
+                           + " ldb=" + std::to_string(ldb) + " ldc=" + std::to_string(ldc)
+                           + " alpha=" + std::to_string(alpha) + " beta=" + std::to_string(beta);
+        if (tuned) {
+            what += " config=" + std::to_string(config.mr) + "x" + std::to_string(config.nr) + "/"
+                    + std::to_string(config.mc) + "/" + std::to_string(config.kc) + "/" + std::to_string(config.nc)
+                    + "/" + std::to_string(config.tiles_per_thread);
+        }
+        bool ok = true;
+        for (size_t i = 0; i < m && ok; ++i) {
+            for (size_t j = 0; j < ldc && ok; ++j) {
+                double value = c[i * ldc + j];
+                if (j >= n) {
+                    ok = value == padding;
+                } else {
+                    // The forward error bound of a dot product of k terms, and of the scaling of C
+                    double bound = (k + 2) * eps * magnitude[i * ldc + j] + std::numeric_limits<double>::min();
+                    ok = std::fabs(value - expected[i * ldc + j]) <= bound;
+                }
+            }
+        }
+        checker.check(ok && c.back() == padding, what);
+    }
+}
+
+// Keeps the calling thread busy for a while, without giving its core away like a sleep would
+void spin(std::chrono::microseconds duration) {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < duration) {
+    }
+}
+
+// parallelFor on random ranges and grains, on a scheduler of its own : every index exactly once,
+// parallel loops inside the pieces of another one, task groups, and the first exception thrown comes out
+void testScheduler(Checker& checker, size_t rounds) {
+    std::cout << "scheduler\n";
+    Scheduler scheduler(SchedulerOptions{4, false});
+    for (size_t round = 0; round < rounds; ++round) {
+        size_t begin = randomSize(100);
+        size_t end = begin + randomSize(5000);
+        size_t grain = rng() % 3 == 0 ? 0 : 1 + randomSize(300);
+        std::vector<std::atomic<uint32_t>> hits(end);
+        std::atomic<bool> short_piece(false);
+        scheduler.parallelFor(begin, end, grain, [&](size_t first, size_t last) {
+            // Only a range shorter than a grain is run in a shorter piece
+            if (grain > 0 && last - first < grain && end - begin >= grain) {
+                short_piece = true;
+            }
+            for (size_t i = first; i < last; ++i) {
+                hits[i].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        bool once = true;
+        for (size_t i = 0; i < end; ++i) {
+            once = once && hits[i].load() == (i >= begin ? 1u : 0u);
+        }
+        checker.check(once && !short_piece, "parallelFor [" + std::to_string(begin) + ", " + std::to_string(end)
+                                            + ") grain " + std::to_string(grain));
+    }
+
+    // A loop of loops, and groups of tasks inside it
+    const size_t outer = 37;
+    const size_t inner = 1001;
+    std::vector<std::atomic<uint64_t>> sums(outer);
+    scheduler.parallelFor(0, outer, 1, [&](size_t first, size_t last) {
+        for (size_t o = first; o < last; ++o) {
+            scheduler.parallelFor(0, inner, 7, [&](size_t a, size_t b) {
+                for (size_t i = a; i < b; ++i) {
+                    sums[o].fetch_add(i, std::memory_order_relaxed);
+                }
+            });
+            TaskGroup group(scheduler);
+            for (size_t t = 0; t < 3; ++t) {
+                group.run([&sums, o] { sums[o].fetch_add(1, std::memory_order_relaxed); });
+            }
+            group.wait();
+        }
+    });
+    bool nested = true;
+    for (size_t o = 0; o < outer; ++o) {
+        nested = nested && sums[o].load() == inner * (inner - 1) / 2 + 3;
+    }
+    checker.check(nested, "nested parallelFor and task groups");
+
+    // Two threads that are not workers run a loop each while a third one has tasks queued : both loops are
+    // still split (pieces run on other threads), and no thread that is not a worker runs a piece or a task
+    // of another one while it waits for its own
+    for (size_t round = 0; round < 2; ++round) {
+        std::atomic<size_t> ready(0);
+        std::thread::id ids[3];
+        std::atomic<bool> crossed(false);
+        size_t elsewhere[2] = {};
+        bool covered[2] = {};
+        // Whether the calling thread is one of the three, other than the owner
+        auto checkOwner = [&](size_t owner) {
+            for (size_t t = 0; t < 3; ++t) {
+                if (t != owner && std::this_thread::get_id() == ids[t]) {
+                    crossed = true;
+                }
+            }
+        };
+        auto start = [&](size_t t) {
+            ids[t] = std::this_thread::get_id();
+            ready.fetch_add(1);
+            while (ready.load() < 3) {
+                std::this_thread::yield();
+            }
+        };
+        auto loop = [&](size_t t) {
+            start(t);
+            const size_t length = 128;
+            std::vector<std::atomic<uint32_t>> hits(length);
+            std::atomic<size_t> count(0);
+            scheduler.parallelFor(0, length, 1, [&](size_t first, size_t last) {
+                checkOwner(t);
+                if (std::this_thread::get_id() != ids[t]) {
+                    count.fetch_add(1);
+                }
+                for (size_t i = first; i < last; ++i) {
+                    hits[i].fetch_add(1);
+                    // Long enough for the workers to come and take a part
+                    spin(std::chrono::microseconds(100));
+                }
+            });
+            elsewhere[t] = count.load();
+            covered[t] = std::all_of(hits.begin(), hits.end(), [](const auto& h) { return h.load() == 1; });
+        };
+        auto tasks = [&] {
+            TaskGroup group(scheduler);
+            for (size_t task = 0; task < 50; ++task) {
+                group.run([&] {
+                    while (ready.load() < 3) {
+                        std::this_thread::yield();
+                    }
+                    checkOwner(2);
+                    spin(std::chrono::microseconds(200));
+                });
+            }
+            start(2);
+            group.wait();
+        };
+        std::thread first(loop, 0);
+        std::thread second(loop, 1);
+        std::thread third(tasks);
+        first.join();
+        second.join();
+        third.join();
+        checker.check(covered[0] && covered[1] && elsewhere[0] > 0 && elsewhere[1] > 0 && !crossed,
+                      "parallelFor from two threads at once : " + std::to_string(elsewhere[0]) + " and "
+                      + std::to_string(elsewhere[1]) + " pieces on other threads"
+                      + (crossed ? ", a thread ran the work of another one" : ""));
+    }
+
+    bool thrown = false;
+    try {
+        scheduler.parallelFor(0, 10000, 10, [](size_t first, size_t last) {
+            if (first <= 5000 && 5000 < last) {
+                throw std::runtime_error("piece of 5000");
+            }
+        });
+    } catch (const std::runtime_error& e) {
+        thrown = std::string(e.what()) == "piece of 5000";
+    }
+    checker.check(thrown, "exception thrown in a parallelFor");
+}
+
+// The operators of Matrix against the first versions of them
+void testMatrix(Checker& checker, size_t rounds) {
+    std::cout << "matrix\n";
+    for (size_t round = 0; round < rounds; ++round) {
+        size_t rows = randomSize(150, false);
+        size_t inner = randomSize(150, false);
+        size_t cols = randomSize(150, false);
+        std::string shape = std::to_string(rows) + "x" + std::to_string(inner) + "x" + std::to_string(cols);
+        Matrix a = randomMatrix(rows, inner);
+        Matrix b = randomMatrix(inner, cols);
+        Matrix c = randomMatrix(rows, inner);
+
+        checker.close(a * b, reference::multiply(a, b), inner, "operator* " + shape);
+        Matrix t = a.transpose();
+        Matrix expected_t = reference::transpose(a);
+        checker.sameValues(t.data(), expected_t.data(), t.size(), "transpose " + shape);
+        Matrix sum = a + c;
+        Matrix expected_sum = reference::add(a, c);
+        checker.sameValues(sum.data(), expected_sum.data(), sum.size(), "operator+ " + shape);
+        a += c;
+        checker.sameValues(a.data(), expected_sum.data(), a.size(), "operator+= " + shape);
+    }
+}
+
+// The loops of activateRow and activationBackward against the std::function of each activation,
+// on rows that do not start on an aligned address
+void testActivations(Checker& checker, size_t rounds) {
+    std::cout << "activations\n";
+    for (size_t round = 0; round < rounds; ++round) {
+        for (Activation id : {Activation::Identity, Activation::Sigmoid, Activation::ReLU, Activation::Tanh}) {
+            size_t n = randomSize(300);
+            size_t offset = rng() % 4;
+            double bias = randomValue();
+            std::vector<double> in(n + offset);
+            std::vector<double> grad(n + offset);
+            for (double& v : in) v = 4.0 * randomValue();
+            for (double& v : grad) v = randomValue();
+            std::vector<double> out(n + offset);
+            std::vector<double> delta(n + offset);
+            activateRow(id, in.data() + offset, out.data() + offset, n, bias);
+            activationBackward(id, out.data() + offset, grad.data() + offset, delta.data() + offset, n);
+
+            std::function<double(double)> f = activationFunction(id);
+            std::function<double(double)> derivative = activationDerivative(id);
+            std::vector<double> expected_out(n);
+            std::vector<double> expected_delta(n);
+            for (size_t i = 0; i < n; ++i) {
+                expected_out[i] = f(in[offset + i] + bias);
+                expected_delta[i] = derivative(expected_out[i]) * grad[offset + i];
+            }
+            std::string what = activationName(id) + " n=" + std::to_string(n) + " offset=" + std::to_string(offset);
+            checker.sameValues(out.data() + offset, expected_out.data(), n, what + " forward");
+            checker.sameValues(delta.data() + offset, expected_delta.data(), n, what + " backward");
+        }
+    }
+}
+
+Activation randomActivation() {
+    const Activation ids[] = {Activation::Identity, Activation::Sigmoid, Activation::ReLU, Activation::Tanh};
+    return ids[rng() % 4];
+}
+
+// A random layer of every kind, with its images from 1x1 pixel up, windows as large as the images
+// and strides larger than the windows
+LayerSpec randomSpec(size_t kind) {
+    switch (kind) {
+        case 0:
+            return LayerSpec::dense(randomSize(100, false), randomSize(100, false), randomActivation());
+        case 1: {
+            size_t height = randomSize(12, false);
+            size_t width = randomSize(12, false);
+            size_t padding = rng() % 3;
+            size_t window = 1 + rng() % std::min(height, width) + padding;
+            window = std::min(window, std::min(height, width) + 2 * padding);
+            return LayerSpec::conv2d(randomSize(4, false), height, width, randomSize(5, false), window,
+                                     1 + rng() % 3, padding, randomActivation());
+        }
+        case 2:
+        case 3: {
+            size_t height = randomSize(12, false);
+            size_t width = randomSize(12, false);
+            size_t window = 1 + rng() % std::min(height, width);
+            size_t stride = 1 + rng() % 3;
+            return kind == 2 ? LayerSpec::maxPool2d(randomSize(4, false), height, width, window, stride)
+                             : LayerSpec::avgPool2d(randomSize(4, false), height, width, window, stride);
+        }
+        case 4:
+            return LayerSpec::activate(randomSize(100, false), randomActivation());
+        default:
+            return LayerSpec::softmax(randomSize(30, false));
+    }
+}
+
+std::string describe(const LayerSpec& spec) {
+    const char* kinds[] = {"dense", "conv2d", "maxpool2d", "avgpool2d", "activation", "softmax"};
+    return std::string(kinds[static_cast<size_t>(spec.kind)]) + " in=" + std::to_string(spec.in_size)
+           + " out=" + std::to_string(spec.out_size) + " c=" + std::to_string(spec.channels)
+           + " " + std::to_string(spec.height) + "x" + std::to_string(spec.width)
+           + " f=" + std::to_string(spec.filters) + " w=" + std::to_string(spec.window)
+           + " s=" + std::to_string(spec.stride) + " p=" + std::to_string(spec.padding)
+           + " " + activationName(spec.activation);
+}
+
+// Length of the longest sum of a layer, the scale of its rounding errors
+size_t sumLength(const LayerSpec& spec, size_t n) {
+    switch (spec.kind) {
+        case LayerKind::Dense:
+            return std::max({spec.in_size, spec.out_size, n});
+        case LayerKind::Conv2D:
+            return (spec.channels + spec.filters) * spec.window * spec.window + spec.height * spec.width * n;
+        default:
+            return std::max<size_t>(spec.in_size, spec.window * spec.window);
+    }
+}
+
+// Every layer on its own against the reference : outputs, gradients of the input and of the parameters.
+// A Dense or Conv2D without activation is also run with an activation fused into it, as a plan does
+void testLayers(Checker& checker, size_t rounds) {
+    std::cout << "layers\n";
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t kind = 0; kind < 6; ++kind) {
+            LayerSpec spec = randomSpec(kind);
+            std::unique_ptr<Layer> layer = makeLayer(spec);
+            LayerSpec expected_spec = spec;
+            if ((kind == 0 || kind == 1) && spec.activation == Activation::Identity) {
+                expected_spec.activation = randomActivation();
+                layer->fuseActivation(expected_spec.activation);
+            }
+
+            size_t count = std::max<size_t>(layer->parameterCount(), 1);
+            Arena params(count);
+            Arena grads(count);
+            layer->bind(params.data(), grads.data());
+            for (size_t i = 0; i < layer->parameterCount(); ++i) {
+                params.data()[i] = randomValue();
+            }
+
+            size_t n = randomSize(40, false);
+            Matrix input = randomMatrix(layer->inputSize(), n);
+            Matrix dLoss_dOutput = randomMatrix(layer->outputSize(), n);
+            Matrix output = layer->forward(input);
+            Matrix dLoss_dInput = layer->backward(dLoss_dOutput);
+
+            Arena expected_grads(count);
+            Matrix expected_output = reference::forward(expected_spec, params.data(), input);
+            Matrix expected_dInput = reference::backward(expected_spec, params.data(), input, dLoss_dOutput,
+                                                         expected_grads.data());
+
+            std::string what = describe(expected_spec) + " n=" + std::to_string(n);
+            size_t length = sumLength(spec, n);
+            checker.close(output, expected_output, length, what + " forward");
+            checker.close(dLoss_dInput, expected_dInput, length, what + " input gradient");
+            if (layer->parameterCount() > 0) {
+                Matrix g = Matrix::view(grads.data(), 1, layer->parameterCount());
+                Matrix expected_g = Matrix::view(expected_grads.data(), 1, layer->parameterCount());
+                checker.close(g, expected_g, length, what + " parameter gradients");
+            }
+        }
+    }
+}
+
+// A few networks that mix every kind of layer, with activation layers the plans fuse
+std::vector<std::vector<LayerSpec>> networks() {
+    return {
+        {LayerSpec::dense(13, 17, Activation::Identity), LayerSpec::activate(17, Activation::Tanh),
+         LayerSpec::dense(17, 7, Activation::Sigmoid), LayerSpec::dense(7, 5, Activation::Identity),
+         LayerSpec::softmax(5)},
+        {LayerSpec::conv2d(2, 9, 7, 3, 3, 1, 1, Activation::Identity), LayerSpec::activate(189, Activation::Tanh),
+         LayerSpec::maxPool2d(3, 9, 7, 2, 2), LayerSpec::conv2d(3, 4, 3, 4, 2, 1, 0, Activation::Sigmoid),
+         LayerSpec::avgPool2d(4, 3, 2, 1, 1), LayerSpec::dense(24, 6, Activation::Tanh)},
+        {LayerSpec::conv2d(1, 8, 8, 5, 5, 2, 2, Activation::Tanh), LayerSpec::avgPool2d(5, 4, 4, 3, 1),
+         LayerSpec::dense(20, 4, Activation::Identity), LayerSpec::activate(4, Activation::Sigmoid),
+         LayerSpec::activate(4, Activation::Tanh)},
+    };
+}
+
+// Whole networks through their plans (fusion and shared buffers) against the reference layer after layer,
+// then their gradients against finite differences of the loss
+void testNetworks(Checker& checker) {
+    std::cout << "networks\n";
+    for (const std::vector<LayerSpec>& specs : networks()) {
+        // The learning rate is 0, so train computes the gradients without changing the parameters
+        Network net(specs, Cost::MSE, 0.0);
+        net.initialize(static_cast<uint32_t>(rng()));
+        size_t n = 1 + rng() % 9;
+        Matrix input = randomMatrix(net.getSizes().front(), n);
+        Matrix targets = randomMatrix(net.getSizes().back(), n);
+        std::string what = "network of " + std::to_string(specs.size()) + " layers from " + describe(specs.front());
+
+        Matrix output = net.forward(input);
+        std::vector<Matrix> values = {input};
+        std::vector<size_t> offsets;
+        size_t offset = 0;
+        for (size_t l = 0; l < specs.size(); ++l) {
+            offsets.push_back(offset);
+            values.push_back(reference::forward(specs[l], net.parameters().data() + offset, values.back()));
+            offset += net.getLayers()[l]->parameterCount();
+        }
+        checker.close(output, values.back(), 1000, what + " forward");
+
+        // The gradient of the loss of the network, layer after layer from the output
+        net.train(input, targets);
+        Arena expected_grads(std::max<size_t>(net.parameters().size(), 1));
+        Matrix grad(values.back().numRows(), n);
+        for (size_t i = 0; i < grad.size(); ++i) {
+            grad.data()[i] = values.back().data()[i] - targets.data()[i];
+        }
+        for (size_t l = specs.size(); l-- > 0;) {
+            grad = reference::backward(specs[l], net.parameters().data() + offsets[l], values[l], grad,
+                                       expected_grads.data() + offsets[l]);
+        }
+        Matrix g = Matrix::view(net.gradients().data(), 1, net.gradients().size());
+        Matrix expected_g = Matrix::view(expected_grads.data(), 1, net.gradients().size());
+        checker.close(g, expected_g, 1000, what + " gradients");
+
+        // Central differences of the loss (train gives its mean over the batch, the gradients are summed)
+        // Every call of train overwrites the gradients, they are kept first
+        const std::vector<double> analytics(net.gradients().data(), net.gradients().data() + net.gradients().size());
+        const double h = 1e-5;
+        double worst = 0.0;
+        double* p = net.parameters().data();
+        for (size_t i = 0; i < net.parameters().size(); ++i) {
+            double analytic = analytics[i];
+            double value = p[i];
+            p[i] = value + h;
+            double up = net.train(input, targets) * n;
+            p[i] = value - h;
+            double down = net.train(input, targets) * n;
+            p[i] = value;
+            double numeric = (up - down) / (2 * h);
+            worst = std::max(worst, std::fabs(numeric - analytic) / std::max({std::fabs(numeric), std::fabs(analytic), 1e-3}));
+        }
+        checker.check(worst < 1e-5, what + " finite differences : relative error " + std::to_string(worst));
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = std::random_device()();
+    size_t rounds = 200;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--seed" && i + 1 < argc) {
+                seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+            } else if (arg == "--rounds" && i + 1 < argc) {
+                rounds = std::stoul(argv[++i]);
+            } else {
+                throw std::invalid_argument("Unknown option : " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Threads of the scheduler even on a small machine, so the products are also cut into tiles
+    Scheduler::configure(SchedulerOptions{std::max<size_t>(4, std::thread::hardware_concurrency()), false});
+
+    std::cout << "Differential tests, seed " << seed << "\n";
+    rng.seed(seed);
+    Checker checker;
+    try {
+        testGemm(checker, rounds);
+        testScheduler(checker, rounds / 4);
+        testMatrix(checker, rounds / 4);
+        testActivations(checker, rounds);
+        testLayers(checker, rounds);
+        testNetworks(checker);
+    } catch (const std::exception& e) {
+        checker.check(false, std::string("exception : ") + e.what());
+    }
+
+    std::cout << checker.checks - checker.failures << " of " << checker.checks << " checks passed";
+    if (checker.failures > 0) {
+        std::cout << ", run difftest --seed " << seed << " to reproduce\n";
+        return 1;
+    }
+    std::cout << "\n";
+    return 0;
+}
@@ -0,0 +1,449 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "evaluator.h"
+#include "mapped_file.h"
+#include "scheduler.h"
+#include "spsc_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Rows parsed from the file, as uint8 values
+struct ParsedRows {
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> labels;
+    size_t count = 0;
+};
+
+// A batch ready for the network, then the predictions of the network for it
+struct EvalBatch {
+    Matrix inputs{0, 0};
+    std::vector<uint8_t> labels;
+    std::vector<uint32_t> predictions;
+    size_t count = 0;
+};
+
+// The queues carry indices into the buffer pools, -1 marks the end of the file
+constexpr int end_of_file = -1;
+
+// Number of features of a batch converted by a task at least
+constexpr size_t features_per_task = 64;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns the start of the line after the one p is in, or end
+const char* nextLine(const char* p, const char* end) {
+    const void* newline = std::memchr(p, '\n', end - p);
+    return newline ? static_cast<const char*>(newline) + 1 : end;
+}
+
+// End of the content of the line starting at p : before the '\n' and the '\r' of Windows files
+const char* lineEnd(const char* p, const char* next) {
+    const char* e = next;
+    while (e > p && (e[-1] == '\n' || e[-1] == '\r')) {
+        --e;
+    }
+    return e;
+}
+
+// Parses the values of the line [p, e) : the label first if labeled, then features values
+void parseRow(const char* p, const char* e, size_t row, size_t features, bool labeled, uint8_t* pixels, uint8_t* label) {
+    size_t columns = features + (labeled ? 1 : 0);
+    for (size_t col = 0; col < columns; ++col) {
+        unsigned value = 0;
+        auto [ptr, ec] = std::from_chars(p, e, value);
+        if (ec != std::errc() || value > 255) {
+            throw std::runtime_error("Row " + std::to_string(row + 1) + ", column " + std::to_string(col + 1)
+                                     + " is not an integer in [0, 255]");
+        }
+        if (labeled && col == 0) {
+            *label = static_cast<uint8_t>(value);
+        } else {
+            pixels[col - (labeled ? 1 : 0)] = static_cast<uint8_t>(value);
+        }
+
+        p = ptr;
+        if (col + 1 < columns) {
+            if (p == e || *p != ',') {
+                throw std::runtime_error("Row " + std::to_string(row + 1) + " has less than "
+                                         + std::to_string(columns) + " values");
+            }
+            ++p;
+        }
+    }
+    if (p != e) {
+        throw std::runtime_error("Row " + std::to_string(row + 1) + " has more than "
+                                 + std::to_string(columns) + " values");
+    }
+}
+
+
+// Fills a batch with the next samples : their features, normalized and padded to the full batch, their labels
+// and their number. Returns false when there are none left, or when the pipeline is stopping.
+// It is called on the thread of the batcher
+using BatchSource = std::function<bool(EvalBatch& batch)>;
+
+// Runs the stages that follow the source of the batches, each on its own thread : the batcher (which calls source),
+// the network (on the calling thread) and the writer of the predictions when there is a file to write.
+// A failing stage sets stop and wakes the stages waiting on the queues. The caller sets stop too when the source
+// fails on a thread of its own, and wakes the queues the source waits on
+void runStages(Network& net, size_t batch_size, size_t depth, bool labeled, const BatchSource& source,
+               const std::string& predictions_path, std::atomic<bool>& stop, EvalResult& result) {
+    const size_t features = net.getSizes().front();
+    const size_t classes = net.getSizes().back();
+
+    std::ofstream out;
+    if (!predictions_path.empty()) {
+        out.open(predictions_path, std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Can't open " + predictions_path + " for writing");
+        }
+    }
+    const bool writing = out.is_open();
+
+    // The batches go batcher -> inference (-> writer) -> batcher
+    std::vector<EvalBatch> batches(depth);
+    for (EvalBatch& b : batches) {
+        b.inputs = Matrix(features, batch_size);
+        b.labels.resize(batch_size);
+        b.predictions.resize(batch_size);
+    }
+    SpscQueue<int> ready(depth + 1);
+    SpscQueue<int> predicted(depth + 1);
+    SpscQueue<int> free_batches(depth + 1);
+    for (int i = 0; i < static_cast<int>(depth); ++i) {
+        free_batches.tryPush(i);
+    }
+    std::exception_ptr errors[2];
+
+    // Sets stop and wakes the stages waiting on a queue, so they give up
+    auto halt = [&] {
+        stop = true;
+        ready.wake();
+        predicted.wake();
+        free_batches.wake();
+    };
+
+    // Stage 2 : fills the batches from the source
+    std::thread batcher([&] {
+        try {
+            while (true) {
+                int b;
+                if (!free_batches.pop(b, stop)) {
+                    return;
+                }
+                if (!source(batches[b])) {
+                    ready.push(end_of_file, stop);
+                    return;
+                }
+                if (!ready.push(b, stop)) {
+                    return;
+                }
+            }
+        } catch (...) {
+            errors[0] = std::current_exception();
+            halt();
+        }
+    });
+
+    // Stage 4 : writes the predictions, in the order of the samples
+    std::thread writer;
+    if (writing) {
+        writer = std::thread([&] {
+            try {
+                std::string text;
+                while (true) {
+                    int b;
+                    if (!predicted.pop(b, stop) || b == end_of_file) {
+                        return;
+                    }
+                    auto busy_start = std::chrono::steady_clock::now();
+                    const EvalBatch& batch = batches[b];
+                    text.clear();
+                    for (size_t j = 0; j < batch.count; ++j) {
+                        char digits[16];
+                        char* digits_end = std::to_chars(digits, digits + sizeof(digits), batch.predictions[j]).ptr;
+                        text.append(digits, digits_end);
+                        text += '\n';
+                    }
+                    out.write(text.data(), static_cast<std::streamsize>(text.size()));
+                    if (!out.good()) {
+                        throw std::runtime_error("Can't write the predictions to " + predictions_path);
+                    }
+                    result.write_seconds += secondsSince(busy_start);
+                    if (!free_batches.push(b, stop)) {
+                        return;
+                    }
+                }
+            } catch (...) {
+                errors[1] = std::current_exception();
+                halt();
+            }
+        });
+    }
+
+    // Stage 3, on this thread : runs the network on the batches and picks the largest output of each sample
+    std::exception_ptr inference_error;
+    try {
+        while (true) {
+            int b;
+            if (!ready.pop(b, stop)) {
+                break;
+            }
+            if (b == end_of_file) {
+                if (writing) {
+                    predicted.push(end_of_file, stop);
+                }
+                break;
+            }
+
+            auto busy_start = std::chrono::steady_clock::now();
+            EvalBatch& batch = batches[b];
+            const Matrix& output = net.forward(batch.inputs);
+            for (size_t j = 0; j < batch.count; ++j) {
+                size_t best = 0;
+                for (size_t i = 1; i < classes; ++i) {
+                    if (output(i, j) > output(best, j)) {
+                        best = i;
+                    }
+                }
+                batch.predictions[j] = static_cast<uint32_t>(best);
+                if (labeled && best == batch.labels[j]) {
+                    ++result.correct;
+                }
+            }
+            result.samples += batch.count;
+            result.infer_seconds += secondsSince(busy_start);
+
+            if (!(writing ? predicted.push(b, stop) : free_batches.push(b, stop))) {
+                break;
+            }
+        }
+    } catch (...) {
+        inference_error = std::current_exception();
+        halt();
+    }
+
+    batcher.join();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    for (const std::exception_ptr& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+    if (inference_error) {
+        std::rethrow_exception(inference_error);
+    }
+
+    out.flush();
+    if (writing && !out.good()) {
+        throw std::runtime_error("Can't write the predictions to " + predictions_path);
+    }
+}
+
+}
+
+Evaluator::Evaluator(Network& net, size_t batch_size, size_t depth)
+    : net(net), batch_size(batch_size), depth(depth)
+{
+    if (batch_size == 0) {
+        throw std::invalid_argument("The batch size must be at least 1");
+    }
+    if (depth < 2) {
+        throw std::invalid_argument("The pipeline needs at least 2 buffers between two stages");
+    }
+}
+
+EvalResult Evaluator::run(const std::string& path, const std::string& predictions_path) {
+    MappedFile file(path);
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    const char* end = begin + file.size();
+    const size_t features = net.getSizes().front();
+
+    // Skip the header, if the first line does not start with a number
+    const char* data = begin;
+    if (data < end && (*data < '0' || *data > '9')) {
+        data = nextLine(data, end);
+    }
+
+    // The number of values of the first row tells whether the file is labeled
+    EvalResult result;
+    if (data < end) {
+        const char* first_end = lineEnd(data, nextLine(data, end));
+        size_t columns = static_cast<size_t>(std::count(data, first_end, ',')) + 1;
+        if (columns == features + 1) {
+            result.labeled = true;
+        } else if (columns != features) {
+            throw std::runtime_error(path + " has rows of " + std::to_string(columns) + " values, the network needs "
+                                     + std::to_string(features) + " (or a label and " + std::to_string(features) + ")");
+        }
+    }
+    const bool labeled = result.labeled;
+
+    // The rows parsed from the file go parser -> batcher -> parser
+    std::vector<ParsedRows> rows(depth);
+    for (ParsedRows& r : rows) {
+        r.pixels.resize(batch_size * features);
+        r.labels.resize(batch_size);
+    }
+    SpscQueue<int> parsed(depth + 1);
+    SpscQueue<int> free_rows(depth + 1);
+    for (int i = 0; i < static_cast<int>(depth); ++i) {
+        free_rows.tryPush(i);
+    }
+
+    // A failing stage records its error and sets stop, the other stages then give up waiting
+    std::atomic<bool> stop(false);
+    auto halt = [&] {
+        stop = true;
+        parsed.wake();
+        free_rows.wake();
+    };
+    std::exception_ptr parse_error;
+    auto start = std::chrono::steady_clock::now();
+
+    // Stage 1 : parses the lines of the file into rows, releasing the pages it is done with
+    std::thread parser([&] {
+        try {
+            const char* p = data;
+            const char* released = begin;
+            size_t row = 0;
+            while (p < end) {
+                int r;
+                if (!free_rows.pop(r, stop)) {
+                    return;
+                }
+                auto busy_start = std::chrono::steady_clock::now();
+                ParsedRows& block = rows[r];
+                block.count = 0;
+                while (p < end && block.count < batch_size) {
+                    const char* next = nextLine(p, end);
+                    const char* e = lineEnd(p, next);
+                    if (e != p) {
+                        parseRow(p, e, row, features, labeled, &block.pixels[block.count * features], &block.labels[block.count]);
+                        ++block.count;
+                        ++row;
+                    }
+                    p = next;
+                }
+                if (block.count == 0) {
+                    // Only empty lines were left at the end of the file
+                    break;
+                }
+                if (p - released >= (ptrdiff_t(1) << 24)) {
+                    file.release(released - begin, p - released);
+                    released = p;
+                }
+                result.parse_seconds += secondsSince(busy_start);
+                if (!parsed.push(r, stop)) {
+                    return;
+                }
+            }
+            parsed.push(end_of_file, stop);
+        } catch (...) {
+            parse_error = std::current_exception();
+            halt();
+        }
+    });
+
+    // The batches are the parsed rows converted into normalized doubles, one column per row
+    auto convert = [&](EvalBatch& batch) {
+        int r;
+        if (!parsed.pop(r, stop) || r == end_of_file) {
+            return false;
+        }
+        auto busy_start = std::chrono::steady_clock::now();
+        ParsedRows& block = rows[r];
+        const size_t n = block.count;
+        // The rows of the batch are spread over the threads of the scheduler, each one writes whole rows
+        // A short last batch is padded with zeros : every batch has the same size, so the network runs
+        // them all with the same plan, and the extra columns are not looked at
+        double* values = batch.inputs.data();
+        const uint8_t* pixels = block.pixels.data();
+        parallelFor(0, features, features_per_task, [&](size_t first, size_t last) {
+            for (size_t f = first; f < last; ++f) {
+                double* row = values + f * batch_size;
+                for (size_t j = 0; j < n; ++j) {
+                    row[j] = pixels[j * features + f] / 255.0;
+                }
+                std::fill(row + n, row + batch_size, 0.0);
+            }
+        });
+        std::copy(block.labels.begin(), block.labels.begin() + n, batch.labels.begin());
+        batch.count = n;
+        result.batch_seconds += secondsSince(busy_start);
+        return free_rows.push(r, stop);
+    };
+
+    std::exception_ptr stages_error;
+    try {
+        runStages(net, batch_size, depth, labeled, convert, predictions_path, stop, result);
+    } catch (...) {
+        stages_error = std::current_exception();
+        halt();
+    }
+    parser.join();
+    // An error of the parser stops the other stages, it is the one that tells what went wrong
+    if (parse_error) {
+        std::rethrow_exception(parse_error);
+    }
+    if (stages_error) {
+        std::rethrow_exception(stages_error);
+    }
+    result.seconds = secondsSince(start);
+    return result;
+}
+
+EvalResult Evaluator::run(const Dataset& dataset, const std::string& predictions_path) {
+    if (dataset.numFeatures() != net.getSizes().front()) {
+        throw std::invalid_argument("The samples have " + std::to_string(dataset.numFeatures())
+                                    + " values, the network needs " + std::to_string(net.getSizes().front()));
+    }
+    EvalResult result;
+    result.labeled = true;
+    std::atomic<bool> stop(false);
+    auto start = std::chrono::steady_clock::now();
+
+    // The batches are gathered from the dataset in its order. A short last batch repeats its last sample
+    // up to the full batch, so every batch runs with the same plan, and the extra columns are not looked at
+    std::vector<size_t> indices(batch_size);
+    size_t next = 0;
+    auto gather = [&](EvalBatch& batch) {
+        if (next >= dataset.size() || stop) {
+            return false;
+        }
+        auto busy_start = std::chrono::steady_clock::now();
+        const size_t n = std::min(batch_size, dataset.size() - next);
+        for (size_t j = 0; j < batch_size; ++j) {
+            indices[j] = next + std::min(j, n - 1);
+        }
+        dataset.gather(indices.data(), batch_size, batch.inputs);
+        for (size_t j = 0; j < n; ++j) {
+            batch.labels[j] = dataset.label(next + j);
+        }
+        batch.count = n;
+        next += n;
+        result.batch_seconds += secondsSince(busy_start);
+        return true;
+    };
+
+    runStages(net, batch_size, depth, true, gather, predictions_path, stop, result);
+    result.seconds = secondsSince(start);
+    return result;
+}
@@ -0,0 +1,72 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides an Evaluator that runs a network over a CSV file as a pipeline of stages, each on its own thread :
+// parsing the lines, converting them into batches, running the network, and writing the predictions.
+// The stages are joined by lock-free queues and hand buffers to each other, so they all work at the same time
+// and the throughput is the one of the slowest stage instead of the sum of them.
+// The conversion and the network spread their work over the threads of the scheduler (see scheduler.h).
+// The file is mapped and read once from start to end, the parsed pages are released as it goes,
+// so files much larger than the memory can be scored.
+// A Dataset already loaded (a mapped cache or IDX files) runs through the same stages, without the parsing.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <cstddef>
+#include <string>
+#include "dataset.h"
+#include "network.h"
+
+// What an evaluation did, with the time each stage spent working
+struct EvalResult {
+    size_t samples = 0;
+    size_t correct = 0;          // only meaningful when labeled
+    bool labeled = false;
+    double seconds = 0.0;        // from start to end
+    double parse_seconds = 0.0;
+    double batch_seconds = 0.0;
+    double infer_seconds = 0.0;
+    double write_seconds = 0.0;
+
+    double accuracy() const { return samples == 0 ? 0.0 : static_cast<double>(correct) / samples; }
+};
+
+class Evaluator {
+private:
+    Network& net;
+    size_t batch_size;
+    size_t depth;
+
+public:
+    // Parameters :
+    // net : the network to run, its input size gives the number of features per line
+    // batch_size : number of lines run through the network at once
+    // depth : number of buffers between two stages, so a stage can be up to depth batches ahead of the next one
+    //
+    // Throws std::invalid_argument if batch_size is 0 or depth is below 2
+    explicit Evaluator(Network& net, size_t batch_size = 256, size_t depth = 4);
+
+    // Runs the network over every line of a CSV file and predicts the class of each line (the largest output)
+    // A line is either a label followed by the features values (a labeled file, the accuracy is measured),
+    // or only the features values (an unlabeled file to score), all integers in [0, 255].
+    // Which one it is comes from the number of values of the first line. A first line that is not numeric is skipped.
+    //
+    // Parameters :
+    // path : the CSV file
+    // predictions_path : if not empty, the predicted class of each line is written to this file, one per line
+    //
+    // Throws std::runtime_error if a file can't be read or written, or if a line is not a valid row
+    EvalResult run(const std::string& path, const std::string& predictions_path = "");
+
+    // Same as above, on the samples of a dataset, in its order (a dataset is always labeled)
+    // Its samples are gathered into the batches while the network runs on the previous ones
+    //
+    // Throws std::invalid_argument if the samples do not have the number of features of the network,
+    // std::runtime_error if the predictions can't be written
+    EvalResult run(const Dataset& dataset, const std::string& predictions_path = "");
+};
+
+#endif //EVALUATOR_H
@@ -0,0 +1,324 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "gemm.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Below this many floating point operations a product runs on the calling thread alone,
+// cutting it into tasks would cost more than the other threads save
+constexpr double parallel_flops = 4e6;
+
+// The smallest tiles of C a product is cut into for the threads
+constexpr size_t min_tile_rows = 16;
+constexpr size_t min_tile_cols = 32;
+
+// Value (i, j) of op(X), for a matrix stored row by row
+inline double at(const double* x, size_t ld, bool trans, size_t i, size_t j) {
+    return trans ? x[j * ld + i] : x[i * ld + j];
+}
+
+// Packs the mb x kb block of op(A) starting at (i0, p0) into panels of MR rows
+// Each panel is stored column after column (MR values per column), the last panel is padded with zeros
+template <size_t MR>
+void packA(const double* a, size_t lda, bool trans, size_t i0, size_t p0, size_t mb, size_t kb,
+           double alpha, double* packed) {
+    for (size_t ir = 0; ir < mb; ir += MR) {
+        size_t rows = std::min(MR, mb - ir);
+        for (size_t p = 0; p < kb; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                packed[i] = i < rows ? alpha * at(a, lda, trans, i0 + ir + i, p0 + p) : 0.0;
+            }
+            packed += MR;
+        }
+    }
+}
+
+// Packs the kb x nb block of op(B) starting at (p0, j0) into panels of NR columns
+// Each panel is stored row after row (NR values per row), the last panel is padded with zeros
+template <size_t NR>
+void packB(const double* b, size_t ldb, bool trans, size_t p0, size_t j0, size_t kb, size_t nb, double* packed) {
+    for (size_t jr = 0; jr < nb; jr += NR) {
+        size_t cols = std::min(NR, nb - jr);
+        for (size_t p = 0; p < kb; ++p) {
+            if (!trans && cols == NR) {
+                // The common case is a straight copy of a piece of row
+                const double* row = b + (p0 + p) * ldb + j0 + jr;
+                std::copy(row, row + NR, packed);
+            } else {
+                for (size_t j = 0; j < NR; ++j) {
+                    packed[j] = j < cols ? at(b, ldb, trans, p0 + p, j0 + jr + j) : 0.0;
+                }
+            }
+            packed += NR;
+        }
+    }
+}
+
+// Adds the product of a packed panel of A (MR x kb) and a packed panel of B (kb x NR) to a tile of C
+// Only the first rows x cols values of the tile are written, for the tiles on the borders of C
+template <size_t MR, size_t NR>
+void microKernel(size_t kb, const double* __restrict a, const double* __restrict b,
+                 double* c, size_t ldc, size_t rows, size_t cols) {
+    double acc[MR][NR] = {};
+    for (size_t p = 0; p < kb; ++p) {
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+
+    if (rows == MR && cols == NR) {
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                c[i * ldc + j] += acc[i][j];
+            }
+        }
+    } else {
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                c[i * ldc + j] += acc[i][j];
+            }
+        }
+    }
+}
+
+// Adds alpha * op(A) * op(B) to the rows [i0, i1) and the columns [j0, j1) of C, block by block
+// The packing buffers belong to the calling thread, a product never waits in the middle so they are free
+template <size_t MR, size_t NR>
+void blockedProduct(const GemmConfig& config, bool trans_a, bool trans_b,
+                    size_t i0, size_t i1, size_t j0, size_t j1, size_t k,
+                    double alpha, const double* a, size_t lda, const double* b, size_t ldb, double* c, size_t ldc) {
+    const size_t MC = config.mc;
+    const size_t KC = config.kc;
+    const size_t NC = config.nc;
+
+    // The packing buffers are kept from one call to the next, they only grow
+    thread_local std::vector<double> packed_a;
+    thread_local std::vector<double> packed_b;
+    packed_a.resize(std::max(packed_a.size(), ((MC + MR - 1) / MR) * MR * KC));
+    packed_b.resize(std::max(packed_b.size(), ((NC + NR - 1) / NR) * NR * KC));
+
+    for (size_t jc = j0; jc < j1; jc += NC) {
+        size_t nb = std::min(NC, j1 - jc);
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kb = std::min(KC, k - pc);
+            packB<NR>(b, ldb, trans_b, pc, jc, kb, nb, packed_b.data());
+
+            for (size_t ic = i0; ic < i1; ic += MC) {
+                size_t mb = std::min(MC, i1 - ic);
+                packA<MR>(a, lda, trans_a, ic, pc, mb, kb, alpha, packed_a.data());
+
+                for (size_t jr = 0; jr < nb; jr += NR) {
+                    const double* panel_b = packed_b.data() + (jr / NR) * NR * kb;
+                    for (size_t ir = 0; ir < mb; ir += MR) {
+                        const double* panel_a = packed_a.data() + (ir / MR) * MR * kb;
+                        microKernel<MR, NR>(kb, panel_a, panel_b, c + (ic + ir) * ldc + jc + jr, ldc,
+                                            std::min(MR, mb - ir), std::min(NR, nb - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The micro-kernels there are, each one with the blocked product built around it
+using BlockedProduct = void (*)(const GemmConfig& config, bool trans_a, bool trans_b,
+                                size_t i0, size_t i1, size_t j0, size_t j1, size_t k,
+                                double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+                                double* c, size_t ldc);
+
+struct Kernel {
+    uint32_t mr;
+    uint32_t nr;
+    BlockedProduct product;
+};
+
+const Kernel micro_kernels[] = {
+    {4, 8, &blockedProduct<4, 8>},
+    {8, 4, &blockedProduct<8, 4>},
+    {4, 4, &blockedProduct<4, 4>},
+    {8, 8, &blockedProduct<8, 8>},
+    {2, 8, &blockedProduct<2, 8>},
+};
+
+BlockedProduct findKernel(uint32_t mr, uint32_t nr) {
+    for (const Kernel& kernel : micro_kernels) {
+        if (kernel.mr == mr && kernel.nr == nr) {
+            return kernel.product;
+        }
+    }
+    return nullptr;
+}
+
+// The configurations gemm uses, and where the shapes are collected if they are
+// The products read the pointer on any thread, the vector is only touched under the lock
+GemmTuning tuning;
+std::atomic<std::vector<GemmShape>*> recorded{nullptr};
+std::mutex record_lock;
+
+}
+
+const GemmConfig& GemmTuning::find(const GemmShape& shape) const {
+    // A network runs a handful of shapes, a linear search is cheaper than the smallest product
+    for (const auto& [tuned, config] : shapes) {
+        if (tuned == shape) {
+            return config;
+        }
+    }
+    return fallback;
+}
+
+const std::vector<std::pair<uint32_t, uint32_t>>& gemmKernelShapes() {
+    static const std::vector<std::pair<uint32_t, uint32_t>> shapes = [] {
+        std::vector<std::pair<uint32_t, uint32_t>> list;
+        for (const Kernel& kernel : micro_kernels) {
+            list.emplace_back(kernel.mr, kernel.nr);
+        }
+        return list;
+    }();
+    return shapes;
+}
+
+void checkGemmConfig(const GemmConfig& config) {
+    if (!findKernel(config.mr, config.nr)) {
+        throw std::invalid_argument("There is no " + std::to_string(config.mr) + "x" + std::to_string(config.nr)
+                                    + " GEMM micro-kernel");
+    }
+    if (config.mc == 0 || config.kc == 0 || config.nc == 0 || config.tiles_per_thread == 0) {
+        throw std::invalid_argument("The GEMM blocks and tiles can't be empty");
+    }
+}
+
+void setGemmTuning(const GemmTuning& new_tuning) {
+    checkGemmConfig(new_tuning.fallback);
+    for (const auto& [shape, config] : new_tuning.shapes) {
+        checkGemmConfig(config);
+    }
+    tuning = new_tuning;
+}
+
+const GemmTuning& gemmTuning() {
+    return tuning;
+}
+
+void recordGemmShapes(std::vector<GemmShape>* shapes) {
+    std::lock_guard<std::mutex> guard(record_lock);
+    recorded.store(shapes, std::memory_order_relaxed);
+}
+
+namespace {
+
+void product(const GemmConfig& config, BlockedProduct blocked, bool trans_a, bool trans_b, size_t m, size_t n,
+             size_t k, double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+             double beta, double* c, size_t ldc) {
+    if (recorded.load(std::memory_order_relaxed)) {
+        // The pointer is read again under the lock, the recording may have stopped meanwhile
+        std::lock_guard<std::mutex> guard(record_lock);
+        std::vector<GemmShape>* shapes = recorded.load(std::memory_order_relaxed);
+        const GemmShape shape{trans_a, trans_b, m, n, k};
+        if (shapes && std::find(shapes->begin(), shapes->end(), shape) == shapes->end()) {
+            shapes->push_back(shape);
+        }
+    }
+#ifdef DUMBRONS_PROFILE
+    // One kernel row for each of the four transpositions, C is read too unless beta is 0
+    static const std::string kernels[4] = {"gemm NN", "gemm NT", "gemm TN", "gemm TT"};
+    const std::string& kernel = kernels[(trans_a ? 2 : 0) + (trans_b ? 1 : 0)];
+    const OpCost cost{2.0 * m * n * k, 8.0 * (m * k + k * n + (beta == 0.0 ? 1.0 : 2.0) * m * n)};
+#endif
+    PROFILE_SCOPE(&kernel, kernel, ProfilePhase::Kernel, cost);
+
+    // C = beta * C first, then the product is accumulated into it
+    // A zero beta overwrites C, so whatever it held (even NaN) does not matter
+    for (size_t i = 0; i < m; ++i) {
+        double* row = c + i * ldc;
+        if (beta == 0.0) {
+            std::fill(row, row + n, 0.0);
+        } else if (beta != 1.0) {
+            for (size_t j = 0; j < n; ++j) {
+                row[j] *= beta;
+            }
+        }
+    }
+    if (k == 0 || alpha == 0.0) {
+        return;
+    }
+
+    Scheduler& scheduler = Scheduler::instance();
+    const size_t threads = scheduler.numThreads();
+    if (threads == 1 || 2.0 * m * n * k < parallel_flops) {
+        blocked(config, trans_a, trans_b, 0, m, 0, n, k, alpha, a, lda, b, ldb, c, ldc);
+        return;
+    }
+
+    // C is cut into tiles, each one a product of its own (it packs its rows of A and its columns of B).
+    // The longer side is halved until there are a few tiles per thread, or the tiles would get too small
+    // to use what they packed
+    size_t row_tiles = 1;
+    size_t col_tiles = 1;
+    while (row_tiles * col_tiles < config.tiles_per_thread * threads) {
+        size_t tile_m = (m + row_tiles - 1) / row_tiles;
+        size_t tile_n = (n + col_tiles - 1) / col_tiles;
+        bool cut_rows = tile_m / 2 >= min_tile_rows;
+        bool cut_cols = tile_n / 2 >= min_tile_cols;
+        if (cut_rows && (!cut_cols || tile_m >= tile_n)) {
+            row_tiles *= 2;
+        } else if (cut_cols) {
+            col_tiles *= 2;
+        } else {
+            break;
+        }
+    }
+    // The tiles are whole panels of the micro-kernel, except on the borders
+    const size_t tile_rows = ((m + row_tiles - 1) / row_tiles + config.mr - 1) / config.mr * config.mr;
+    const size_t tile_cols = ((n + col_tiles - 1) / col_tiles + config.nr - 1) / config.nr * config.nr;
+    row_tiles = (m + tile_rows - 1) / tile_rows;
+    col_tiles = (n + tile_cols - 1) / tile_cols;
+
+    scheduler.parallelFor(0, row_tiles * col_tiles, 1, [&](size_t first, size_t last) {
+        for (size_t t = first; t < last; ++t) {
+            size_t i0 = (t / col_tiles) * tile_rows;
+            size_t j0 = (t % col_tiles) * tile_cols;
+            blocked(config, trans_a, trans_b, i0, std::min(m, i0 + tile_rows), j0, std::min(n, j0 + tile_cols), k,
+                    alpha, a, lda, b, ldb, c, ldc);
+        }
+    });
+}
+
+}
+
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc) {
+    if (m == 0 || n == 0) {
+        return;
+    }
+    // The configurations were checked when they were set
+    const GemmConfig& config = tuning.find(GemmShape{trans_a, trans_b, m, n, k});
+    product(config, findKernel(config.mr, config.nr), trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb,
+            beta, c, ldc);
+}
+
+void gemm(const GemmConfig& config, bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc) {
+    checkGemmConfig(config);
+    if (m == 0 || n == 0) {
+        return;
+    }
+    product(config, findKernel(config.mr, config.nr), trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb,
+            beta, c, ldc);
+}
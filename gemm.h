@@ -0,0 +1,105 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the matrix multiplication kernel used by Matrix and Layer, on raw row-major arrays.
+// The kernel follows the usual blocked design : blocks of B and A are packed into small contiguous
+// panels (reading them transposed or not), then a micro-kernel computes a MR x NR tile of C in registers.
+// A large product is cut into tiles of C computed in parallel on the scheduler (see scheduler.h). Every value
+// of C is still summed in the same order, so the results do not depend on the number of threads.
+// The shape of the micro-kernel, the sizes of the blocks and how finely a product is cut for the threads are
+// a GemmConfig : each shape of product may get its own, measured on the machine (see gemm_tuner.h).
+//
+// This file is released under the MIT License.
+//
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// How a product is computed : the micro-kernel, the blocks it packs, and the tiles it is cut into for the threads.
+// Another configuration only changes the speed, except kc : the sums along k are cut into blocks of kc values,
+// so their rounding depends on it (every configuration still gives the same results on any number of threads).
+// The tuner leaves kc at its default value : a tuning file is read at the start of every run, it must not change its numbers
+struct GemmConfig {
+    // Shape of the tile of C computed in registers, one of gemmKernelShapes()
+    uint32_t mr = 4;
+    uint32_t nr = 8;
+    // A kc x nc block of B and a mc x kc block of A are packed at a time
+    size_t mc = 64;
+    size_t kc = 256;
+    size_t nc = 2048;
+    // A product large enough to be shared is cut into this many tiles of C per thread, at most
+    size_t tiles_per_thread = 4;
+
+    bool operator==(const GemmConfig&) const = default;
+};
+
+// A shape of product, as the tuning tells them apart
+struct GemmShape {
+    bool trans_a = false;
+    bool trans_b = false;
+    size_t m = 0;
+    size_t n = 0;
+    size_t k = 0;
+
+    bool operator==(const GemmShape&) const = default;
+};
+
+// The configurations of a machine : one for each shape that was tuned, and one for every other shape
+struct GemmTuning {
+    GemmConfig fallback;
+    std::vector<std::pair<GemmShape, GemmConfig>> shapes;
+
+    // The configuration of a shape
+    const GemmConfig& find(const GemmShape& shape) const;
+};
+
+// The shapes of micro-kernel there is a kernel for, as (mr, nr)
+const std::vector<std::pair<uint32_t, uint32_t>>& gemmKernelShapes();
+
+// Checks a configuration
+//
+// Throws std::invalid_argument if there is no micro-kernel of its shape or a size is 0
+void checkGemmConfig(const GemmConfig& config);
+
+// Sets the configurations gemm uses from now on, the default one is used for every shape otherwise.
+// It must not be called while products run (it is meant for the start of the program)
+//
+// Throws std::invalid_argument if a configuration is not valid (see checkGemmConfig)
+void setGemmTuning(const GemmTuning& tuning);
+const GemmTuning& gemmTuning();
+
+// Starts collecting the shapes of the products computed, each shape once, until it is called with nullptr.
+// The products may run on any thread meanwhile (the loader and the evaluator compute some too),
+// the shapes must only be read once the recording is stopped
+void recordGemmShapes(std::vector<GemmShape>* shapes);
+
+// Computes C = alpha * op(A) * op(B) + beta * C
+// op(A) is m x k and op(B) is k x n, C is m x n. op(X) is X, or its transpose if the flag is set.
+// Every matrix is stored row by row, ld is the distance between two rows (the number of columns when packed).
+// When beta is 0, C does not need to be initialized.
+//
+// Parameters :
+// trans_a, trans_b : whether A and B are used transposed
+// m, n, k : sizes of the product
+// alpha : scale of the product
+// a, lda : the values of A and its leading dimension (A is m x k, or k x m when transposed)
+// b, ldb : the values of B and its leading dimension (B is k x n, or n x k when transposed)
+// beta : scale of the previous values of C
+// c, ldc : the values of C and its leading dimension
+// The configuration is the one the tuning gives to the shape (see setGemmTuning)
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc);
+
+// Same as above, with a given configuration instead of the one of the tuning (the tuner times them this way)
+//
+// Throws std::invalid_argument if the configuration is not valid (see checkGemmConfig)
+void gemm(const GemmConfig& config, bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc);
+
+#endif //GEMM_H
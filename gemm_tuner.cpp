@@ -0,0 +1,294 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "gemm_tuner.h"
+#include "benchmark.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// First line of a tuning file, the number is the version of the format
+const std::string tuning_magic = "dumbrons gemm tuning 1";
+
+// The candidate settings, around the default configuration
+// kc is not among them : it changes how the sums along k are rounded, and a tuning must only change the speed
+const size_t mc_candidates[] = {16, 32, 64, 128, 256};
+const size_t nc_candidates[] = {256, 512, 1024, 2048, 4096};
+const size_t tiles_candidates[] = {1, 2, 4, 8};
+
+// A setting replaces the current one only when it is at least this much faster, so the noise of the timings
+// does not wander away from the default configuration
+constexpr double min_gain = 0.03;
+
+// Whether a block size is worth timing for a side of the given length : a block at least as long as the side
+// is the whole side, only the smallest such block is timed
+bool worthTiming(size_t value, size_t extent, const size_t* candidates, size_t count) {
+    if (value < extent) {
+        return true;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (candidates[i] >= extent) {
+            return candidates[i] == value;
+        }
+    }
+    return value == candidates[count - 1];
+}
+
+// The block size a candidate gives : blocks at least as long as the side are all the whole side,
+// the current one is then kept, so a block that changes nothing is not picked for the noise of its timing
+size_t blockSize(size_t value, size_t current, size_t extent) {
+    return value >= extent && current >= extent ? current : value;
+}
+
+std::string shapeName(const GemmShape& shape) {
+    return std::string("gemm ") + (shape.trans_a ? "T" : "N") + (shape.trans_b ? "T" : "N") + " "
+           + std::to_string(shape.m) + "x" + std::to_string(shape.n) + "x" + std::to_string(shape.k);
+}
+
+std::string configName(const GemmConfig& config) {
+    return std::to_string(config.mr) + "x" + std::to_string(config.nr) + ", mc " + std::to_string(config.mc)
+           + ", kc " + std::to_string(config.kc) + ", nc " + std::to_string(config.nc) + ", "
+           + std::to_string(config.tiles_per_thread) + " tiles per thread";
+}
+
+void writeConfig(std::ostream& out, const GemmConfig& config) {
+    out << config.mr << " " << config.nr << " " << config.mc << " " << config.kc << " " << config.nc << " "
+        << config.tiles_per_thread;
+}
+
+// A tuning file is read at the start of every run : with another kc, a seeded run would give other numbers
+// depending on whether the file exists
+void checkKc(const GemmConfig& config, const std::string& path, size_t line) {
+    if (config.kc != GemmConfig().kc) {
+        throw std::runtime_error(path + " : line " + std::to_string(line) + " changes kc, which changes the results"
+                                 + " of the products (tune again with --tune-gemm)");
+    }
+}
+
+bool readConfig(std::istream& in, GemmConfig& config) {
+    return static_cast<bool>(in >> config.mr >> config.nr >> config.mc >> config.kc >> config.nc
+                                >> config.tiles_per_thread);
+}
+
+}
+
+std::vector<GemmShape> networkGemmShapes(const Network& net, const std::vector<size_t>& train_batches,
+                                         const std::vector<size_t>& eval_batches) {
+    for (const std::vector<size_t>* sizes : {&train_batches, &eval_batches}) {
+        if (std::find(sizes->begin(), sizes->end(), 0) != sizes->end()) {
+            throw std::invalid_argument("The batch sizes must be positive");
+        }
+    }
+    // A network of the same layers, so the weights and the plans of the network are left alone
+    std::vector<LayerSpec> specs;
+    for (const auto& layer : net.getLayers()) {
+        specs.push_back(layer->spec());
+    }
+    Network probe(specs);
+    const size_t input_size = net.getLayers().front()->inputSize();
+    const size_t output_size = net.getLayers().back()->outputSize();
+
+    std::vector<GemmShape> shapes;
+    recordGemmShapes(&shapes);
+    try {
+        for (size_t n : train_batches) {
+            probe.train(Matrix(input_size, n), Matrix(output_size, n));
+        }
+        for (size_t n : eval_batches) {
+            probe.forward(Matrix(input_size, n));
+        }
+    } catch (...) {
+        recordGemmShapes(nullptr);
+        throw;
+    }
+    recordGemmShapes(nullptr);
+    return shapes;
+}
+
+GemmConfig tuneGemmShape(const GemmShape& shape, double seconds, std::ostream* log) {
+    // Random operands, stored as the network stores them (packed rows)
+    const size_t lda = shape.trans_a ? shape.m : shape.k;
+    const size_t ldb = shape.trans_b ? shape.k : shape.n;
+    std::vector<double> a(shape.m * shape.k);
+    std::vector<double> b(shape.k * shape.n);
+    std::vector<double> c(shape.m * shape.n);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (double& v : a) {
+        v = dist(rng);
+    }
+    for (double& v : b) {
+        v = dist(rng);
+    }
+
+    Benchmark benchmark("", seconds / 4, seconds, 5);
+    const double flops = 2.0 * shape.m * shape.n * shape.k;
+    auto time = [&](const GemmConfig& config) {
+        const BenchmarkResult* result = benchmark.run(shapeName(shape) + " " + configName(config), flops, 0.0, [&] {
+            gemm(config, shape.trans_a, shape.trans_b, shape.m, shape.n, shape.k, 1.0, a.data(), lda,
+                 b.data(), ldb, 0.0, c.data(), shape.n);
+        });
+        return result->median;
+    };
+
+    const GemmConfig fallback;
+    GemmConfig best = fallback;
+    const double default_time = time(best);
+    double best_time = default_time;
+    auto consider = [&](const GemmConfig& config) {
+        if (config == best) {
+            return;
+        }
+        double seconds_taken = time(config);
+        if (seconds_taken < best_time * (1.0 - min_gain)) {
+            best = config;
+            best_time = seconds_taken;
+        }
+    };
+
+    // The micro-kernel first : the blocks are then sized for the one that is kept
+    const GemmConfig with_default_kernel = best;
+    for (const auto& [mr, nr] : gemmKernelShapes()) {
+        GemmConfig config = with_default_kernel;
+        config.mr = mr;
+        config.nr = nr;
+        consider(config);
+    }
+
+    const GemmConfig with_kernel = best;
+    for (size_t mc : mc_candidates) {
+        if (!worthTiming(mc, shape.m, mc_candidates, std::size(mc_candidates))) {
+            continue;
+        }
+        GemmConfig config = with_kernel;
+        config.mc = blockSize(mc, with_kernel.mc, shape.m);
+        consider(config);
+    }
+
+    const GemmConfig with_a_blocks = best;
+    for (size_t nc : nc_candidates) {
+        if (!worthTiming(nc, shape.n, nc_candidates, std::size(nc_candidates))) {
+            continue;
+        }
+        GemmConfig config = with_a_blocks;
+        config.nc = blockSize(nc, with_a_blocks.nc, shape.n);
+        consider(config);
+    }
+
+    // The split only matters when the product is shared between threads
+    if (Scheduler::instance().numThreads() > 1) {
+        const GemmConfig with_blocks = best;
+        for (size_t tiles : tiles_candidates) {
+            GemmConfig config = with_blocks;
+            config.tiles_per_thread = tiles;
+            consider(config);
+        }
+    }
+
+    if (log) {
+        *log << shapeName(shape) << " : " << configName(best) << ", " << flops / best_time * 1e-9 << " GFLOP/s ("
+             << flops / default_time * 1e-9 << " GFLOP/s with the default configuration)\n";
+    }
+    return best;
+}
+
+GemmTuning tuneGemm(const std::vector<GemmShape>& shapes, double seconds, std::ostream* log) {
+    GemmTuning tuning;
+    for (const GemmShape& shape : shapes) {
+        GemmConfig config = tuneGemmShape(shape, seconds, log);
+        // A shape that keeps the default configuration does not need a line
+        if (!(config == tuning.fallback)) {
+            tuning.shapes.emplace_back(shape, config);
+        }
+    }
+    return tuning;
+}
+
+std::string defaultGemmTuningPath() {
+    return "gemm_tuning/" + hostName() + ".txt";
+}
+
+void saveGemmTuning(const GemmTuning& tuning, const std::string& path) {
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(parent, ec);
+    }
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't write the GEMM tuning to " + path);
+    }
+    file << tuning_magic << "\n";
+    file << "host " << hostName() << "\n";
+    file << "date " << currentDate() << "\n";
+    file << "threads " << Scheduler::instance().numThreads() << "\n";
+    file << "# default : mr nr mc kc nc tiles_per_thread\n";
+    file << "# shape : N|T N|T m n k, then the configuration\n";
+    file << "default ";
+    writeConfig(file, tuning.fallback);
+    file << "\n";
+    for (const auto& [shape, config] : tuning.shapes) {
+        file << "shape " << (shape.trans_a ? "T" : "N") << " " << (shape.trans_b ? "T" : "N") << " "
+             << shape.m << " " << shape.n << " " << shape.k << " ";
+        writeConfig(file, config);
+        file << "\n";
+    }
+    if (!file) {
+        throw std::runtime_error("Can't write the GEMM tuning to " + path);
+    }
+}
+
+GemmTuning loadGemmTuning(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't read the GEMM tuning " + path);
+    }
+    std::string line;
+    if (!std::getline(file, line) || line != tuning_magic) {
+        throw std::runtime_error(path + " is not a GEMM tuning file");
+    }
+
+    GemmTuning tuning;
+    size_t number = 1;
+    while (std::getline(file, line)) {
+        ++number;
+        std::istringstream in(line);
+        std::string kind;
+        if (!(in >> kind) || kind[0] == '#' || kind == "host" || kind == "date" || kind == "threads") {
+            continue;
+        }
+        bool valid = false;
+        if (kind == "default") {
+            valid = readConfig(in, tuning.fallback);
+        } else if (kind == "shape") {
+            std::string trans_a;
+            std::string trans_b;
+            GemmShape shape;
+            GemmConfig config;
+            valid = (in >> trans_a >> trans_b >> shape.m >> shape.n >> shape.k) && readConfig(in, config)
+                    && (trans_a == "N" || trans_a == "T") && (trans_b == "N" || trans_b == "T");
+            shape.trans_a = trans_a == "T";
+            shape.trans_b = trans_b == "T";
+            if (valid) {
+                checkGemmConfig(config);
+                checkKc(config, path, number);
+                tuning.shapes.emplace_back(shape, config);
+            }
+        }
+        if (!valid) {
+            throw std::runtime_error(path + " : line " + std::to_string(number) + " is not valid");
+        }
+        if (kind == "default") {
+            checkKc(tuning.fallback, path, number);
+        }
+    }
+    checkGemmConfig(tuning.fallback);
+    return tuning;
+}
@@ -0,0 +1,63 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the GEMM tuner : it times configurations of the kernel (the shape of the micro-kernel, the sizes
+// of the packed blocks, the number of tiles per thread) on the shapes of product a network computes,
+// and keeps the fastest one of each shape. The tuning of a machine is written to a small text file,
+// read back at the start of the next runs so the search is done only once per machine (see setGemmTuning).
+//
+// This file is released under the MIT License.
+//
+
+#ifndef GEMM_TUNER_H
+#define GEMM_TUNER_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "gemm.h"
+#include "network.h"
+
+// Returns the shapes of the products of a network : those of one training step on batches of each training size,
+// and those of one forward pass on batches of each evaluation size (as the validation and the evaluator run it).
+// They are recorded on a copy of the layers, the network itself is not run
+//
+// Parameters :
+// net : the network
+// train_batches : the numbers of samples of the training batches (a shorter last batch has its own shapes)
+// eval_batches : the numbers of samples of the evaluation batches
+//
+// Throws std::invalid_argument if a batch size is 0
+std::vector<GemmShape> networkGemmShapes(const Network& net, const std::vector<size_t>& train_batches,
+                                         const std::vector<size_t>& eval_batches);
+
+// Finds the fastest configuration of a shape, one setting after the other : the micro-kernel,
+// then the blocks of A (mc), then the blocks of B (nc), then the tiles per thread. kc keeps its default value,
+// so a tuning never changes the results, only the speed (see GemmConfig).
+// A setting is only changed when it is clearly faster, the default configuration is kept otherwise
+//
+// Parameters :
+// shape : the product to tune
+// seconds : time spent timing each configuration
+// log : where each tuned shape is reported, nullptr to say nothing
+GemmConfig tuneGemmShape(const GemmShape& shape, double seconds = 0.01, std::ostream* log = nullptr);
+
+// Tunes every shape, the default configuration stays the one of the other shapes
+GemmTuning tuneGemm(const std::vector<GemmShape>& shapes, double seconds = 0.01, std::ostream* log = nullptr);
+
+// The tuning file of this machine : gemm_tuning/<host name>.txt
+std::string defaultGemmTuningPath();
+
+// Writes a tuning to a text file : a header (the host, the date, the number of threads it was measured with),
+// then the default configuration and one line per shape. The directory of the file is made if needed
+//
+// Throws std::runtime_error if the file can't be written
+void saveGemmTuning(const GemmTuning& tuning, const std::string& path);
+
+// Reads a tuning written by saveGemmTuning
+//
+// Throws std::runtime_error if the file can't be read, is not a tuning file or changes kc,
+// std::invalid_argument if a configuration is not valid (see checkGemmConfig)
+GemmTuning loadGemmTuning(const std::string& path);
+
+#endif //GEMM_TUNER_H
@@ -5,99 +5,161 @@
 //
 
 #include "layer.h"
-#include <random>
-
-// Bias and weights are initialized, inputs and outputs are initialized to zero
-Layer::Layer(size_t in_size, size_t out_size,
-             std::function<double(double)> activation,
-             std::function<double(double)> activation_deriv)
-    : weights(out_size, in_size),
-      biases(out_size, 1, 0.0),
-      inputs(in_size, 1, 0.0),
-      outputs(out_size, 1, 0.0),
-      deltas(out_size, 1, 0.0),
-      activation(activation),
-      activation_deriv(activation_deriv)
-{
-    // Initialize weights with random values in the range [-1, 1]
-    // Using a random device and Mersenne Twister for better randomness
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dist(-1.0, 1.0);
-
-    // Fill the weights matrix with random values
-    for (size_t i = 0; i < out_size; ++i) {
-        for (size_t j = 0; j < in_size; ++j) {
-            weights(i, j) = dist(gen);
-        }
+#include "dense.h"
+#include "conv.h"
+#include "pool.h"
+#include "activation_layer.h"
+#include <stdexcept>
+
+void Layer::resizeFor(Matrix& m, size_t rows, size_t cols) {
+    if (m.numRows() != rows || m.numCols() != cols) {
+        m = Matrix(rows, cols);
     }
 }
 
-Matrix Layer::forward(const Matrix& input) {
-    // Just some checks to ensure the input is a column vector of the correct size
-    if (input.numRows() != weights.numCols() || input.numCols() != 1) {
-        throw std::invalid_argument("Input must be a column vector of size (in, 1)");
+void Layer::checkForward(const Matrix& input, const Matrix& output) const {
+    if (input.numRows() != inputSize() || input.numCols() == 0) {
+        throw std::invalid_argument("Input must be a matrix of size (" + std::to_string(inputSize()) + ", n)");
     }
+    if (output.numRows() != outputSize() || output.numCols() != input.numCols()) {
+        throw std::invalid_argument("Output must be a matrix of size (" + std::to_string(outputSize()) + ", n)");
+    }
+}
 
-    // Reset outputs and deltas
-    inputs = input;
+void Layer::checkBackward(const Matrix& dLoss_dOutput, const Matrix* dLoss_dInput, size_t n) const {
+    if (dLoss_dOutput.numRows() != outputSize() || dLoss_dOutput.numCols() != n) {
+        throw std::invalid_argument("dLoss/dOutput must match output dimensions");
+    }
+    if (dLoss_dInput && (dLoss_dInput->numRows() != inputSize() || dLoss_dInput->numCols() != n)) {
+        throw std::invalid_argument("dLoss/dInput must match input dimensions");
+    }
+}
 
-    // Compute the linear combination of inputs and weights, plus biases
-    // In other words, it computes z = W * x + b
-    Matrix z = weights * input + biases;
+const Matrix& Layer::forward(const Matrix& input) {
+    resizeFor(own_outputs, outputSize(), input.numCols());
+    PROFILE_SCOPE(this, describe(), ProfilePhase::Forward, forwardCost(input.numCols()));
+    forwardInto(input, own_outputs);
+    return own_outputs;
+}
 
-    // Store the outputs of the layer after applying the activation function
-    outputs = z;
+const Matrix& Layer::backward(const Matrix& dLoss_dOutput) {
+    resizeFor(own_input_grads, inputSize(), dLoss_dOutput.numCols());
+    PROFILE_SCOPE(this, describe(), ProfilePhase::Backward, backwardCost(dLoss_dOutput.numCols(), true));
+    backwardInto(dLoss_dOutput, &own_input_grads);
+    return own_input_grads;
+}
 
-    // Apply the activation function to each element of the outputs
-    // I think the structure  should be improved to make using activation functions like softmax easier
-    // For now, we assume the activation function is applied element-wise
-    for (size_t i = 0; i < outputs.numRows(); ++i) {
-        outputs(i, 0) = activation(outputs(i, 0));
-    }
+OpCost Layer::forwardCost(size_t n) const {
+    return {static_cast<double>(outputSize() * n), 8.0 * (inputSize() + outputSize()) * n};
+}
 
-    return outputs;
+OpCost Layer::backwardCost(size_t n, bool input_gradient) const {
+    // The output and its gradient are read, the gradient of the input written
+    return {static_cast<double>(outputSize() * n), 8.0 * (2 * outputSize() + (input_gradient ? inputSize() : 0)) * n};
 }
 
-Matrix Layer::backward(const Matrix& dLoss_dOutput) {
-    if (dLoss_dOutput.numRows() != outputs.numRows() || dLoss_dOutput.numCols() != 1) {
-        throw std::invalid_argument("dLoss/dOutput must match output dimensions");
+std::string Layer::describe() const {
+    LayerSpec s = spec();
+    const std::string activation = s.activation == Activation::Identity ? "" : " " + activationName(s.activation);
+    auto image = [](size_t channels, size_t height, size_t width) {
+        return std::to_string(channels) + "x" + std::to_string(height) + "x" + std::to_string(width);
+    };
+    switch (s.kind) {
+        case LayerKind::Dense:
+            return "dense " + std::to_string(s.in_size) + "x" + std::to_string(s.out_size) + activation;
+        case LayerKind::Conv2D:
+            return "conv " + image(s.channels, s.height, s.width) + " " + std::to_string(s.filters) + "x"
+                   + std::to_string(s.window) + "x" + std::to_string(s.window) + activation;
+        case LayerKind::MaxPool2D:
+            return "maxpool " + image(s.channels, s.height, s.width) + " " + std::to_string(s.window) + "x"
+                   + std::to_string(s.window);
+        case LayerKind::AvgPool2D:
+            return "avgpool " + image(s.channels, s.height, s.width) + " " + std::to_string(s.window) + "x"
+                   + std::to_string(s.window);
+        case LayerKind::Activation:
+            return activationName(s.activation) + " " + std::to_string(s.in_size);
+        case LayerKind::Softmax:
+            return "softmax " + std::to_string(s.in_size);
     }
+    return "layer";
+}
 
-    // Reset deltas
-    deltas = outputs;
-
-    // Compute the deltas for the layer
-    // deltas = dActivation(outputs) * dLoss/dOutput
-    for (size_t i = 0; i < deltas.numRows(); ++i) {
-        deltas(i, 0) = activation_deriv(outputs(i, 0)) * dLoss_dOutput(i, 0);
-    }
+LayerSpec LayerSpec::dense(size_t in_size, size_t out_size, Activation activation) {
+    LayerSpec spec;
+    spec.kind = LayerKind::Dense;
+    spec.activation = activation;
+    spec.in_size = in_size;
+    spec.out_size = out_size;
+    return spec;
+}
 
-    // Compute the gradient of the loss with respect to the weights
-    // dLoss/dWeights = deltas * inputs^T
-    Matrix dLoss_dInput = weights.transpose() * deltas;
+LayerSpec LayerSpec::conv2d(size_t channels, size_t height, size_t width, size_t filters, size_t window,
+                            size_t stride, size_t padding, Activation activation) {
+    LayerSpec spec;
+    spec.kind = LayerKind::Conv2D;
+    spec.activation = activation;
+    spec.channels = channels;
+    spec.height = height;
+    spec.width = width;
+    spec.filters = filters;
+    spec.window = window;
+    spec.stride = stride;
+    spec.padding = padding;
+    return spec;
+}
 
-    return dLoss_dInput;
+LayerSpec LayerSpec::maxPool2d(size_t channels, size_t height, size_t width, size_t window, size_t stride) {
+    LayerSpec spec;
+    spec.kind = LayerKind::MaxPool2D;
+    spec.channels = channels;
+    spec.height = height;
+    spec.width = width;
+    spec.window = window;
+    spec.stride = stride;
+    return spec;
 }
 
-void Layer::update(double learning_rate) {
-    // Update the weights and biases using the deltas computed during backpropagation
-    // The gradient of the loss with respect to the weights is given by deltas * inputs^T
-    // The gradient of the loss with respect to the biases is given by deltas
+LayerSpec LayerSpec::avgPool2d(size_t channels, size_t height, size_t width, size_t window, size_t stride) {
+    LayerSpec spec = maxPool2d(channels, height, width, window, stride);
+    spec.kind = LayerKind::AvgPool2D;
+    return spec;
+}
 
-    Matrix grad_w = deltas * inputs.transpose();
+LayerSpec LayerSpec::activate(size_t size, Activation activation) {
+    LayerSpec spec;
+    spec.kind = LayerKind::Activation;
+    spec.activation = activation;
+    spec.in_size = size;
+    spec.out_size = size;
+    return spec;
+}
 
-    for (size_t i = 0; i < weights.numRows(); ++i) {
-        for (size_t j = 0; j < weights.numCols(); ++j) {
-            // Update the weights using gradient descent
-            // w_i,j = w_i,j - learning_rate * dLoss/dWeights_i,j
-            weights(i, j) -= learning_rate * grad_w(i, j);
-        }
-    }
+LayerSpec LayerSpec::softmax(size_t size) {
+    LayerSpec spec;
+    spec.kind = LayerKind::Softmax;
+    spec.in_size = size;
+    spec.out_size = size;
+    return spec;
+}
 
-    for (size_t i = 0; i < biases.numRows(); ++i) {
-        // Update the biases using gradient descent
-        // b_i = b_i - learning_rate * dLoss/dBias_i
-        biases(i, 0) -= learning_rate * deltas(i, 0);
+std::unique_ptr<Layer> makeLayer(const LayerSpec& spec) {
+    switch (spec.kind) {
+        case LayerKind::Dense:
+            if (spec.in_size == 0 || spec.out_size == 0) {
+                throw std::invalid_argument("The sizes of a dense layer must not be 0");
+            }
+            return std::make_unique<Dense>(spec.in_size, spec.out_size, spec.activation);
+        case LayerKind::Conv2D:
+            return std::make_unique<Conv2D>(spec.channels, spec.height, spec.width, spec.filters, spec.window,
+                                            spec.stride, spec.padding, spec.activation);
+        case LayerKind::MaxPool2D:
+            return std::make_unique<MaxPool2D>(spec.channels, spec.height, spec.width, spec.window, spec.stride);
+        case LayerKind::AvgPool2D:
+            return std::make_unique<AvgPool2D>(spec.channels, spec.height, spec.width, spec.window, spec.stride);
+        case LayerKind::Activation:
+            return std::make_unique<ActivationLayer>(spec.in_size, spec.activation);
+        case LayerKind::Softmax:
+            return std::make_unique<Softmax>(spec.in_size);
     }
-}
\ No newline at end of file
+    throw std::invalid_argument("Unknown layer kind " + std::to_string(static_cast<uint32_t>(spec.kind)));
+}
@@ -1,11 +1,12 @@
 //
 // Created by mazen on 09/06/2025.
 // This file is part of a simple neural network library for C++.
-// It provides a Layer class that represents a single layer in a neural network.
-// The Layer class supports forward and backward passes, weight updates, and uses activation functions.
+// It provides the Layer interface shared by every kind of layer of a network (Dense, Conv2D, MaxPool2D, AvgPool2D,
+// ActivationLayer, Softmax), and the LayerSpec that describes a layer, so a Network can be built from a list of them,
+// saved and loaded. The layers write into buffers given by the caller, so an ExecutionPlan (see plan.h) decides
+// where every intermediate result lives.
 // The library is designed to be easy to use and extend, with a focus on educational purposes.
 // I wrote it to practice C++ and have fun with machine learning concepts.
-// It is just a simple implementation of a neural network layer, not optimized for performance or memory usage.
 //
 // This file is released under the MIT License.
 //
@@ -13,69 +14,155 @@
 #ifndef LAYER_H
 #define LAYER_H
 
+#include <cstdint>
+#include <memory>
+#include <random>
 #include <vector>
 #include "matrix.h"
+#include "activation.h"
+#include "profiler.h"
 
+// The values are stored in model files, they must never change
+enum class LayerKind : uint32_t {
+    Dense = 0,
+    Conv2D = 1,
+    MaxPool2D = 2,
+    AvgPool2D = 3,
+    Activation = 4,
+    Softmax = 5
+};
+
+// What a layer is made of, everything needed to build it again
+// Images are stored channel by channel, each channel row by row : a sample of channels images of height x width
+// is a column of channels * height * width values
+struct LayerSpec {
+    LayerKind kind = LayerKind::Dense;
+    Activation activation = Activation::Identity;
+
+    // Dense : number of inputs and outputs, Activation and Softmax : number of values of a sample (both the same)
+    size_t in_size = 0;
+    size_t out_size = 0;
 
+    // Conv2D and pooling : the input images, then the window (window x window pixels) moved by stride pixels
+    // Conv2D has filters output channels and pads its input with padding zeros on every side
+    size_t channels = 0;
+    size_t height = 0;
+    size_t width = 0;
+    size_t filters = 0;
+    size_t window = 0;
+    size_t stride = 1;
+    size_t padding = 0;
+
+    static LayerSpec dense(size_t in_size, size_t out_size, Activation activation);
+    static LayerSpec conv2d(size_t channels, size_t height, size_t width, size_t filters, size_t window,
+                            size_t stride, size_t padding, Activation activation);
+    static LayerSpec maxPool2d(size_t channels, size_t height, size_t width, size_t window, size_t stride);
+    static LayerSpec avgPool2d(size_t channels, size_t height, size_t width, size_t window, size_t stride);
+    static LayerSpec activate(size_t size, Activation activation);
+    static LayerSpec softmax(size_t size);
+};
 
 class Layer {
 private:
-    // Weights and biases are stored as matrices
-    // Weights are of size (out_size, in_size) and biases are of size (out_size, 1)
-    // Outputs are of size (out_size, 1) and inputs are of size (in_size, 1)
-    // Deltas are of size (out_size, 1) and are used for backpropagation
-    // Activation functions are stored as function pointers
-    // Activation is a function that takes a double and returns a double
-    Matrix weights;
-    Matrix biases;
-    Matrix outputs;
-    Matrix inputs;
-    Matrix deltas;
-
-    std::function<double(double)> activation;
-    std::function<double(double)> activation_deriv;
+    // Where forward and backward write when the layer is used on its own, outside of a plan
+    Matrix own_outputs{0, 0};
+    Matrix own_input_grads{0, 0};
 
-public:
-    // Constructor to initialize the layer with given sizes and activation functions
+protected:
+    // Gives a matrix the size of a batch, keeping its values when it already has it
+    // The matrices of a layer are reallocated only when the batch size changes
+    static void resizeFor(Matrix& m, size_t rows, size_t cols);
+
+    // Checks the sizes given to forwardInto and backwardInto
     //
-    // Parameters :
-    // in_size : number of input neurons
-    // out_size : number of output neurons
-    // activation : activation function to be used in the layer
-    // activation_deriv : derivative of the activation function
-    Layer(size_t in_size, size_t out_size,
-          std::function<double(double)> activation,
-          std::function<double(double)> activation_deriv);
+    // Throws std::invalid_argument if they do not match the layer
+    void checkForward(const Matrix& input, const Matrix& output) const;
+    void checkBackward(const Matrix& dLoss_dOutput, const Matrix* dLoss_dInput, size_t n) const;
+
+public:
+    virtual ~Layer() = default;
+
+    // Number of values of a sample at the input and at the output of the layer
+    virtual size_t inputSize() const = 0;
+    virtual size_t outputSize() const = 0;
 
     // Forward pass through the layer
     //
     // Parameters :
-    // input : the input matrix, should be a column vector of size (in_size, 1)
-    // output : the output matrix, which is the result of the forward pass through the layer, should be a column vector of size (out_size, 1)
+    // input : the input matrix, of size (inputSize(), n) for a batch of n samples, one sample per column
+    //         it is not copied, if keepsInput() it must stay alive and unchanged until the backward pass of the batch
+    // output : where the result is written, of size (outputSize(), n)
+    //          if keepsOutput() it must stay alive and unchanged until the backward pass of the batch
     //
-    // throws std::invalid_argument if the input dimensions do not match the expected size
-    Matrix forward(const Matrix& input);
+    // throws std::invalid_argument if the dimensions do not match the layer
+    virtual void forwardInto(const Matrix& input, Matrix& output) = 0;
 
-    // Backward pass through the layer
+    // Backward pass through the layer, for the batch of the last forward pass
+    // The gradients of the parameters are the sums of the gradients of the samples of the batch
     //
     // Parameters :
-    // dLoss_dOutput : the gradient of the loss with respect to the output of the layer, should be a column vector of size (out_size, 1)
-    // output : the gradient of the loss with respect to the input of the layer, should be a column vector of size (in_size, 1)
+    // dLoss_dOutput : the gradient of the loss with respect to the output of the layer, of size (outputSize(), n)
+    // dLoss_dInput : where the gradient of the loss with respect to the input of the layer is written,
+    //                of size (inputSize(), n), or null when nobody needs it (the first layer of a network)
     //
-    // throws std::invalid_argument if the dimensions of dLoss_dOutput do not match the output size of the layer
-    Matrix backward(const Matrix& dLoss_dOutput);
+    // throws std::invalid_argument if the dimensions do not match the last forward pass
+    virtual void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) = 0;
+
+    // Whether backward reads the input or the output of the last forward pass
+    // Otherwise their memory can be reused as soon as forward is done with them
+    virtual bool keepsInput() const { return false; }
+    virtual bool keepsOutput() const { return false; }
 
-    // Update the weights and biases of the layer using the deltas computed during backpropagation
+    // Asks the layer to apply an activation to its outputs, at the end of its own forward pass (and its derivative
+    // at the start of its backward pass), in place of a separate activation layer : one pass over the outputs
+    // instead of two and one buffer less. Only a layer without an activation of its own can take one.
+    // Identity removes the activation fused before.
+    //
+    // output : whether the layer took the activation
+    virtual bool fuseActivation(Activation id) { return id == Activation::Identity; }
+
+    // Same as forwardInto and backwardInto, into buffers kept by the layer, for a layer used on its own
+    // The results stay valid until the next call
+    const Matrix& forward(const Matrix& input);
+    const Matrix& backward(const Matrix& dLoss_dOutput);
+
+    // Number of doubles the layer needs in a parameter arena, 0 for a layer without parameters
+    virtual size_t parameterCount() const { return 0; }
+
+    // Moves the parameters and their gradients into memory owned by someone else (a Network)
+    // The gradients are set to zero
     //
     // Parameters :
-    // learning_rate : the learning rate to be used for updating the weights and biases
-    void update(double learning_rate);
+    // params : where the parameters are stored, must hold parameterCount() doubles
+    // grads : where the gradients are stored, with the same layout as params
+    // copy_values : if true the current parameters are copied into params,
+    //               otherwise the layer takes the values already in params (for example a loaded model)
+    virtual void bind(double*, double*, bool = true) {}
 
-    // Getters for the weights, biases, outputs, inputs, and deltas
-    const Matrix& getOutput() const { return outputs; }
-    const Matrix& getDelta() const { return deltas; }
-};
+    // Draws new random parameters, the constructors do it with a generator seeded by std::random_device
+    // Nothing to do for a layer without parameters
+    virtual void initialize(std::mt19937&) {}
 
+    // What the layer is made of, its activation is Custom when it was built from user functions
+    // An activation fused by a plan is not part of it
+    virtual LayerSpec spec() const = 0;
 
+    // The work of a forward and of a backward pass on a batch of n samples, for the profiler (see profiler.h)
+    // By default one operation per output, and the input and the output (plus the gradients for backward) moved once
+    //
+    // Parameters :
+    // n : the number of samples of the batch
+    // input_gradient : whether the backward pass also computes the gradient with respect to the input
+    virtual OpCost forwardCost(size_t n) const;
+    virtual OpCost backwardCost(size_t n, bool input_gradient) const;
+
+    // A short description of the layer for the profiler and the logs, "conv 1x28x28 8x5x5 relu" for example
+    std::string describe() const;
+};
+
+// Builds the layer a spec describes, with new random parameters
+//
+// Throws std::invalid_argument if the spec is not a valid layer (a size of 0, a window larger than the images...)
+std::unique_ptr<Layer> makeLayer(const LayerSpec& spec);
 
 #endif //LAYER_H
@@ -0,0 +1,200 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "loader.h"
+#include "trace.h"
+#include <chrono>
+#include <stdexcept>
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+BatchLoader::BatchLoader(const Dataset& dataset, size_t classes, size_t batch_size,
+                         size_t depth, size_t threads, Transform transform)
+    : dataset(dataset), classes(classes), transform(std::move(transform)),
+      sampler(nullptr), end(0), next_fill(0), next_take(0), released(0),
+      holding(false), filling(0), stopping(false)
+{
+    if (depth < 2) {
+        throw std::invalid_argument("The loader needs at least 2 buffers");
+    }
+    if (threads == 0) {
+        throw std::invalid_argument("The loader needs at least 1 producer thread");
+    }
+
+    // The buffers are allocated once, at the largest batch size, and reused for the whole training
+    slots.resize(depth);
+    for (Slot& slot : slots) {
+        slot.inputs = Matrix(dataset.numFeatures(), batch_size);
+        slot.targets = Matrix(classes, batch_size);
+        // Swapped in : assigning a view would copy its values
+        Matrix inputs = Matrix::view(slot.inputs.data(), dataset.numFeatures(), batch_size);
+        Matrix targets = Matrix::view(slot.targets.data(), classes, batch_size);
+        slot.batch.inputs.swap(inputs);
+        slot.batch.targets.swap(targets);
+    }
+
+    for (size_t t = 0; t < threads; ++t) {
+        producers.emplace_back(&BatchLoader::producerLoop, this);
+    }
+}
+
+BatchLoader::~BatchLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake_producers.notify_all();
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+}
+
+void BatchLoader::stop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopLocked(lock);
+}
+
+void BatchLoader::stopLocked(std::unique_lock<std::mutex>& lock) {
+    // No batch can be claimed past end, and the batches already claimed are waited for
+    end = 0;
+    holding = false;
+    wake_trainer.wait(lock, [this] { return filling == 0; });
+}
+
+void BatchLoader::startEpoch(const BatchSampler& new_sampler, size_t first_batch) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Batches still being prepared for the previous epoch write into the slots, let them finish first
+    stopLocked(lock);
+
+    sampler = &new_sampler;
+    end = new_sampler.numBatches();
+    next_fill = first_batch;
+    next_take = first_batch;
+    released = first_batch;
+    holding = false;
+    for (Slot& slot : slots) {
+        slot.ready = false;
+    }
+    lock.unlock();
+    wake_producers.notify_all();
+}
+
+const BatchLoader::Batch& BatchLoader::next() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The batch taken last time is done with, its buffer can be filled again
+    if (holding) {
+        holding = false;
+        ++released;
+        wake_producers.notify_all();
+    }
+    if (next_take >= end) {
+        throw std::logic_error("Every batch of the epoch was already taken");
+    }
+
+    Slot& slot = slots[next_take % slots.size()];
+    if (!slot.ready && error.empty()) {
+        TRACE_SCOPE("loader", "wait for batch");
+        auto wait_start = std::chrono::steady_clock::now();
+        wake_trainer.wait(lock, [&] { return slot.ready || !error.empty(); });
+        counters.wait_seconds += secondsSince(wait_start);
+        ++counters.stalls;
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+
+    slot.ready = false;
+    holding = true;
+    ++next_take;
+    ++counters.batches;
+    return slot.batch;
+}
+
+void BatchLoader::producerLoop() {
+    TRACE_THREAD("loader");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        // Wait for a batch to prepare and a free buffer to prepare it in
+        // Time spent here while the epoch still has batches to prepare is backpressure from the trainer
+        auto can_fill = [this] { return stopping || (next_fill < end && next_fill < released + slots.size()); };
+        if (!can_fill()) {
+            TRACE_SCOPE("loader", "wait for buffer");
+            bool blocked = next_fill < end;
+            auto wait_start = std::chrono::steady_clock::now();
+            wake_producers.wait(lock, can_fill);
+            if (blocked) {
+                counters.blocked_seconds += secondsSince(wait_start);
+            }
+        }
+        if (stopping) {
+            break;
+        }
+
+        size_t b = next_fill++;
+        Slot& slot = slots[b % slots.size()];
+        const BatchSampler& order = *sampler;
+        ++filling;
+        lock.unlock();
+
+        std::string failure;
+        auto produce_start = std::chrono::steady_clock::now();
+        try {
+            Batch& batch = slot.batch;
+            batch.index = b;
+            batch.size = order.batchSize(b);
+            if (batch.size != batch.inputs.numCols()) {
+                // A short batch, or a full one after it : the batch views the start of the buffers of the slot,
+                // so gather finds the matrices at the right size and writes into them
+                if (batch.size > slot.inputs.numCols()) {
+                    throw std::invalid_argument("A batch of " + std::to_string(batch.size)
+                                                + " samples is larger than the buffers of the loader");
+                }
+                Matrix inputs = Matrix::view(slot.inputs.data(), slot.inputs.numRows(), batch.size);
+                Matrix targets = Matrix::view(slot.targets.data(), classes, batch.size);
+                batch.inputs.swap(inputs);
+                batch.targets.swap(targets);
+            }
+            {
+                TRACE_SCOPE("loader", "gather");
+                dataset.gather(order.batch(b), batch.size, batch.inputs);
+                dataset.gatherTargets(order.batch(b), batch.size, classes, batch.targets);
+            }
+            if (transform) {
+                TRACE_SCOPE("loader", "transform");
+                transform(batch.inputs, order.batch(b), batch.size);
+            }
+        } catch (const std::exception& e) {
+            failure = e.what();
+        }
+        double produce_time = secondsSince(produce_start);
+
+        lock.lock();
+        --filling;
+        counters.produce_seconds += produce_time;
+        if (!failure.empty()) {
+            error = failure;
+        } else if (b < end) {
+            slot.ready = true;
+        }
+        wake_trainer.notify_all();
+    }
+}
+
+LoaderStats BatchLoader::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void BatchLoader::resetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters = LoaderStats();
+}
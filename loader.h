@@ -0,0 +1,133 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a BatchLoader that prepares the batches of an epoch in the background : producer threads
+// gather, normalize (and optionally transform) the next batches into a ring of buffers while the trainer
+// works on the current one. The ring is the bounded queue between them : the producers never get more than
+// depth batches ahead, they wait for the trainer to give a buffer back (backpressure).
+// The loader measures how long the trainer waited for data, to tell whether the training is input bound.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dataset.h"
+#include "matrix.h"
+#include "sampler.h"
+
+// What the loader measured since it was created or since the last resetStats
+struct LoaderStats {
+    size_t batches = 0;            // batches handed to the trainer
+    size_t stalls = 0;             // how many of them were not ready when the trainer asked for them
+    double wait_seconds = 0.0;     // time the trainer spent waiting for batches
+    double produce_seconds = 0.0;  // time spent preparing batches, summed over the producers
+    double blocked_seconds = 0.0;  // time the producers spent waiting for a free buffer, summed over the producers
+};
+
+class BatchLoader {
+public:
+    // A prepared batch : the inputs (features, n) and the one-hot targets (classes, n)
+    struct Batch {
+        Matrix inputs{0, 0};
+        Matrix targets{0, 0};
+        size_t index = 0;
+        size_t size = 0;
+    };
+
+    // Applied by the producers to every batch after it is gathered, for example to augment the samples
+    // Parameters : the inputs of the batch, the indices of its samples in the dataset, and the number of samples
+    using Transform = std::function<void(Matrix& inputs, const size_t* indices, size_t n)>;
+
+private:
+    struct Slot {
+        Batch batch;
+        // The buffers of the slot, at the full batch size. The matrices of the batch are views of their first
+        // values, so a short batch has the size of its samples without anything being reallocated
+        Matrix inputs{0, 0};
+        Matrix targets{0, 0};
+        bool ready = false;
+    };
+
+    const Dataset& dataset;
+    size_t classes;
+    Transform transform;
+
+    std::vector<Slot> slots;
+
+    // The epoch being loaded. Batches are numbered as in the sampler : the producers claim next_fill,
+    // the trainer takes next_take, and every batch below released has given its buffer back.
+    // A batch can only be filled once the batch depth places before it was released, so its slot is free.
+    const BatchSampler* sampler;
+    size_t end;
+    size_t next_fill;
+    size_t next_take;
+    size_t released;
+    bool holding;
+    size_t filling;
+    bool stopping;
+    std::string error;
+    LoaderStats counters;
+
+    std::mutex mutex;
+    std::condition_variable wake_producers;
+    std::condition_variable wake_trainer;
+    std::vector<std::thread> producers;
+
+    void producerLoop();
+
+    // Same as stop, with the mutex already held
+    void stopLocked(std::unique_lock<std::mutex>& lock);
+
+public:
+    // Starts the producers, they wait for the first epoch
+    //
+    // Parameters :
+    // dataset : the samples, it must outlive the loader
+    // classes : number of classes of the one-hot targets (10 for MNIST)
+    // batch_size : largest number of samples in a batch, the buffers are allocated for it once
+    //              (a larger batch fails like a batch that can't be gathered, see next)
+    // depth : number of buffers in the ring, so the producers can be up to depth - 1 batches ahead of the trainer
+    // threads : number of producer threads
+    // transform : applied to every batch after it is gathered, may be empty
+    //
+    // Throws std::invalid_argument if depth is below 2 or threads is 0
+    BatchLoader(const Dataset& dataset, size_t classes, size_t batch_size,
+                size_t depth = 3, size_t threads = 1, Transform transform = nullptr);
+
+    // Stops the producers, a batch being prepared is finished first
+    ~BatchLoader();
+
+    BatchLoader(const BatchLoader&) = delete;
+    BatchLoader& operator=(const BatchLoader&) = delete;
+
+    // Starts loading the batches of an epoch, from first_batch to the last batch of the sampler
+    // The batches of the previous epoch that were not taken are dropped.
+    //
+    // Parameters :
+    // sampler : the order of the epoch, it must not be shuffled again before the epoch is over
+    // first_batch : the first batch to load (not 0 when resuming in the middle of an epoch)
+    void startEpoch(const BatchSampler& sampler, size_t first_batch = 0);
+
+    // Drops the batches of the epoch that were not taken and waits for the batches being prepared,
+    // so the sampler can be shuffled again before the end of the epoch
+    void stop();
+
+    // Returns the next batch of the epoch, waiting for it if it is not ready yet
+    // The batch stays valid until the next call to next or startEpoch, then its buffer goes back to the producers
+    //
+    // Throws std::logic_error if every batch of the epoch was already taken,
+    // std::runtime_error if a producer failed to prepare a batch
+    const Batch& next();
+
+    LoaderStats stats();
+    void resetStats();
+};
+
+#endif //LOADER_H
@@ -16,184 +16,762 @@
 //
 
 #include "network.h"
+#include "checkpoint.h"
+#include "dataset.h"
+#include "sampler.h"
+#include "loader.h"
+#include "stream.h"
+#include "augment.h"
+#include "evaluator.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "trace.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "gemm_tuner.h"
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <random>
 #include <numeric>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <string>
+#include <unistd.h>
+
+// Options that can be given on the command line, everything else is still set in the code below
+struct Options {
+    std::string train_path = "../archive/mnist_train.csv";
+    std::string test_path = "../archive/mnist_test.csv";
+    bool use_cache = true;
+    CacheCheck cache_check = CacheCheck::Metadata;
+    std::string model = "mlp";
+    std::string optimizer = "sgd";
+    double learning_rate = 0.01;
+    std::string save_path;
+    std::string load_path;
+    std::string checkpoint_path;
+    size_t checkpoint_every = 500;
+    std::string resume_path;
+    size_t loader_threads = 1;
+    size_t prefetch = 3;
+    std::vector<std::string> stream_paths;
+    size_t shuffle_buffer = 10000;
+    bool augment = false;
+    std::string predict_path;
+    std::string predictions_path;
+    bool bench = false;
+    std::string bench_log = "bench_results.jsonl";
+    double target_accuracy = 90.0;
+    bool seeded = false;
+    uint32_t seed = 42;
+    std::string trace_path;
+    std::string metrics_path;
+    SchedulerOptions scheduler;
+    bool tune_gemm = false;
+    std::string gemm_tuning_path;
+};
+
+// The number of samples of the training batches and of the validation batches
+// (the evaluator pads its last batch to the full size, see evaluator.h)
+constexpr size_t batch_size = 32;
+constexpr size_t eval_batch_size = 256;
+
+// What a bench run measures of an epoch
+struct EpochRecord {
+    double seconds = 0.0;
+    size_t samples = 0;
+    double accuracy = 0.0;
+    double validation_seconds = 0.0;
+};
+
+// Reads the command line options
+// --train <path>     : the training dataset, ../archive/mnist_train.csv by default
+// --test <path>      : the validation dataset, ../archive/mnist_test.csv by default
+//                      Both can also be the images file of an IDX pair, for example train-images-idx3-ubyte,
+//                      the labels are then read from the matching labels file (train-labels-idx1-ubyte)
+// --no-cache         : always parses the CSV files instead of using their binary cache (path + ".cache")
+// --cache-hash       : checks the caches against the CSV files by content, not only by size and date
+// --model <name>     : mlp (fully connected layers, the default) or cnn (a small convolutional network)
+// --optimizer <name> : sgd, momentum, nesterov, rmsprop, adam or adamw (see optimizer.h)
+// --lr <value>       : learning rate of the optimizer
+// --save <path>      : saves the trained model to a file (see Network::save)
+// --load <path>      : loads a saved model and only runs the validation, without training
+// --checkpoint <path>        : writes a checkpoint in the background every few batches and at the end of each epoch
+// --checkpoint-every <count> : number of batches between two checkpoints, 500 by default
+// --resume <path>            : restores a checkpoint and resumes the training exactly where it was taken
+// --loader-threads <count>   : number of threads preparing the batches in the background, 1 by default
+//                              (the augmentation of a batch is spread over the threads of the scheduler anyway)
+// --prefetch <count>         : number of batch buffers shared with them, at least 2, 3 by default
+// --stream <shard>[,<shard>...] : trains by streaming binary dataset files (a CSV cache is one) instead of
+//                                 loading --train in memory, the memory used does not depend on their size
+// --shuffle-buffer <count>      : number of samples the stream shuffles at a time, 10000 by default
+// --augment                  : distorts the training images on the fly (shift, rotation, elastic distortion, noise)
+// --predict <path>           : after the validation, predicts the class of every line of a CSV file (labeled or not)
+// --predictions <path>       : where the predictions are written, one per line, <predict path>.predictions by default
+// --seed <value>             : seeds the weights, the shuffling and the distortions, so two runs train the same way
+// --bench                    : benchmark run, seeded (42 unless --seed is given) and without the output of every batch :
+//                              validates after each epoch, reports the load time, the time and samples/s of the epochs,
+//                              the peak memory and the time to reach --target, and appends the run to --bench-log
+// --bench-log <path>         : where the bench runs are appended, one JSON object per line, bench_results.jsonl by default
+// --target <accuracy>        : the validation accuracy in % a bench run times, 90 by default
+// --trace <path>             : writes a timeline of the run (batches, layers, loader, optimizer steps, checkpoints)
+//                              as a Chrome trace file, to open in ui.perfetto.dev, needs a build with DUMBRONS_TRACE
+// --threads <count>          : number of threads of the scheduler the kernels, the augmentation and the parsing run on,
+//                              every hardware thread by default (or DUMBRONS_THREADS)
+// --pin                      : pins every thread of the scheduler to its own core
+// --metrics <path>           : appends the training metrics (loss, accuracy, samples/s, learning rate) as JSON lines,
+//                              a few per second and one per epoch, also for a bench run
+// --tune-gemm                : times the GEMM configurations on the products of the model before it trains (or is
+//                              validated), writes the fastest ones to the tuning file, then goes on
+// --gemm-tuning <path>       : the GEMM tuning file, read at the start when it exists,
+//                              gemm_tuning/<host name>.txt by default
+//
+// Throws std::invalid_argument on an unknown option, a missing value or options that don't go together
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--train") {
+            options.train_path = value();
+        } else if (arg == "--test") {
+            options.test_path = value();
+        } else if (arg == "--no-cache") {
+            options.use_cache = false;
+        } else if (arg == "--cache-hash") {
+            options.cache_check = CacheCheck::Content;
+        } else if (arg == "--model") {
+            options.model = value();
+            if (options.model != "mlp" && options.model != "cnn") {
+                throw std::invalid_argument("Unknown model : " + options.model + " (mlp or cnn)");
+            }
+        } else if (arg == "--optimizer") {
+            options.optimizer = value();
+        } else if (arg == "--lr") {
+            options.learning_rate = std::stod(value());
+        } else if (arg == "--save") {
+            options.save_path = value();
+        } else if (arg == "--load") {
+            options.load_path = value();
+        } else if (arg == "--checkpoint") {
+            options.checkpoint_path = value();
+        } else if (arg == "--checkpoint-every") {
+            options.checkpoint_every = std::stoul(value());
+        } else if (arg == "--resume") {
+            options.resume_path = value();
+        } else if (arg == "--loader-threads") {
+            options.loader_threads = std::stoul(value());
+        } else if (arg == "--prefetch") {
+            options.prefetch = std::stoul(value());
+        } else if (arg == "--stream") {
+            std::istringstream list(value());
+            std::string shard;
+            while (std::getline(list, shard, ',')) {
+                options.stream_paths.push_back(shard);
+            }
+        } else if (arg == "--shuffle-buffer") {
+            options.shuffle_buffer = std::stoul(value());
+        } else if (arg == "--augment") {
+            options.augment = true;
+        } else if (arg == "--predict") {
+            options.predict_path = value();
+        } else if (arg == "--predictions") {
+            options.predictions_path = value();
+        } else if (arg == "--seed") {
+            options.seed = static_cast<uint32_t>(std::stoul(value()));
+            options.seeded = true;
+        } else if (arg == "--bench") {
+            options.bench = true;
+            options.seeded = true;
+        } else if (arg == "--bench-log") {
+            options.bench_log = value();
+        } else if (arg == "--target") {
+            options.target_accuracy = std::stod(value());
+        } else if (arg == "--trace") {
+            options.trace_path = value();
+#ifndef DUMBRONS_TRACE
+            throw std::invalid_argument("--trace needs a build with tracing, configure it with -DDUMBRONS_TRACE=ON");
+#endif
+        } else if (arg == "--threads") {
+            options.scheduler.threads = std::stoul(value());
+            if (options.scheduler.threads == 0) {
+                throw std::invalid_argument("The scheduler needs at least 1 thread");
+            }
+        } else if (arg == "--pin") {
+            options.scheduler.pin = true;
+        } else if (arg == "--metrics") {
+            options.metrics_path = value();
+        } else if (arg == "--tune-gemm") {
+            options.tune_gemm = true;
+        } else if (arg == "--gemm-tuning") {
+            options.gemm_tuning_path = value();
+        } else {
+            throw std::invalid_argument("Unknown option : " + arg);
+        }
+    }
+    if (options.bench && !options.load_path.empty()) {
+        throw std::invalid_argument("--bench times a training, it can't be used with --load");
+    }
+    return options;
+}
 
-int main() {
-    // Activation functions and their derivatives
-    // Note that the activation functions are defined as lambda functions for simplicity
-    // You can replace them with any other activation functions you want to use
-    // A future improvement would be to use a class for activation functions and implements softmax for multi-class classification
-    auto relu = [](double x) { return x > 0 ? x : 0; };
-    auto drelu = [](double x) { return x > 0 ? 1.0 : 0.0; };
-
-    auto sigmoid = [](double x) {
-        return 1.0 / (1.0 + std::exp(-x));
-    };
-    auto dsigmoid = [](double x) {
-        double s = 1.0 / (1.0 + std::exp(-x));
-        return s * (1.0 - s);
-    };
-    auto mse = [](double y_pred, double y_true) {
-        return 0.5 * std::pow(y_pred - y_true, 2);
-    };
-    auto dmse = [](double y_pred, double y_true) {
-        return y_pred - y_true;
-    };
-
-    // Load the MNIST dataset
-    std::vector<Matrix> inputs;
-    std::vector<Matrix> targets;
-
-    std::cout << "Loading training dataset...\n";
-
-    // Open the training dataset file
-    std::ifstream in("../archive/mnist_train.csv");
-    if (!in.is_open()) {
-        std::cerr << "Erreur : impossible d'ouvrir mnist_train.csv" << std::endl;
-        return 1;
+// The layers of the models --model can choose
+// mlp : 784 -> 128 -> 64 -> 10, fully connected
+// cnn : two blocks of a 5x5 convolution (8 then 16 filters, padded so it keeps the size of the images)
+//       and a 2x2 max pooling, then a dense layer from the 16 maps of 7x7 to the 10 classes
+static std::vector<LayerSpec> modelSpecs(const std::string& model) {
+    if (model == "cnn") {
+        return {LayerSpec::conv2d(1, 28, 28, 8, 5, 1, 2, Activation::ReLU),
+                LayerSpec::maxPool2d(8, 28, 28, 2, 2),
+                LayerSpec::conv2d(8, 14, 14, 16, 5, 1, 2, Activation::ReLU),
+                LayerSpec::maxPool2d(16, 14, 14, 2, 2),
+                LayerSpec::dense(16 * 7 * 7, 10, Activation::Sigmoid)};
     }
+    return {LayerSpec::dense(784, 128, Activation::Sigmoid),
+            LayerSpec::dense(128, 64, Activation::Sigmoid),
+            LayerSpec::dense(64, 10, Activation::ReLU)};
+}
 
-    // We jump the first line :)
-    std::string header;
-    std::getline(in, header);
+// Loads a dataset : IDX files are mapped as they are, CSV files go through their binary cache
+// (or are parsed every time when the cache is disabled)
+static Dataset loadDataset(const std::string& path, const Options& options) {
+    const std::string idx_images = "images-idx3-ubyte";
+    size_t idx_pos = path.rfind(idx_images);
+    if (idx_pos != std::string::npos) {
+        std::string labels_path = path;
+        labels_path.replace(idx_pos, idx_images.size(), "labels-idx1-ubyte");
+        return Dataset::loadIdx(path, labels_path);
+    }
 
-    std::string line;
-    while (std::getline(in, line)) {
-        std::stringstream ss(line);
-        std::string token;
+    if (!options.use_cache) {
+        return Dataset::loadCsv(path);
+    }
+    return Dataset::loadCached(path, options.cache_check);
+}
 
-        std::getline(ss, token, ',');
-        int label = std::stoi(token);
+// The GEMM tuning file of the run : the one given with --gemm-tuning, or the one of this machine
+static std::string gemmTuningPath(const Options& options) {
+    return options.gemm_tuning_path.empty() ? defaultGemmTuningPath() : options.gemm_tuning_path;
+}
 
-        // Create a 784x1 matrix for the input (the image)
-        // The ith element of the input matrix corresponds to the ith pixel of the image
-        Matrix input(784, 1);
-        for (int i = 0; i < 784; ++i) {
-            // Read each pixel value from the line, convert it to double, and normalize it by dividing by 255.0
-            std::getline(ss, token, ',');
-            input(i, 0) = std::stod(token) / 255.0;
-        }
+// Makes gemm use the tuning file of the run, when there is one
+// A file given with --gemm-tuning must exist, the default one is only read if it does
+// output : whether a tuning was read
+//
+// Throws std::runtime_error or std::invalid_argument if the file is not a valid tuning file
+static bool useGemmTuning(const Options& options) {
+    const std::string path = gemmTuningPath(options);
+    if (options.gemm_tuning_path.empty() && !std::ifstream(path)) {
+        return false;
+    }
+    setGemmTuning(loadGemmTuning(path));
+    return true;
+}
 
-        // Create a 10x1 matrix for the target (the label)
-        // The ith element of the target matrix is 1.0 if the label is i, and 0.0 otherwise
-        // This is a one-hot encoding of the label
-        Matrix target(10, 1, 0.0);
-        target(label, 0) = 1.0;
+// Tunes the products of a network for this machine (--tune-gemm), uses the tuning and writes it to the tuning file
+// The shapes are those of the training batches of the run and of the validation batches
+//
+// Parameters :
+// net : the network of the run
+// options : the options of the run, for the tuning file
+// train_batches : the numbers of samples of the training batches, none when the run only evaluates
+//
+// Throws std::runtime_error if the file can't be written
+static void tuneNetworkGemm(const Network& net, const Options& options, const std::vector<size_t>& train_batches) {
+    std::cout << "Tuning the GEMM kernel on the products of the model...\n";
+    auto start = std::chrono::steady_clock::now();
+    GemmTuning tuning = tuneGemm(networkGemmShapes(net, train_batches, {eval_batch_size}), 0.01, &std::cout);
+    setGemmTuning(tuning);
+    const std::string path = gemmTuningPath(options);
+    saveGemmTuning(tuning, path);
+    std::chrono::duration<double> tune_time = std::chrono::steady_clock::now() - start;
+    std::cout << "GEMM tuning written to " << path << " in " << tune_time.count() << " s\n";
+}
 
-        inputs.push_back(input);
-        targets.push_back(target);
+// Runs the network on the validation data and counts its right predictions
+// The test set is loaded like the training set (a CSV through its binary cache), then runs through the
+// evaluation pipeline : its batches are gathered on one thread while the network runs on another
+//
+// Throws std::runtime_error if the data can't be read or does not hold 28x28 images
+static EvalResult validate(Network& net, const Options& options) {
+    TRACE_SCOPE("eval", "validation");
+    Dataset test_set;
+    try {
+        test_set = loadDataset(options.test_path, options);
+    } catch (const std::exception& e) {
+        throw std::runtime_error("impossible de charger " + options.test_path + " : " + e.what());
+    }
+    if (test_set.numFeatures() != 784) {
+        throw std::runtime_error(options.test_path + " does not hold 28x28 images");
     }
-    std::cout << "Training dataset loaded...\n";
+    return Evaluator(net, eval_batch_size).run(test_set);
+}
 
-    // The next step is to implement a GUI or at least a TUI to let the user choose the parameters of the network
-    // For now, we will use a simple network with 3 layers:
-    std::vector<std::function<double(double)>> activations = {sigmoid, sigmoid, relu};
-    std::vector<std::function<double(double)>> dactivations = {dsigmoid, dsigmoid, drelu};
+// Appends a bench run to options.bench_log, as one JSON object on one line :
+// the configuration, the load time, every epoch, the time to the target accuracy (null if not reached),
+// the peak memory and the final accuracy
+//
+// Throws std::runtime_error if the log can't be written
+static void writeBenchRecord(const Options& options, double load_seconds, const std::vector<EpochRecord>& epochs,
+                             double time_to_target, double accuracy) {
+    std::ofstream log(options.bench_log, std::ios::app);
+    if (!log) {
+        throw std::runtime_error("Can't open " + options.bench_log);
+    }
+    log << std::setprecision(6);
+    log << "{\"date\": " << jsonString(currentDate())
+        << ", \"host\": " << jsonString(hostName())
+        << ", \"model\": " << jsonString(options.model)
+        << ", \"optimizer\": " << jsonString(options.optimizer)
+        << ", \"learning_rate\": " << options.learning_rate
+        << ", \"batch_size\": " << batch_size
+        << ", \"seed\": " << options.seed
+        << ", \"augment\": " << (options.augment ? "true" : "false")
+        << ", \"train\": " << jsonString(options.stream_paths.empty() ? options.train_path : options.stream_paths.front())
+        << ", \"load_seconds\": " << load_seconds
+        << ", \"epochs\": [";
+    for (size_t e = 0; e < epochs.size(); ++e) {
+        const EpochRecord& record = epochs[e];
+        log << (e == 0 ? "" : ", ")
+            << "{\"seconds\": " << record.seconds
+            << ", \"samples_per_second\": " << record.samples / record.seconds
+            << ", \"accuracy\": " << record.accuracy
+            << ", \"validation_seconds\": " << record.validation_seconds << "}";
+    }
+    log << "], \"target_accuracy\": " << options.target_accuracy << ", \"time_to_target_seconds\": ";
+    if (time_to_target < 0.0) {
+        log << "null";
+    } else {
+        log << time_to_target;
+    }
+    log << ", \"peak_memory_bytes\": " << peakMemory()
+        << ", \"accuracy\": " << accuracy << "}\n";
+    if (!log) {
+        throw std::runtime_error("Can't write to " + options.bench_log);
+    }
+}
 
-    // The cost function is the mean squared error (MSE) and its derivative
-    Network net({784, 128, 64, 10}, activations, dactivations, mse, dmse, 0.01);
-    std::cout << "Building the network with the following parameters : \n";
-    std::cout << "Hidden layers :                           128, 24 \n";
-    std::cout << "Hidden layers activation function:        sigmoid \n";
-    std::cout << "Learning rate:                            0.01 \n";
-    std::cout << "Batch size :                              32 \n";
-    std::cout << "Epochs :                                  10 \n";
+int main(int argc, char** argv) {
+    Options options;
+    std::unique_ptr<Optimizer> optimizer;
+    try {
+        options = parseOptions(argc, argv);
+        optimizer = makeOptimizer(options.optimizer, options.learning_rate);
+        // The tracer starts before the workers of the scheduler and the other threads (see Tracer::start)
+        if (!options.trace_path.empty()) {
+            Tracer::instance().start();
+            TRACE_THREAD("trainer");
+        }
+        Scheduler::configure(options.scheduler);
+        // A run that tunes does not need the previous tuning, the products are timed with given configurations
+        if (!options.tune_gemm && useGemmTuning(options)) {
+            std::cout << "GEMM tuning loaded from " << gemmTuningPath(options) << "\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
+    }
 
-    // Now we have to create the batches
-    size_t batch_size = 32;
-    int num_epochs = 10;
+    // The next step is to implement a GUI or at least a TUI to let the user choose the parameters of the network
+    // For now, we will use a simple network with 3 layers, or a small convolutional network (see modelSpecs)
+    // The activation and cost functions are chosen by id, their derivatives come with them (see activation.h)
+    // The cost function is the mean squared error (MSE)
+    Network net(modelSpecs(options.model), Cost::MSE, options.learning_rate);
+    net.setOptimizer(std::move(optimizer));
+
+    // What a bench run records, the time to the target accuracy is counted in training time only
+    double load_seconds = 0.0;
+    std::vector<EpochRecord> epochs;
+    double time_to_target = -1.0;
+
+    if (!options.load_path.empty()) {
+        // A saved model is mapped in memory, it is ready to run right away
+        try {
+            net = Network::load(options.load_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Model loaded from " << options.load_path << "\n";
+
+        // A loaded model is only evaluated, only the products of the validation are tuned
+        if (options.tune_gemm) {
+            try {
+                tuneNetworkGemm(net, options, {});
+            } catch (const std::exception& e) {
+                std::cerr << "Erreur : " << e.what() << std::endl;
+                return 1;
+            }
+        }
+    } else {
+        // Load the MNIST dataset
+        // The CSV is mapped in memory and parsed in parallel into one contiguous block of uint8 values
+        // The block is kept in a binary cache next to the CSV, the next runs just map the cache
+        // When streaming, only the headers of the shards are read here, the samples are read during the training
+        std::cout << "Loading training dataset...\n";
+        auto load_start = std::chrono::steady_clock::now();
+        Dataset train_set;
+        std::unique_ptr<ShardStream> stream;
+        try {
+            if (options.stream_paths.empty()) {
+                train_set = loadDataset(options.train_path, options);
+            } else {
+                stream = std::make_unique<ShardStream>(options.stream_paths, options.shuffle_buffer);
+            }
+        } catch (const std::exception& e) {
+            const std::string& source = options.stream_paths.empty() ? options.train_path : options.stream_paths.front();
+            std::cerr << "Erreur : impossible de charger " << source << " : " << e.what() << std::endl;
+            return 1;
+        }
+        std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+        load_seconds = load_time.count();
+        if ((stream ? stream->numFeatures() : train_set.numFeatures()) != 784) {
+            std::cerr << "Erreur : the training dataset does not hold 28x28 images" << std::endl;
+            return 1;
+        }
 
-    std::random_device rd;
-    std::mt19937 g(rd());
+        // The labels are checked once here, the batches are then gathered without any error to handle
+        // The labels of a stream are only checked when they are read
+        for (size_t s = 0; s < train_set.size(); ++s) {
+            if (train_set.label(s) >= 10) {
+                std::cerr << "Erreur : sample " << s + 1 << " has a label out of [0, 9]" << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Training dataset loaded in " << load_time.count() << " s...\n";
+
+        std::cout << "Building the network with the following parameters : \n";
+        if (options.model == "cnn") {
+            std::cout << "Convolutions :                            8 and 16 filters of 5x5, relu \n";
+            std::cout << "Pooling :                                 max 2x2 after each convolution \n";
+        } else {
+            std::cout << "Hidden layers :                           128, 24 \n";
+            std::cout << "Hidden layers activation function:        sigmoid \n";
+        }
+        std::cout << "Optimizer:                                " << net.getOptimizer().name() << " \n";
+        std::cout << "Learning rate:                            " << options.learning_rate << " \n";
+        std::cout << "Batch size :                              " << batch_size << " \n";
+        std::cout << "Epochs :                                  10 \n";
+        std::cout << "Threads :                                 " << Scheduler::instance().numThreads() << " \n";
+
+        // Now we have to create the batches
+        size_t num_epochs = 10;
+
+        // A seeded run draws the same weights, batches and distortions every time
+        std::random_device rd;
+        std::mt19937 g(options.seeded ? options.seed : rd());
+        if (options.seeded) {
+            net.initialize(options.seed);
+        }
 
-    for (size_t epoch = 0; epoch < num_epochs; ++epoch) {
-        std::cout << "Starting " << epoch + 1 << ".\n";
+        // When resuming, the parameters, the optimizer and the generator come back as they were in the checkpoint
+        // The generator is restored to its state at the start of the epoch, so the shuffle below gives the same order
+        size_t first_epoch = 0;
+        size_t first_batch = 0;
+        if (!options.resume_path.empty()) {
+            try {
+                TrainingPosition position = Checkpointer::restore(options.resume_path, net);
+                std::istringstream(position.rng_state) >> g;
+                first_epoch = position.epoch;
+                first_batch = position.batch;
+            } catch (const std::exception& e) {
+                std::cerr << "Erreur : " << e.what() << std::endl;
+                return 1;
+            }
+            std::cout << "Resuming epoch " << first_epoch + 1 << " at batch " << first_batch + 1 << "\n";
+        }
 
-        // Shuffle the indices of the inputs and targets
-        // This is done to ensure that the training is not biased by the order of the data
-        // We use a random number generator to shuffle the indices
-        std::vector<size_t> indices(inputs.size());
-        std::iota(indices.begin(), indices.end(), 0);
-        std::shuffle(indices.begin(), indices.end(), g);
+        std::unique_ptr<Checkpointer> checkpointer;
+        if (!options.checkpoint_path.empty()) {
+            checkpointer = std::make_unique<Checkpointer>(options.checkpoint_path);
+        }
 
-        // Split the data into batches
-        // We will iterate over the batches and train the network on each batch
-        for (size_t b = 0; b < inputs.size() / batch_size; ++b) {
-            std::cout << "Epoch " <<  epoch +1 << " on batch " << b+1 << "\n";
+        // The batches are lists of indices into the dataset
+        // They are gathered in the background by the loader, while the network trains on the previous one
+        // A stream gives its batches one after the other instead, into matrices reused from one batch to the next
+        BatchSampler sampler(train_set.size(), batch_size);
+        // The augmentation runs as the transform of the loader, so it overlaps with the training,
+        // and its samples are spread over the threads of the scheduler
+        std::unique_ptr<Augmenter> augmenter;
+        if (options.augment) {
+            augmenter = std::make_unique<Augmenter>(AugmentOptions(), 28, 28);
+        }
 
-            std::vector<Matrix> batch_inputs;
-            std::vector<Matrix> batch_targets;
-            // We will create a batch of inputs and targets based on the shuffled indices
-            // Each batch will contain batch_size elements
-            for (size_t i = 0; i < batch_size; ++i) {
-                size_t idx = indices[b * batch_size + i];
-                batch_inputs.push_back(inputs[idx]);
-                batch_targets.push_back(targets[idx]);
+        // The progress of the training is reported from another thread, a few times per second (see metrics.h)
+        // A bench run has no progress line, its metrics only go to the --metrics log when there is one
+        std::unique_ptr<MetricsReporter> metrics;
+        std::unique_ptr<BatchLoader> loader;
+        Matrix stream_inputs(784, batch_size);
+        Matrix stream_targets(10, batch_size);
+        std::vector<size_t> stream_keys(batch_size);
+        try {
+            if (!stream) {
+                loader = std::make_unique<BatchLoader>(train_set, 10, batch_size, options.prefetch,
+                                                       options.loader_threads,
+                                                       augmenter ? augmenter->transform() : nullptr);
             }
-            std::cout << "Training... \n";
-
-            // Train the network on the current batch
-            net.train(batch_inputs, batch_targets, 1);
-            std::cout << "Training finished !\n";
+            if (!options.bench || !options.metrics_path.empty()) {
+                metrics = std::make_unique<MetricsReporter>(options.bench ? nullptr : &std::cout,
+                                                            isatty(STDOUT_FILENO) != 0, options.metrics_path);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
 
+        // The products are tuned on the batches the training will run : every batch is full,
+        // unless the sampler keeps a shorter last one
+        if (options.tune_gemm) {
+            std::vector<size_t> train_batches{batch_size};
+            if (!stream && sampler.numBatches() > 0 && sampler.batchSize(sampler.numBatches() - 1) != batch_size) {
+                train_batches.push_back(sampler.batchSize(sampler.numBatches() - 1));
+            }
+            try {
+                tuneNetworkGemm(net, options, train_batches);
+            } catch (const std::exception& e) {
+                std::cerr << "Erreur : " << e.what() << std::endl;
+                return 1;
+            }
         }
 
-        std::cout << "Epoch " << epoch + 1 << " done.\n";
-    }
+        double training_seconds = 0.0;
+        for (size_t epoch = first_epoch; epoch < num_epochs; ++epoch) {
+            TRACE_SCOPE("train", "epoch");
+            std::cout << "Starting " << epoch + 1 << ".\n";
+            auto epoch_start = std::chrono::steady_clock::now();
+            size_t trained = 0;
+            if (metrics) {
+                metrics->startEpoch();
+            }
 
-    // Now we can test the model on the validation data
-    std::ifstream test_file("../archive/mnist_test.csv");
-    if (!test_file.is_open()) {
-        std::cerr << "Erreur : impossible d'ouvrir mnist_test.csv" << std::endl;
-        return 1;
-    }
+            // Keep the state of the generator before the shuffle, for the checkpoints of this epoch
+            std::ostringstream rng_state;
+            rng_state << g;
+
+            // Shuffle the indices of the samples
+            // This is done to ensure that the training is not biased by the order of the data
+            // We use a random number generator to shuffle the indices
+            // A stream is shuffled as it goes, by drawing the samples out of its shuffle buffer with the same generator
+            // The distortions of the epoch come from the generator too, so a resumed epoch gets the same ones
+            if (augmenter) {
+                augmenter->setEpochKey(g());
+            }
 
-    std::getline(test_file, header);
+            size_t start_batch = epoch == first_epoch ? first_batch : 0;
+            size_t num_batches;
+            if (stream) {
+                num_batches = stream->size() / batch_size;
+                stream->rewind();
+            } else {
+                sampler.shuffle(g);
+                num_batches = sampler.numBatches();
+                // Reset before the producers start, so the time they spend on the first batches is counted
+                loader->resetStats();
+                loader->startEpoch(sampler, start_batch);
+            }
 
-    std::string test_line;
-    int correct = 0;
-    int total = 0;
-    std::cout << "Running the model on the validation data... \n";
+            // Split the data into batches
+            // We will iterate over the batches and train the network on each batch
+            // A stream can't jump to a batch, when resuming it draws the batches already trained again and skips them
+            for (size_t b = stream ? 0 : start_batch; b < num_batches; ++b) {
+                // The batch is a 784 x batch_size matrix with one column per image and the pixels normalized by dividing by 255.0
+                // The targets are the one-hot encodings of the labels : the ith element of a column is 1.0 if the label is i
+                TRACE_SCOPE("train", "batch");
+                const Matrix* batch_inputs;
+                const Matrix* batch_targets;
+                try {
+                    TRACE_SCOPE("loader", "next batch");
+                    if (stream) {
+                        size_t count = stream->next(batch_size, stream_inputs, stream_targets, 10, g);
+                        if (augmenter && b >= start_batch) {
+                            // A streamed sample has no index in a dataset, its position in the pass is used instead
+                            std::iota(stream_keys.begin(), stream_keys.end(), b * batch_size);
+                            augmenter->apply(stream_inputs, stream_keys.data(), count);
+                        }
+                        batch_inputs = &stream_inputs;
+                        batch_targets = &stream_targets;
+                    } else {
+                        const BatchLoader::Batch& batch = loader->next();
+                        batch_inputs = &batch.inputs;
+                        batch_targets = &batch.targets;
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Erreur : " << e.what() << std::endl;
+                    return 1;
+                }
+                if (b < start_batch) {
+                    continue;
+                }
+
+                // Train the network on the current batch, straight from the buffer it was prepared in
+                double loss = net.train(*batch_inputs, *batch_targets);
+                trained += batch_inputs->numCols();
+
+                // The trainer only hands the numbers of the batch over, it never waits for them to be printed
+                if (metrics) {
+                    BatchMetrics batch_metrics;
+                    batch_metrics.epoch = static_cast<uint32_t>(epoch);
+                    batch_metrics.batch = static_cast<uint32_t>(b);
+                    batch_metrics.batches = static_cast<uint32_t>(num_batches);
+                    batch_metrics.samples = static_cast<uint32_t>(batch_inputs->numCols());
+                    batch_metrics.correct = static_cast<uint32_t>(countCorrect(net.trainingOutput(), *batch_targets));
+                    batch_metrics.loss = loss;
+                    batch_metrics.learning_rate = net.getOptimizer().getLearningRate();
+                    metrics->push(batch_metrics);
+                }
+
+                // The checkpoint is only copied here, it is written in the background
+                if (checkpointer && (b + 1) % options.checkpoint_every == 0 && b + 1 < num_batches) {
+                    checkpointer->snapshot(net, {epoch, b + 1, rng_state.str()});
+                }
+            }
 
-    // We will read the test file line by line, parse the input and label, and then use the network to predict the label
-    // The input is a 784x1 matrix (the image) and the output is a 10x1 matrix (the predicted label)
-    // We will compare the predicted label with the actual label and count the number of correct predictions
-    while (std::getline(test_file, test_line)) {
-        std::stringstream ss(test_line);
-        std::string token;
+            // At the end of an epoch the generator is already where the next epoch starts
+            if (checkpointer) {
+                std::ostringstream next_rng_state;
+                next_rng_state << g;
+                checkpointer->snapshot(net, {epoch + 1, 0, next_rng_state.str()});
+            }
+
+            std::chrono::duration<double> epoch_time = std::chrono::steady_clock::now() - epoch_start;
+
+            // The reporter ends its progress line first, nothing else is printed while it may be writing
+            EpochMetrics training;
+            if (metrics) {
+                try {
+                    training = metrics->finishEpoch();
+                } catch (const std::exception& e) {
+                    std::cerr << "Erreur : " << e.what() << std::endl;
+                    return 1;
+                }
+            }
+            std::cout << "Epoch " << epoch + 1 << " done in " << epoch_time.count() << " s";
+            if (metrics && training.samples > 0) {
+                std::cout << ", training loss " << training.loss << ", training accuracy " << training.accuracy * 100.0 << "%";
+            }
+            std::cout << ".\n";
+
+            // If the training waited a lot for its batches, more loader threads would help
+            if (loader) {
+                LoaderStats loading = loader->stats();
+                std::cout << "Waited " << loading.wait_seconds << " s for the data (" << loading.stalls << " of "
+                          << loading.batches << " batches were not ready), the loader spent "
+                          << loading.produce_seconds << " s preparing them.\n";
+            }
 
-        std::getline(ss, token, ',');
-        int label = std::stoi(token);
+            // A bench run validates after every epoch, outside of the time of the epoch
+            if (options.bench) {
+                EpochRecord record;
+                record.seconds = epoch_time.count();
+                record.samples = trained;
+                try {
+                    EvalResult validation = validate(net, options);
+                    record.accuracy = validation.accuracy() * 100.0;
+                    record.validation_seconds = validation.seconds;
+                } catch (const std::exception& e) {
+                    std::cerr << "Erreur : " << e.what() << std::endl;
+                    return 1;
+                }
+                training_seconds += record.seconds;
+                if (time_to_target < 0.0 && record.accuracy >= options.target_accuracy) {
+                    time_to_target = training_seconds;
+                }
+                std::cout << "Epoch " << epoch + 1 << " : " << trained / record.seconds << " samples/s, validation accuracy "
+                          << record.accuracy << "% (validated in " << record.validation_seconds << " s)\n";
+                epochs.push_back(record);
+            }
 
-        Matrix input(784, 1);
-        for (int i = 0; i < 784; ++i) {
-            std::getline(ss, token, ',');
-            input(i, 0) = std::stod(token) / 255.0;
+            // Where the epoch spent its time, layer by layer, when built with DUMBRONS_PROFILE
+            PROFILE_REPORT(std::cout, "epoch " + std::to_string(epoch + 1));
         }
 
-        Matrix output = net.forward(input);
+        if (checkpointer) {
+            try {
+                checkpointer->flush();
+            } catch (const std::exception& e) {
+                std::cerr << "Erreur : " << e.what() << std::endl;
+                return 1;
+            }
+        }
 
-        // Find the index of the maximum value in the output matrix
-        int predicted = 0;
-        double max_val = output(0, 0);
-        for (int i = 1; i < 10; ++i) {
-            if (output(i, 0) > max_val) {
-                max_val = output(i, 0);
-                predicted = i;
+        if (!options.save_path.empty()) {
+            try {
+                net.save(options.save_path);
+            } catch (const std::exception& e) {
+                std::cerr << "Erreur : " << e.what() << std::endl;
+                return 1;
             }
+            std::cout << "Model saved to " << options.save_path << "\n";
         }
 
-        if (predicted == label) correct++;
-        total++;
+    }
+
+    // Now we can test the model on the validation data
+    std::cout << "Running the model on the validation data... \n";
+    EvalResult validation;
+    try {
+        validation = validate(net, options);
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
     }
     std::cout << "Validation completed ! \n";
 
-    double accuracy = static_cast<double>(correct) / total * 100.0;
+    double accuracy = validation.accuracy() * 100.0;
     std::cout << "Model accuracy: " << accuracy << "%\n";
+    PROFILE_REPORT(std::cout, "the validation");
+
+    // Scoring a file : the predicted class of each of its lines is written to the predictions file
+    if (!options.predict_path.empty()) {
+        std::string predictions_path = options.predictions_path.empty() ? options.predict_path + ".predictions"
+                                                                         : options.predictions_path;
+        try {
+            EvalResult result = Evaluator(net, eval_batch_size).run(options.predict_path, predictions_path);
+            std::cout << "Predicted " << result.samples << " samples in " << result.seconds << " s (parsing "
+                      << result.parse_seconds << " s, batching " << result.batch_seconds << " s, inference "
+                      << result.infer_seconds << " s, writing " << result.write_seconds << " s), written to "
+                      << predictions_path << "\n";
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.bench) {
+        try {
+            writeBenchRecord(options, load_seconds, epochs, time_to_target, accuracy);
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Peak memory : " << peakMemory() / (1024.0 * 1024.0) << " MB, ";
+        if (time_to_target < 0.0) {
+            std::cout << "the target of " << options.target_accuracy << "% was not reached";
+        } else {
+            std::cout << options.target_accuracy << "% reached after " << time_to_target << " s of training";
+        }
+        std::cout << ", run appended to " << options.bench_log << "\n";
+    }
+
+    if (!options.trace_path.empty()) {
+        Tracer::instance().stop();
+        try {
+            Tracer::instance().write(options.trace_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Trace written to " << options.trace_path << "\n";
+    }
 
     return 0;
 }
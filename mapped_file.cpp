@@ -0,0 +1,87 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+    : bytes(nullptr), length(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Can't open " + path);
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Can't read the size of " + path);
+    }
+    length = static_cast<size_t>(st.st_size);
+
+    // mmap refuses empty mappings, an empty file is just an empty MappedFile
+    if (length != 0) {
+        void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Can't map " + path);
+        }
+        bytes = static_cast<uint8_t*>(p);
+    }
+
+    // The mapping stays valid once the file is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) {
+        ::munmap(bytes, length);
+    }
+}
+
+void MappedFile::release(size_t offset, size_t length) {
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t first = (offset + page - 1) / page * page;
+    size_t last = std::min(offset + length, this->length) / page * page;
+    if (bytes != nullptr && first < last) {
+        ::madvise(bytes + first, last - first, MADV_DONTNEED);
+    }
+}
+
+namespace {
+
+// Flushes a file or a directory to the disk, returns false if it can't
+bool syncPath(const std::string& path, int flags) {
+    int fd = ::open(path.c_str(), flags);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+}
+
+void replaceFile(const std::string& tmp_path, const std::string& path) {
+    // Without the flush the rename can reach the disk before the content, a crash then leaves an empty file
+    if (!syncPath(tmp_path, O_WRONLY)) {
+        throw std::runtime_error("Can't flush " + tmp_path + " to the disk");
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Can't replace " + path);
+    }
+    // The rename itself is an entry of the directory
+    std::string directory = std::filesystem::path(path).parent_path().string();
+    if (!syncPath(directory.empty() ? "." : directory, O_RDONLY | O_DIRECTORY)) {
+        throw std::runtime_error("Can't flush the directory of " + path + " to the disk");
+    }
+}
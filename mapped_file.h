@@ -0,0 +1,58 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides MappedFile, a small RAII wrapper around mmap used to read model and dataset files
+// without copying them : the pages are loaded by the kernel when they are first touched,
+// and replaceFile, which puts a newly written file in place of another one.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile {
+private:
+    uint8_t* bytes;
+    size_t length;
+
+public:
+    // Maps a whole file in memory
+    // The mapping is private : writing to it never changes the file, the written pages are copied on write
+    //
+    // Parameters :
+    // path : the file to map
+    //
+    // Throws std::runtime_error if the file can't be opened or mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Tells the system the pages of a part of the file will not be read again, so they can leave the memory
+    // They are read back from the file if they are used anyway. Only the whole pages inside the part are released.
+    //
+    // Parameters :
+    // offset, length : the part of the file
+    void release(size_t offset, size_t length);
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Renames a file written next to another one over it, once its content is on the disk.
+// The directory is flushed too, so after a crash the path holds either the old file or the whole new one
+//
+// Parameters :
+// tmp_path : the new file, already written and closed
+// path : the file it replaces
+//
+// Throws std::runtime_error if the file can't be flushed or renamed
+void replaceFile(const std::string& tmp_path, const std::string& path);
+
+#endif //MAPPED_FILE_H
@@ -5,12 +5,84 @@
 //
 
 #include "matrix.h"
+#include "gemm.h"
+#include <algorithm>
 
 Matrix::Matrix(size_t rows, size_t cols, double init_val)
-    : rows(rows), cols(cols), data(rows * cols, init_val)
+    : rows(rows), cols(cols), storage(rows * cols, init_val), values(storage.data())
 {
 }
 
+Matrix::Matrix(const Matrix& other)
+    : rows(other.rows), cols(other.cols),
+      storage(other.values, other.values + other.size()), values(storage.data())
+{
+}
+
+Matrix::Matrix(Matrix&& other) noexcept
+    : rows(other.rows), cols(other.cols), storage(std::move(other.storage)), values(other.values)
+{
+    // The moved vector keeps its buffer, so values is still valid for owned matrices and views alike
+    other.rows = 0;
+    other.cols = 0;
+    other.values = nullptr;
+}
+
+Matrix& Matrix::operator=(const Matrix& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    if (isView()) {
+        if (rows != other.rows || cols != other.cols) {
+            throw std::invalid_argument("Matrix dimensions must match when assigning to a view");
+        }
+        std::copy(other.values, other.values + other.size(), values);
+        return *this;
+    }
+
+    rows = other.rows;
+    cols = other.cols;
+    storage.assign(other.values, other.values + other.size());
+    values = storage.data();
+    return *this;
+}
+
+Matrix& Matrix::operator=(Matrix&& other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    // Views keep pointing to their memory, and a view given to us can't be stolen either
+    if (isView() || other.isView()) {
+        return *this = static_cast<const Matrix&>(other);
+    }
+
+    rows = other.rows;
+    cols = other.cols;
+    storage = std::move(other.storage);
+    values = storage.data();
+    other.rows = 0;
+    other.cols = 0;
+    other.values = nullptr;
+    return *this;
+}
+
+Matrix Matrix::view(double* values, size_t rows, size_t cols) {
+    Matrix m(0, 0);
+    m.rows = rows;
+    m.cols = cols;
+    m.values = values;
+    return m;
+}
+
+void Matrix::swap(Matrix& other) noexcept {
+    std::swap(rows, other.rows);
+    std::swap(cols, other.cols);
+    std::swap(storage, other.storage);
+    std::swap(values, other.values);
+}
+
 double& Matrix::operator()(size_t i, size_t j) {
     if (i >= rows || j >= cols) {
         throw std::out_of_range("Index out of bounds");
@@ -18,14 +90,14 @@ double& Matrix::operator()(size_t i, size_t j) {
     // Accessing the element at (i, j) in a 1D vector representation
     // The element at (i, j) is at index i * cols + j in the data vector
     // This is a common way to store 2D matrices in a 1D array for performance
-    return data[i * cols + j];
+    return values[i * cols + j];
 }
 
 double Matrix::operator()(size_t i, size_t j) const {
     if (i >= rows || j >= cols) {
         throw std::out_of_range("Matrix indices out of bounds");
     }
-    return data[i * cols + j];
+    return values[i * cols + j];
 }
 
 void Matrix::print(std::ostream& out, int precision) const {
@@ -109,15 +181,9 @@ Matrix Matrix::operator*(const Matrix& b) const {
         throw std::invalid_argument("In order to perform A • B, cols(A) must match rows(B)");
     }
 
+    // The product is done by the blocked kernel of gemm.h, on the raw values
     Matrix m(rows, b.cols, 0.0);
-
-    for (size_t i = 0; i < rows; ++i) {
-        for (size_t j = 0; j < b.cols; ++j) {
-            for (size_t k = 0; k < cols; ++k) {
-                m(i, j) += (*this)(i, k) * b(k, j);
-            }
-        }
-    }
+    gemm(false, false, rows, b.cols, cols, 1.0, values, cols, b.values, b.cols, 0.0, m.values, b.cols);
 
     return m;
 }
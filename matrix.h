@@ -23,9 +23,12 @@ class Matrix {
 private:
     // The matrix data is stored in a flat vector for efficiency
     // Maybe i will implementing hollow matrices in the future
-    std::vector<double> data;
+    // A matrix can also be a view : it then owns nothing and values points into memory owned by someone else
+    // (for example the parameter arena of a Network). In that case the storage vector stays empty.
     size_t rows;
     size_t cols;
+    std::vector<double> storage;
+    double* values;
 
 public:
     // Constructor to create a matrix of given size initialized with a specific valu
@@ -36,8 +39,35 @@ public:
     // init_val : initial value for all elements in the matrix, default is 0.0
     Matrix(size_t rows, size_t cols, double init_val = 0.0);
 
+    // Copying a matrix always produces a matrix that owns its values, even when copying a view.
+    // Assigning to a view writes the values into the viewed memory instead of detaching the view,
+    // so the dimensions must match.
+    //
+    // Throws std::invalid_argument if a view is assigned a matrix of different dimensions
+    Matrix(const Matrix& other);
+    Matrix(Matrix&& other) noexcept;
+    Matrix& operator=(const Matrix& other);
+    Matrix& operator=(Matrix&& other);
+
+    // Creates a matrix that reads and writes the given memory instead of owning its values
+    //
+    // Parameters :
+    // values : pointer to rows * cols doubles stored row by row, must outlive the view
+    // rows : number of rows in the matrix
+    // cols : number of columns in the matrix
+    static Matrix view(double* values, size_t rows, size_t cols);
+
+    // Exchanges the contents of two matrices, views included, without copying any value
+    void swap(Matrix& other) noexcept;
+
     size_t numRows() const { return rows; }
     size_t numCols() const { return cols; }
+    size_t size() const { return rows * cols; }
+    bool isView() const { return storage.empty() && size() != 0; }
+
+    // Raw access to the row-major values, without bounds checking
+    double* data() { return values; }
+    const double* data() const { return values; }
 
     // Access elements using (row, column) indexing
     //
@@ -0,0 +1,212 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "metrics.h"
+#include "benchmark.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// How often the reporter thread looks at the queue when nobody wakes it up
+constexpr std::chrono::milliseconds poll_period(20);
+
+// Weight of the last batch in the running average of the loss, about the last 50 batches count
+constexpr double running_weight = 0.02;
+
+double secondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+}
+
+MetricsReporter::MetricsReporter(std::ostream* progress, bool rewrite, const std::string& log_path, double interval,
+                                 size_t capacity)
+    : queue(capacity), dropped(0), progress(progress), rewrite(rewrite), interval(interval),
+      loss_sum(0.0), correct(0), running_loss(0.0), interval_samples(0), log_failed(false),
+      epoch_start(std::chrono::steady_clock::now()), last_report(epoch_start),
+      flush_asked(false), stopping(false)
+{
+    if (!log_path.empty()) {
+        log.open(log_path, std::ios::app);
+        if (!log) {
+            throw std::runtime_error("Can't open " + log_path + " to write the metrics");
+        }
+    }
+    worker = std::thread(&MetricsReporter::workerLoop, this);
+}
+
+MetricsReporter::~MetricsReporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void MetricsReporter::startEpoch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    epoch_start = std::chrono::steady_clock::now();
+}
+
+void MetricsReporter::push(const BatchMetrics& metrics) {
+    if (!queue.tryPush(metrics)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+EpochMetrics MetricsReporter::finishEpoch() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flush_asked = true;
+    wake.notify_all();
+    wake.wait(lock, [this] { return !flush_asked; });
+    if (log_failed) {
+        throw std::runtime_error("Can't write the metrics to their log");
+    }
+    return finished;
+}
+
+void MetricsReporter::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait_for(lock, poll_period, [this] { return flush_asked || stopping; });
+        const bool flush = flush_asked;
+        const bool stop = stopping;
+
+        // The reports are written without the lock, the trainer is not kept waiting in startEpoch
+        lock.unlock();
+        drain(flush || stop);
+        lock.lock();
+
+        // Everything finishEpoch is waiting for was pushed before it asked, so it is all in the sums now
+        if (flush || (stop && current.batches > 0)) {
+            closeEpoch();
+        }
+        if (flush) {
+            flush_asked = false;
+            wake.notify_all();
+        }
+        if (stop) {
+            break;
+        }
+    }
+}
+
+void MetricsReporter::drain(bool force) {
+    BatchMetrics metrics;
+    bool taken = false;
+    while (queue.tryPop(metrics)) {
+        if (current.batches == 0) {
+            // The samples per second are counted from the first batch of the epoch on
+            last_report = std::chrono::steady_clock::now();
+        } else {
+            interval_samples += metrics.samples;
+        }
+        current.epoch = metrics.epoch;
+        ++current.batches;
+        current.samples += metrics.samples;
+        loss_sum += metrics.loss * metrics.samples;
+        correct += metrics.correct;
+        // The mean of the batches so far until there are enough of them, so the first batch does not weigh on the rest
+        const double weight = std::max(running_weight, 1.0 / current.batches);
+        running_loss = (1.0 - weight) * running_loss + weight * metrics.loss;
+        last = metrics;
+        taken = true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (current.batches > 0 && (force || (taken && secondsBetween(last_report, now) >= interval))) {
+        report(now, force);
+    }
+}
+
+void MetricsReporter::report(std::chrono::steady_clock::time_point now, bool last_of_epoch) {
+    const double seconds = secondsBetween(last_report, now);
+    const double rate = seconds > 0.0 ? interval_samples / seconds : 0.0;
+    const double epoch_loss = current.samples > 0 ? loss_sum / current.samples : 0.0;
+    const double accuracy = current.samples > 0 ? static_cast<double>(correct) / current.samples : 0.0;
+
+    if (progress) {
+        std::ostringstream line;
+        line << std::fixed << "Epoch " << last.epoch + 1 << ", batch " << last.batch + 1 << "/" << last.batches
+             << " : loss " << std::setprecision(4) << running_loss << " (epoch mean " << epoch_loss << "), accuracy "
+             << std::setprecision(1) << accuracy * 100.0 << "%, " << std::setprecision(0) << rate << " samples/s, lr "
+             << std::defaultfloat << last.learning_rate;
+        if (rewrite) {
+            // The line is written over the previous one, a shorter line is padded to hide the end of the longer one
+            *progress << "\r" << std::left << std::setw(100) << line.str() << std::right;
+            if (last_of_epoch) {
+                *progress << "\n";
+            }
+            progress->flush();
+        } else {
+            *progress << line.str() << "\n";
+        }
+    }
+    if (log.is_open()) {
+        log << std::setprecision(9)
+            << "{\"type\": \"progress\", \"epoch\": " << last.epoch + 1
+            << ", \"batch\": " << last.batch + 1
+            << ", \"batches\": " << last.batches
+            << ", \"loss\": " << running_loss
+            << ", \"epoch_loss\": " << epoch_loss
+            << ", \"accuracy\": " << accuracy
+            << ", \"samples_per_s\": " << rate
+            << ", \"learning_rate\": " << last.learning_rate << "}\n";
+        log_failed = log_failed || !log;
+    }
+    last_report = now;
+    interval_samples = 0;
+}
+
+void MetricsReporter::closeEpoch() {
+    finished = current;
+    finished.loss = current.samples > 0 ? loss_sum / current.samples : 0.0;
+    finished.accuracy = current.samples > 0 ? static_cast<double>(correct) / current.samples : 0.0;
+    finished.seconds = secondsBetween(epoch_start, std::chrono::steady_clock::now());
+    finished.dropped = dropped.exchange(0, std::memory_order_relaxed);
+
+    if (log.is_open()) {
+        log << std::setprecision(9)
+            << "{\"type\": \"epoch\", \"epoch\": " << finished.epoch + 1
+            << ", \"batches\": " << finished.batches
+            << ", \"samples\": " << finished.samples
+            << ", \"loss\": " << finished.loss
+            << ", \"accuracy\": " << finished.accuracy
+            << ", \"seconds\": " << finished.seconds
+            << ", \"dropped\": " << finished.dropped
+            << ", \"date\": " << jsonString(currentDate()) << "}\n";
+        log.flush();
+        log_failed = log_failed || !log;
+    }
+
+    current = EpochMetrics();
+    loss_sum = 0.0;
+    correct = 0;
+    running_loss = 0.0;
+    interval_samples = 0;
+}
+
+size_t countCorrect(const Matrix& outputs, const Matrix& targets) {
+    const size_t classes = outputs.numRows();
+    const size_t n = outputs.numCols();
+    size_t right = 0;
+    for (size_t j = 0; j < n; ++j) {
+        size_t predicted = 0;
+        size_t expected = 0;
+        for (size_t i = 1; i < classes; ++i) {
+            if (outputs(i, j) > outputs(predicted, j)) {
+                predicted = i;
+            }
+            if (targets(i, j) > targets(expected, j)) {
+                expected = i;
+            }
+        }
+        right += predicted == expected ? 1 : 0;
+    }
+    return right;
+}
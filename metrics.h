@@ -0,0 +1,128 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the MetricsReporter : the trainer pushes what each batch did (its loss, its right predictions,
+// its samples, the learning rate) into a lock-free queue (see spsc_queue.h) and goes on with the next batch,
+// a background thread adds them up and reports them : a progress line rewritten at most a few times per second,
+// and/or a JSON line per report in a log file. The trainer never waits for the terminal or the disk.
+// The training loss is followed as a running average over the last batches, and as the mean of the epoch.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include "matrix.h"
+#include "spsc_queue.h"
+
+// What the trainer pushes for each batch
+struct BatchMetrics {
+    uint32_t epoch = 0;         // counted from 0
+    uint32_t batch = 0;         // index of the batch in its epoch
+    uint32_t batches = 0;       // number of batches of the epoch
+    uint32_t samples = 0;       // samples of the batch
+    uint32_t correct = 0;       // samples whose largest output is their class
+    double loss = 0.0;          // mean cost over the samples of the batch (what Network::train returns)
+    double learning_rate = 0.0;
+};
+
+// What an epoch did, as the reporter added it up
+struct EpochMetrics {
+    uint32_t epoch = 0;
+    uint64_t batches = 0;
+    uint64_t samples = 0;
+    double loss = 0.0;          // mean cost over the samples of the epoch
+    double accuracy = 0.0;      // fraction of the samples that were predicted right, before the step on their batch
+    double seconds = 0.0;       // from startEpoch to finishEpoch
+    uint64_t dropped = 0;       // batches that found the queue full, they are left out of everything else
+};
+
+class MetricsReporter {
+private:
+    SpscQueue<BatchMetrics> queue;
+    std::atomic<uint64_t> dropped;
+
+    std::ostream* progress;
+    bool rewrite;
+    std::ofstream log;
+    double interval;
+
+    // The sums of the epoch, only touched by the reporter thread
+    EpochMetrics current;
+    double loss_sum;
+    uint64_t correct;
+    double running_loss;
+    uint64_t interval_samples;
+    BatchMetrics last;
+    bool log_failed;
+
+    // startEpoch and finishEpoch talk to the reporter thread under the mutex, once per epoch
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::chrono::steady_clock::time_point epoch_start;
+    std::chrono::steady_clock::time_point last_report;
+    bool flush_asked;
+    bool stopping;
+    EpochMetrics finished;
+    std::thread worker;
+
+    void workerLoop();
+
+    // Takes what is in the queue and adds it up, then reports it if the last report is old enough (or force)
+    void drain(bool force);
+    void report(std::chrono::steady_clock::time_point now, bool last_of_epoch);
+
+    // Ends the epoch : its line in the log, and its sums back to zero
+    void closeEpoch();
+
+public:
+    // Starts the reporter thread
+    //
+    // Parameters :
+    // progress : where the progress line is written, or null for none
+    // rewrite : if true the progress line is rewritten in place (for a terminal), otherwise each report is a new line
+    // log_path : the file the reports are appended to as JSON lines, empty for none
+    // interval : the time between two reports, in seconds
+    // capacity : number of batches the queue holds, a batch that finds it full is dropped rather than waited for
+    //
+    // Throws std::runtime_error if the log can't be opened
+    MetricsReporter(std::ostream* progress, bool rewrite, const std::string& log_path, double interval = 0.5,
+                    size_t capacity = 4096);
+
+    // Stops the reporter thread, what is still in the queue is reported first
+    ~MetricsReporter();
+
+    MetricsReporter(const MetricsReporter&) = delete;
+    MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+    // Starts the clock of an epoch, before its first batch
+    void startEpoch();
+
+    // Hands the metrics of a batch to the reporter, never blocks, only called by the trainer thread
+    void push(const BatchMetrics& metrics);
+
+    // Reports everything pushed so far, ends the progress line, appends the epoch to the log,
+    // and starts the sums of the next epoch. Called by the trainer thread at the end of an epoch
+    // output : what the epoch did
+    //
+    // Throws std::runtime_error if the log could not be written
+    EpochMetrics finishEpoch();
+};
+
+// Number of samples of a batch whose largest output is where their one-hot target has its largest value
+//
+// Parameters :
+// outputs : the outputs of the network, of size (classes, n)
+// targets : the one-hot targets, of the same size
+size_t countCorrect(const Matrix& outputs, const Matrix& targets);
+
+#endif //METRICS_H
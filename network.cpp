@@ -5,6 +5,91 @@
 //
 
 #include "network.h"
+#include "dense.h"
+#include "mapped_file.h"
+#include "trace.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+// Layout of a model file :
+// ModelHeader, then layer_count LayerRecords, then zeros up to params_offset where the parameter arena starts,
+// param_count doubles
+// Version 1 files only had dense layers : layer_count + 1 sizes (uint64) then layer_count activation ids (uint32)
+// instead of the records, they are still read
+// Everything is written in the byte order of the machine, byte_order tells the reader which one it was
+struct ModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t layer_count;
+    uint32_t cost;
+    uint64_t param_count;
+    uint64_t params_offset;
+};
+
+// A LayerSpec, with sizes that do not depend on the machine
+struct LayerRecord {
+    uint32_t kind;
+    uint32_t activation;
+    uint64_t in_size;
+    uint64_t out_size;
+    uint64_t channels;
+    uint64_t height;
+    uint64_t width;
+    uint64_t filters;
+    uint64_t window;
+    uint64_t stride;
+    uint64_t padding;
+};
+
+constexpr char model_magic[8] = {'D', 'U', 'M', 'B', 'R', 'O', 'N', 'S'};
+constexpr uint32_t model_version = 2;
+constexpr uint32_t model_byte_order = 0x01020304;
+
+// The parameters start on a page boundary, so a mapped model gets page (and cache line) aligned weights
+constexpr uint64_t model_page_size = 4096;
+
+LayerRecord recordOf(const LayerSpec& spec) {
+    return LayerRecord{static_cast<uint32_t>(spec.kind), static_cast<uint32_t>(spec.activation),
+                       spec.in_size, spec.out_size, spec.channels, spec.height, spec.width,
+                       spec.filters, spec.window, spec.stride, spec.padding};
+}
+
+LayerSpec specOf(const LayerRecord& record) {
+    LayerSpec spec;
+    spec.kind = static_cast<LayerKind>(record.kind);
+    spec.activation = static_cast<Activation>(record.activation);
+    spec.in_size = record.in_size;
+    spec.out_size = record.out_size;
+    spec.channels = record.channels;
+    spec.height = record.height;
+    spec.width = record.width;
+    spec.filters = record.filters;
+    spec.window = record.window;
+    spec.stride = record.stride;
+    spec.padding = record.padding;
+    return spec;
+}
+
+// The dense layers of a multilayer perceptron
+std::vector<LayerSpec> denseSpecs(const std::vector<size_t>& sizes, const std::vector<Activation>& activations) {
+    if (sizes.size() < 2) {
+        throw std::invalid_argument("Network must have at least an input and an output layer");
+    }
+    if (activations.size() != sizes.size() - 1) {
+        throw std::invalid_argument("Network needs one activation function per layer");
+    }
+    std::vector<LayerSpec> specs;
+    for (size_t i = 0; i < sizes.size() - 1; ++i) {
+        specs.push_back(LayerSpec::dense(sizes[i], sizes[i + 1], activations[i]));
+    }
+    return specs;
+}
+
+}
 
 Network::Network(const std::vector<size_t>& sizes,
                 const std::vector<std::function<double(double)>>& activations,
@@ -12,29 +97,147 @@ Network::Network(const std::vector<size_t>& sizes,
                  std::function<double(double, double)> cost,
                  std::function<double(double, double)> cost_deriv,
                  double learning_rate)
-    : learning_rate(learning_rate), cost(cost), cost_deriv(cost_deriv) {
+    : optimizer(std::make_unique<SGD>(learning_rate)), cost(cost), cost_deriv(cost_deriv),
+      sizes(sizes), cost_id(Cost::Custom) {
     // Check if the sizes vector is valid
     // It should contain at least 3 elements (number of hidden layers + input and output layers)
     if (sizes.size() < 2) {
         throw std::invalid_argument("Network must have at least an input and an output layer");
     }
+    if (activations.size() != sizes.size() - 1 || activation_deriv.size() != sizes.size() - 1) {
+        throw std::invalid_argument("Network needs one activation function and one derivative per layer");
+    }
 
     // Create the layers based on the sizes and activation functions provided
     for (size_t i = 0; i < sizes.size() - 1; ++i) {
-        layers.emplace_back(sizes[i], sizes[i+1], activations[i], activation_deriv[i]);
+        layers.push_back(std::make_unique<Dense>(sizes[i], sizes[i+1], activations[i], activation_deriv[i]));
     }
+
+    bindLayers();
 }
 
-Matrix Network::forward(const Matrix &input) {
-    Matrix out = input;
+Network::Network(const std::vector<size_t>& sizes,
+                 const std::vector<Activation>& activations,
+                 Cost cost,
+                 double learning_rate)
+    : Network(denseSpecs(sizes, activations), cost, learning_rate) {}
+
+Network::Network(const std::vector<LayerSpec>& specs,
+                 Cost cost,
+                 double learning_rate)
+    : optimizer(std::make_unique<SGD>(learning_rate)), cost(costFunction(cost)), cost_deriv(costDerivative(cost)),
+      cost_id(cost) {
+    if (specs.empty()) {
+        throw std::invalid_argument("Network must have at least one layer");
+    }
 
-    // Forward has already been implemented in the Layer class
-    // Here we just call the forward method of each layer in sequence
-    for (size_t i = 0; i < layers.size(); ++i) {
-        out = layers[i].forward(out);
+    // Each layer must take what the previous one gives
+    for (size_t i = 0; i < specs.size(); ++i) {
+        std::unique_ptr<Layer> layer = makeLayer(specs[i]);
+        if (!layers.empty() && layers.back()->outputSize() != layer->inputSize()) {
+            throw std::invalid_argument("Layer " + std::to_string(i + 1) + " takes " + std::to_string(layer->inputSize())
+                                        + " values, the previous layer gives " + std::to_string(layers.back()->outputSize()));
+        }
+        layers.push_back(std::move(layer));
     }
 
-    return out;
+    sizes.push_back(layers.front()->inputSize());
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        sizes.push_back(layer->outputSize());
+    }
+
+    bindLayers();
+}
+
+void Network::bindLayers() {
+    // Allocate the parameter and gradient arenas, then move every layer into its slice of them
+    size_t count = 0;
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        count += layer->parameterCount();
+    }
+    params = Arena(count);
+    grads = Arena(count);
+
+    size_t offset = 0;
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        layer->bind(params.data() + offset, grads.data() + offset);
+        offset += layer->parameterCount();
+    }
+}
+
+ExecutionPlan& Network::planFor(size_t batch_size, bool training) {
+    ExecutionPlan& plan = training ? training_plan : inference_plan;
+    if (plan.batchSize() != batch_size) {
+        plan = ExecutionPlan(layers, batch_size, training);
+    }
+    return plan;
+}
+
+const ExecutionPlan& Network::compile(size_t batch_size, bool training) {
+    return planFor(batch_size, training);
+}
+
+const Matrix& Network::forward(const Matrix &input) {
+    // Forward has already been implemented by each kind of layer
+    // The plan calls the forward method of each of its steps in sequence, each step writes into its own buffer
+    return planFor(input.numCols(), false).forward(input);
+}
+
+const Matrix& Network::trainingOutput() const {
+    return training_plan.output();
+}
+
+double Network::train(const Matrix& inputs, const Matrix& targets) {
+    if (inputs.numCols() != targets.numCols()) {
+        throw std::invalid_argument("Inputs and targets must have the same number of samples");
+    }
+    if (targets.numRows() != sizes.back()) {
+        throw std::invalid_argument("Targets must have one row per output neuron");
+    }
+
+    // Forward pass through the network
+    ExecutionPlan& plan = planFor(inputs.numCols(), true);
+    const Matrix* out = &plan.forward(inputs);
+
+    // Compute the loss gradient using the cost derivative, for every output of every sample
+    // This assumes the cost function is differentiable and returns a gradient
+    // It is written straight into the buffer the plan reads it from
+    const size_t count = out->size();
+    Matrix& loss_grad = plan.outputGradient();
+    double loss = 0.0;
+    {
+        // The cost and its derivative counted as one operation each, the outputs and targets read, the gradient written
+        PROFILE_SCOPE(this, "loss", ProfilePhase::Loss, (OpCost{2.0 * count, 24.0 * count}));
+        TRACE_SCOPE("loss", "loss");
+        if (cost_id == Cost::Custom) {
+            for (size_t i = 0; i < count; ++i) {
+                double y_pred = out->data()[i];
+                double y_true = targets.data()[i];
+                loss += cost(y_pred, y_true);
+                loss_grad.data()[i] = cost_deriv(y_pred, y_true);
+            }
+        } else {
+            // A cost of the library is one loop over the outputs, without a call per value
+            loss = costRow(cost_id, out->data(), targets.data(), loss_grad.data(), count);
+        }
+    }
+
+    // Backpropagation through the network
+    // We start from the output layer and propagate the gradients back through each layer
+    // The backward method of each layer computes the gradient of the loss with respect to the inputs
+    // and gives it to the previous layer, the first layer does not compute it since nobody needs it
+    plan.backward();
+
+    // Update the weights and biases of every layer using the computed gradients
+    // Since they all live in the parameter arena, the optimizer does a single sweep over the whole model
+    {
+        PROFILE_SCOPE(optimizer.get(), "optimizer " + optimizer->name(), ProfilePhase::Update,
+                      optimizer->stepCost(params.size()));
+        TRACE_SCOPE("update", "optimizer step");
+        optimizer->step(params, grads);
+    }
+
+    return loss / inputs.numCols();
 }
 
 void Network::train(const std::vector<Matrix>& inputs,
@@ -45,37 +248,161 @@ void Network::train(const std::vector<Matrix>& inputs,
     }
 
     // The following code implements the training loop
-    // For each epoch, we iterate over all inputs and targets
+    // For each epoch, we iterate over all inputs and targets, each of them is a batch of one sample
     for (size_t epoch = 0; epoch < epochs; ++epoch) {
-        // Shuffle the inputs and targets together
         for (size_t i = 0; i < inputs.size(); ++i) {
-            // Forward pass through the network
-            Matrix out = forward(inputs[i]);
-
-            // Compute the loss gradient using the cost derivative
-            // This assumes the cost function is differentiable and returns a gradient
-            // For simplicity, we assume the cost function is mean squared error (MSE)
-            Matrix loss_grad(out.numRows(), 1);
-            for (size_t j = 0; j < out.numRows(); ++j) {
-                double y_pred = out(j, 0);
-                double y_true = targets[i](j, 0);
-                loss_grad(j, 0) = cost_deriv(y_pred, y_true);
-            }
+            train(inputs[i], targets[i]);
+        }
+    }
+}
 
-            // Backpropagation through the network
-            // We start from the output layer and propagate the gradients back through each layer
-            // The backward method of each layer computes the gradient of the loss with respect to the inputs
-            // and returns it to be used in the previous layer
-            Matrix grad = loss_grad;
-            for (int l = layers.size() - 1; l >= 0; --l) {
-                grad = layers[l].backward(grad);
-            }
+void Network::initialize(uint32_t seed) {
+    std::mt19937 gen(seed);
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        layer->initialize(gen);
+    }
+}
 
-            // Update the weights and biases of each layer using the computed gradients
-            // The update method of each layer applies the gradients to the weights and biases
-            for (size_t l = 0; l < layers.size(); ++l) {
-                layers[l].update(learning_rate);
-            }
+void Network::setOptimizer(std::unique_ptr<Optimizer> opt) {
+    if (!opt) {
+        throw std::invalid_argument("The optimizer must not be null");
+    }
+    optimizer = std::move(opt);
+}
+
+void Network::save(const std::string& path) const {
+    if (cost_id == Cost::Custom) {
+        throw std::logic_error("A network with a custom cost function can't be saved");
+    }
+    std::vector<LayerRecord> records;
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        LayerSpec spec = layer->spec();
+        if (spec.activation == Activation::Custom) {
+            throw std::logic_error("A network with custom activation functions can't be saved");
+        }
+        records.push_back(recordOf(spec));
+    }
+
+    ModelHeader header {};
+    std::memcpy(header.magic, model_magic, sizeof(model_magic));
+    header.version = model_version;
+    header.byte_order = model_byte_order;
+    header.layer_count = static_cast<uint32_t>(layers.size());
+    header.cost = static_cast<uint32_t>(cost_id);
+    header.param_count = params.size();
+
+    uint64_t end_of_topology = sizeof(header) + records.size() * sizeof(LayerRecord);
+    header.params_offset = (end_of_topology + model_page_size - 1) / model_page_size * model_page_size;
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Can't open " + path + " for writing");
+    }
+
+    // The arena is written as it is in memory, padding included, in one call
+    std::vector<char> padding(header.params_offset - end_of_topology, 0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(LayerRecord));
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char*>(params.data()), params.size() * sizeof(double));
+
+    if (!out.good()) {
+        throw std::runtime_error("Can't write the model to " + path);
+    }
+}
+
+Network Network::load(const std::string& path, bool map) {
+    auto file = std::make_shared<MappedFile>(path);
+    const uint8_t* bytes = file->data();
+
+    ModelHeader header {};
+    if (file->size() < sizeof(header)) {
+        throw std::runtime_error(path + " is too small to be a model file");
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+
+    if (std::memcmp(header.magic, model_magic, sizeof(model_magic)) != 0) {
+        throw std::runtime_error(path + " is not a model file");
+    }
+    if (header.byte_order != model_byte_order) {
+        throw std::runtime_error(path + " was written on a machine with another byte order");
+    }
+    if (header.version != 1 && header.version != model_version) {
+        throw std::runtime_error(path + " has an unsupported model version " + std::to_string(header.version));
+    }
+
+    // The number of layers is bounded by what the file holds before anything is sized from it
+    // A version 1 topology is the input size, then the output size and the activation id of each layer
+    const uint64_t topology_bytes = file->size() - sizeof(header);
+    const uint64_t fixed_bytes = header.version == 1 ? sizeof(uint64_t) : 0;
+    const uint64_t layer_bytes = header.version == 1 ? sizeof(uint64_t) + sizeof(uint32_t) : sizeof(LayerRecord);
+    if (header.layer_count == 0 || fixed_bytes > topology_bytes
+        || header.layer_count > (topology_bytes - fixed_bytes) / layer_bytes) {
+        throw std::runtime_error(path + " has a truncated topology");
+    }
+
+    std::vector<LayerRecord> records(header.layer_count);
+    if (header.version == 1) {
+        std::vector<uint64_t> dims(header.layer_count + 1);
+        std::vector<uint32_t> ids(header.layer_count);
+        std::memcpy(dims.data(), bytes + sizeof(header), dims.size() * sizeof(uint64_t));
+        std::memcpy(ids.data(), bytes + sizeof(header) + dims.size() * sizeof(uint64_t), ids.size() * sizeof(uint32_t));
+        for (size_t i = 0; i < records.size(); ++i) {
+            records[i] = recordOf(LayerSpec::dense(dims[i], dims[i + 1], static_cast<Activation>(ids[i])));
+        }
+    } else {
+        std::memcpy(records.data(), bytes + sizeof(header), records.size() * sizeof(LayerRecord));
+    }
+
+    std::vector<LayerSpec> specs;
+    for (const LayerRecord& record : records) {
+        if (record.kind > static_cast<uint32_t>(LayerKind::Softmax)) {
+            throw std::runtime_error(path + " uses an unknown layer kind " + std::to_string(record.kind));
+        }
+        if (record.activation > static_cast<uint32_t>(Activation::Tanh)) {
+            throw std::runtime_error(path + " uses an unknown activation id " + std::to_string(record.activation));
         }
+        specs.push_back(specOf(record));
     }
+    if (header.cost != static_cast<uint32_t>(Cost::MSE)) {
+        throw std::runtime_error(path + " uses an unknown cost id " + std::to_string(header.cost));
+    }
+
+    Network net = [&] {
+        try {
+            return Network(specs, static_cast<Cost>(header.cost));
+        } catch (const std::invalid_argument& e) {
+            throw std::runtime_error(path + " has an invalid topology : " + e.what());
+        }
+    }();
+
+    if (header.param_count != net.params.size()) {
+        throw std::runtime_error(path + " does not hold the number of parameters its topology needs");
+    }
+    // Compared with what is left after the offset, a sum could wrap around and point outside the mapping
+    if (header.params_offset % Arena::alignment != 0 || header.params_offset > file->size()
+        || header.param_count > (file->size() - header.params_offset) / sizeof(double)) {
+        throw std::runtime_error(path + " has truncated or misaligned parameters");
+    }
+
+    double* stored = reinterpret_cast<double*>(file->data() + header.params_offset);
+    if (map) {
+        // The arena now keeps the mapping alive, the layers point straight at the mapped pages
+        net.params = Arena::wrap(stored, header.param_count, file);
+    } else {
+        net.params = Arena(header.param_count);
+        std::memcpy(net.params.data(), stored, header.param_count * sizeof(double));
+    }
+
+    size_t offset = 0;
+    for (const std::unique_ptr<Layer>& layer : net.layers) {
+        layer->bind(net.params.data() + offset, net.grads.data() + offset, false);
+        offset += layer->parameterCount();
+    }
+
+    return net;
+}
+
+double Network::gradientNorm() const {
+    return std::sqrt(grads.squaredNorm());
 }
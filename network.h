@@ -1,7 +1,8 @@
 //
 // Created by Mazen Messai on 09/06/2025.
 // This file is part of a simple neural network library for C++.
-// It provides a Network class that represents a neural network composed of multiple layers.
+// It provides a Network class that represents a neural network composed of multiple layers,
+// fully connected (a multilayer perceptron) or convolutional (see LayerSpec).
 // The Network class supports forward and backward passes, training with a dataset, and uses various activation and cost functions.
 // The library is designed to be easy to use and extend, with a focus on educational purposes.
 // I wrote it to practice C++ and have fun with machine learning concepts.
@@ -16,14 +17,39 @@
 #include <vector>
 #include "matrix.h"
 #include "layer.h"
+#include "arena.h"
+#include "optimizer.h"
+#include "activation.h"
+#include "plan.h"
+#include <memory>
+#include <string>
 
 class Network {
 private:
-    std::vector<Layer> layers;
-    double learning_rate;
+    // All the weights and biases of the layers live in one aligned arena, and their gradients in a second one
+    // with the same layout. The layers only hold views into them, so whole-model operations are one sweep.
+    std::vector<std::unique_ptr<Layer>> layers;
+    Arena params;
+    Arena grads;
+    std::unique_ptr<Optimizer> optimizer;
     std::function<double(double, double)> cost;
     std::function<double(double, double)> cost_deriv;
 
+    // The plans forward and train run, rebuilt when the batch size changes (see compile)
+    ExecutionPlan inference_plan;
+    ExecutionPlan training_plan;
+
+    // The number of values of a sample between the layers, from the input to the output,
+    // and the id of the cost function, Custom when the network was built from user functions
+    // The layers keep the rest of what the network is made of (see Layer::spec), so it can be saved
+    std::vector<size_t> sizes;
+    Cost cost_id;
+
+    // Allocates the arenas and binds every layer to its slice of them
+    void bindLayers();
+
+    ExecutionPlan& planFor(size_t batch_size, bool training);
+
 public:
     // Size is a vector of layer sizes, e.g., {2, 3, 1} for a network with 2 input neurons, 3 hidden neurons, and 1 output neuron.
     // For now, the activations and activation_derive are two differents vectors
@@ -35,6 +61,7 @@ public:
     // cost: cost function that takes two doubles (predicted and target) and returns a double
     // cost_deriv: derivative of the cost function that takes two doubles (predicted and target) and returns a double
     // learning_rate: learning rate for the network, default is 0.01
+    // The network starts with plain SGD at this learning rate, see setOptimizer to use another optimizer
     Network(const std::vector<size_t>& sizes,
             const std::vector<std::function<double(double)>>& activations,
             const std::vector<std::function<double(double)>>& activation_deriv,
@@ -42,13 +69,98 @@ public:
             std::function<double(double, double)> cost_deriv,
             double learning_rate = 0.01);
 
+    // Same as above, with activation and cost functions chosen by id (see activation.h)
+    // A network built this way can be saved with save
+    //
+    // Throws std::invalid_argument if there is not one activation per layer
+    Network(const std::vector<size_t>& sizes,
+            const std::vector<Activation>& activations,
+            Cost cost = Cost::MSE,
+            double learning_rate = 0.01);
+
+    // Builds a network from the description of its layers, of any kind, for example a small convolutional network :
+    // {LayerSpec::conv2d(1, 28, 28, 8, 5, 1, 2, Activation::ReLU), LayerSpec::maxPool2d(8, 28, 28, 2, 2),
+    //  LayerSpec::dense(8 * 14 * 14, 10, Activation::Sigmoid)}
+    // A network built this way can be saved with save
+    //
+    // Parameters :
+    // specs : the layers, from the input to the output
+    // cost : the cost function
+    // learning_rate : learning rate of the plain SGD the network starts with
+    //
+    // Throws std::invalid_argument if there is no layer, a spec is not valid (see makeLayer),
+    // or the output of a layer is not the size of the input of the next one
+    Network(const std::vector<LayerSpec>& specs,
+            Cost cost = Cost::MSE,
+            double learning_rate = 0.01);
+
+    // The layers hold views into the arenas of the network, so a network can't be copied
+    // Moving is fine : the arenas and the layers keep their memory
+    Network(const Network&) = delete;
+    Network& operator=(const Network&) = delete;
+    Network(Network&&) = default;
+    Network& operator=(Network&&) = default;
+
+    // Saves the network to a binary model file
+    // The file holds a header (magic, version, the spec of every layer, cost id) followed by the parameter
+    // arena as it is in memory, starting on a page boundary so load can map it directly
+    // The optimizer state is not saved, see the checkpoints for that
+    //
+    // Parameters :
+    // path : the file to write
+    //
+    // Throws std::logic_error if the network uses custom functions, std::runtime_error if the file can't be written
+    void save(const std::string& path) const;
+
+    // Loads a network saved with save
+    //
+    // Parameters :
+    // path : the file to read
+    // map : if true the file is mapped in memory and the weights point straight into the mapped pages,
+    //       nothing is read or copied until it is used. The mapping is private, training a mapped network
+    //       never changes the file. Otherwise the parameters are read into a new arena.
+    //
+    // Throws std::runtime_error if the file can't be read or is not a valid model file
+    static Network load(const std::string& path, bool map = true);
+
     // Forward pass through the network
     // Parameters :
-    // input : the input matrix, should be a column vector of size (input_size, 1)
-    // output : the output matrix, which is the result of the forward pass through the network, should be a column vector of size (output_size, 1)
-    Matrix forward(const Matrix& input);
+    // input : the input matrix, of size (input_size, n) : each column is a sample (n = 1 for a single column vector)
+    // output : the output matrix, which is the result of the forward pass through the network, of size (output_size, n),
+    //          kept by the plan until the next forward pass
+    const Matrix& forward(const Matrix& input);
+
+    // Turns the network into the execution plan that runs batches of batch_size samples (see plan.h) :
+    // activation layers fused into the layer before them, and every intermediate buffer allocated once,
+    // reusing memory that no later step reads. forward and train do it when the batch size changes,
+    // calling it ahead only moves the allocations out of the first batch, or shows what the plan looks like.
+    // The plan stays valid until the next call with another batch size
+    //
+    // Parameters :
+    // batch_size : number of samples of the batches
+    // training : the plan of train (which keeps what the backward pass needs) rather than the one of forward
+    //
+    // Throws std::invalid_argument if batch_size is 0
+    const ExecutionPlan& compile(size_t batch_size, bool training = true);
+
+    // Train the network on one batch : one forward pass, one backward pass and one step of the optimizer
+    // The gradient of the batch is the sum of the gradients of its samples, so a step on a batch of n samples
+    // is close to n steps on single samples with the same learning rate
+    // Parameters :
+    // inputs: the batch of inputs, of size (input_size, n)
+    // targets: the batch of targets, of size (output_size, n)
+    // output : the mean cost over the samples of the batch
+    //
+    // Throws std::invalid_argument if the sizes of inputs and targets do not match the network
+    double train(const Matrix& inputs, const Matrix& targets);
+
+    // The outputs of the network on the last batch it was trained on, before the step of the optimizer
+    // output : a matrix of size (output_size, n), kept until the next call to train
+    //
+    // Throws std::logic_error if the network was not trained yet
+    const Matrix& trainingOutput() const;
 
-    // Train the network using the provided inputs and targets
+    // Train the network using the provided inputs and targets, one sample at a time
     // Parameters :
     // inputs: vector of input matrices, each should be a column vector of size (input_size, 1)
     // targets: vector of target matrices, each should be a column vector of size (output_size, 1)
@@ -56,6 +168,32 @@ public:
     void train(const std::vector<Matrix>& inputs,
                const std::vector<Matrix>& targets,
                size_t epochs);
+
+    // The parameter and gradient arenas, for whole-model operations (optimizers, checkpoints, norms...)
+    // Both arenas have the same layout : for each layer with parameters, its weights then its biases
+    Arena& parameters() { return params; }
+    const Arena& parameters() const { return params; }
+    Arena& gradients() { return grads; }
+    const Arena& gradients() const { return grads; }
+
+    // Draws new random parameters for every layer from one generator (see Layer::initialize),
+    // the same seed always gives the same network
+    void initialize(uint32_t seed);
+
+    const std::vector<std::unique_ptr<Layer>>& getLayers() const { return layers; }
+    const std::vector<size_t>& getSizes() const { return sizes; }
+
+    // Replaces the optimizer used by train to update the parameters
+    //
+    // Parameters :
+    // opt : the new optimizer, it must not be null
+    //
+    // Throws std::invalid_argument if opt is null
+    void setOptimizer(std::unique_ptr<Optimizer> opt);
+    Optimizer& getOptimizer() { return *optimizer; }
+
+    // Returns the L2 norm of the gradients computed by the last backward pass
+    double gradientNorm() const;
 };
 
 
@@ -0,0 +1,194 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "optimizer.h"
+#include <cmath>
+#include <stdexcept>
+
+// Allocates a moment buffer the first time an optimizer sees the parameters
+static void allocate(Arena& buffer, size_t n) {
+    if (buffer.size() != n) {
+        buffer = Arena(n);
+    }
+}
+
+// Same as above, and checks the sizes of the arenas given to step
+static void prepare(Arena& buffer, const Arena& params, const Arena& grads) {
+    if (params.size() != grads.size()) {
+        throw std::invalid_argument("Parameters and gradients must have the same size");
+    }
+    allocate(buffer, params.size());
+}
+
+SGD::SGD(double learning_rate, double momentum, bool nesterov)
+    : Optimizer(learning_rate), momentum(momentum), nesterov(nesterov)
+{
+}
+
+std::string SGD::name() const {
+    if (momentum == 0.0) {
+        return "sgd";
+    }
+    return nesterov ? "nesterov" : "momentum";
+}
+
+void SGD::step(Arena& params, const Arena& grads) {
+    ++steps;
+    if (momentum == 0.0) {
+        // Plain SGD needs no state
+        params.axpy(-learning_rate, grads);
+        return;
+    }
+
+    prepare(velocity, params, grads);
+
+    double* __restrict w = params.data();
+    const double* __restrict g = grads.data();
+    double* __restrict vel = velocity.data();
+    const size_t n = params.size();
+    const double lr = learning_rate;
+    const double mu = momentum;
+
+    // The branch is outside the loops so each of them stays a straight vectorizable pass
+    if (nesterov) {
+        for (size_t i = 0; i < n; ++i) {
+            double vi = mu * vel[i] + g[i];
+            vel[i] = vi;
+            w[i] -= lr * (g[i] + mu * vi);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            double vi = mu * vel[i] + g[i];
+            vel[i] = vi;
+            w[i] -= lr * vi;
+        }
+    }
+}
+
+std::vector<Arena*> SGD::stateBuffers(size_t n) {
+    if (momentum == 0.0) {
+        return {};
+    }
+    allocate(velocity, n);
+    return {&velocity};
+}
+
+OpCost SGD::stepCost(size_t n) const {
+    const double count = static_cast<double>(n);
+    // The weights are read and written and the gradients read, plus the velocity read and written
+    if (momentum == 0.0) {
+        return {2.0 * count, 24.0 * count};
+    }
+    return {(nesterov ? 6.0 : 4.0) * count, 40.0 * count};
+}
+
+RMSProp::RMSProp(double learning_rate, double decay, double epsilon)
+    : Optimizer(learning_rate), decay(decay), epsilon(epsilon)
+{
+}
+
+void RMSProp::step(Arena& params, const Arena& grads) {
+    prepare(square_avg, params, grads);
+    ++steps;
+
+    double* __restrict w = params.data();
+    const double* __restrict g = grads.data();
+    double* __restrict s = square_avg.data();
+    const size_t n = params.size();
+    const double lr = learning_rate;
+    const double rho = decay;
+    const double eps = epsilon;
+
+    for (size_t i = 0; i < n; ++i) {
+        double si = rho * s[i] + (1.0 - rho) * g[i] * g[i];
+        s[i] = si;
+        w[i] -= lr * g[i] / (std::sqrt(si) + eps);
+    }
+}
+
+std::vector<Arena*> RMSProp::stateBuffers(size_t n) {
+    allocate(square_avg, n);
+    return {&square_avg};
+}
+
+OpCost RMSProp::stepCost(size_t n) const {
+    const double count = static_cast<double>(n);
+    return {9.0 * count, 40.0 * count};
+}
+
+Adam::Adam(double learning_rate, double beta1, double beta2, double epsilon, double weight_decay, bool decoupled)
+    : Optimizer(learning_rate), beta1(beta1), beta2(beta2), epsilon(epsilon),
+      weight_decay(weight_decay), decoupled(decoupled)
+{
+}
+
+void Adam::step(Arena& params, const Arena& grads) {
+    prepare(m, params, grads);
+    prepare(v, params, grads);
+    ++steps;
+
+    double* __restrict w = params.data();
+    const double* __restrict g = grads.data();
+    double* __restrict ms = m.data();
+    double* __restrict vs = v.data();
+    const size_t n = params.size();
+    const double b1 = beta1;
+    const double b2 = beta2;
+    const double eps = epsilon;
+
+    // The bias corrections only depend on the step count t, they are folded into the step size and epsilon once per step
+    // lr * m_hat / (sqrt(v_hat) + eps) == step_size * m / (sqrt(v) + eps_hat)
+    const double t = static_cast<double>(steps);
+    const double correction1 = 1.0 - std::pow(b1, t);
+    const double correction2 = std::sqrt(1.0 - std::pow(b2, t));
+    const double step_size = learning_rate * correction2 / correction1;
+    const double eps_hat = eps * correction2;
+
+    // L2 regularization adds the decay to the gradient, decoupled decay shrinks the weights directly
+    const double l2 = decoupled ? 0.0 : weight_decay;
+    const double shrink = decoupled ? 1.0 - learning_rate * weight_decay : 1.0;
+
+    for (size_t i = 0; i < n; ++i) {
+        double gi = g[i] + l2 * w[i];
+        double mi = b1 * ms[i] + (1.0 - b1) * gi;
+        double vi = b2 * vs[i] + (1.0 - b2) * gi * gi;
+        ms[i] = mi;
+        vs[i] = vi;
+        w[i] = shrink * w[i] - step_size * mi / (std::sqrt(vi) + eps_hat);
+    }
+}
+
+std::vector<Arena*> Adam::stateBuffers(size_t n) {
+    allocate(m, n);
+    allocate(v, n);
+    return {&m, &v};
+}
+
+OpCost Adam::stepCost(size_t n) const {
+    const double count = static_cast<double>(n);
+    // The weights, the gradients and both moments, the square root and the division counted as one operation each
+    return {14.0 * count, 56.0 * count};
+}
+
+std::unique_ptr<Optimizer> makeOptimizer(const std::string& name, double learning_rate) {
+    if (name == "sgd") {
+        return std::make_unique<SGD>(learning_rate);
+    }
+    if (name == "momentum") {
+        return std::make_unique<SGD>(learning_rate, 0.9);
+    }
+    if (name == "nesterov") {
+        return std::make_unique<SGD>(learning_rate, 0.9, true);
+    }
+    if (name == "rmsprop") {
+        return std::make_unique<RMSProp>(learning_rate);
+    }
+    if (name == "adam") {
+        return std::make_unique<Adam>(learning_rate);
+    }
+    if (name == "adamw") {
+        return std::make_unique<AdamW>(learning_rate);
+    }
+    throw std::invalid_argument("Unknown optimizer : " + name);
+}
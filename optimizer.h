@@ -0,0 +1,139 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the optimizers used by the Network to update its parameters from their gradients :
+// SGD (with momentum and Nesterov momentum), RMSProp, Adam and AdamW.
+// Each optimizer works on the whole parameter arena at once (see arena.h), and each step is a single
+// pass over the parameters, the gradients and the moment buffers, written so the compiler vectorizes it.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "profiler.h"
+
+class Optimizer {
+protected:
+    double learning_rate;
+    // Number of steps done so far, every step increments it
+    uint64_t steps;
+
+public:
+    explicit Optimizer(double learning_rate) : learning_rate(learning_rate), steps(0) {}
+    virtual ~Optimizer() = default;
+
+    // Updates the parameters using their gradients
+    // The moment buffers of the optimizer are allocated on the first step, with the size of the parameters
+    //
+    // Parameters :
+    // params : the parameter arena of the network
+    // grads : the gradient arena of the network, same size as params
+    //
+    // Throws std::invalid_argument if the arenas do not have the same size
+    virtual void step(Arena& params, const Arena& grads) = 0;
+
+    // Name of the optimizer, as accepted by makeOptimizer
+    virtual std::string name() const = 0;
+
+    double getLearningRate() const { return learning_rate; }
+    void setLearningRate(double lr) { learning_rate = lr; }
+
+    uint64_t getSteps() const { return steps; }
+    void setSteps(uint64_t s) { steps = s; }
+
+    // The moment buffers of the optimizer, so they can be saved in a checkpoint and restored
+    // They are allocated (set to zero) for n parameters if the optimizer did not do any step yet
+    //
+    // Parameters :
+    // n : the number of parameters of the network
+    virtual std::vector<Arena*> stateBuffers(size_t) { return {}; }
+
+    // The work of a step on n parameters, for the profiler (see profiler.h), nothing when it is not known
+    virtual OpCost stepCost(size_t) const { return {}; }
+};
+
+// Stochastic gradient descent, with optional (Nesterov) momentum
+// v = momentum * v + g
+// w = w - lr * v                         (classic momentum)
+// w = w - lr * (g + momentum * v)        (Nesterov momentum)
+class SGD : public Optimizer {
+private:
+    double momentum;
+    bool nesterov;
+    Arena velocity;
+
+public:
+    explicit SGD(double learning_rate, double momentum = 0.0, bool nesterov = false);
+    void step(Arena& params, const Arena& grads) override;
+    std::string name() const override;
+    std::vector<Arena*> stateBuffers(size_t n) override;
+    OpCost stepCost(size_t n) const override;
+};
+
+// RMSProp : the gradient is divided by a running average of its magnitude
+// s = decay * s + (1 - decay) * g^2
+// w = w - lr * g / (sqrt(s) + epsilon)
+class RMSProp : public Optimizer {
+private:
+    double decay;
+    double epsilon;
+    Arena square_avg;
+
+public:
+    explicit RMSProp(double learning_rate, double decay = 0.9, double epsilon = 1e-8);
+    void step(Arena& params, const Arena& grads) override;
+    std::string name() const override { return "rmsprop"; }
+    std::vector<Arena*> stateBuffers(size_t n) override;
+    OpCost stepCost(size_t n) const override;
+};
+
+// Adam : running averages of the gradient and of its square, with bias correction
+// m = beta1 * m + (1 - beta1) * g
+// v = beta2 * v + (1 - beta2) * g^2
+// w = w - lr * (m / (1 - beta1^t)) / (sqrt(v / (1 - beta2^t)) + epsilon)
+//
+// With decoupled weight decay (AdamW), the weights also shrink by lr * weight_decay * w at each step
+// instead of having the decay added to the gradient.
+class Adam : public Optimizer {
+private:
+    double beta1;
+    double beta2;
+    double epsilon;
+    double weight_decay;
+    bool decoupled;
+    Arena m;
+    Arena v;
+
+public:
+    explicit Adam(double learning_rate, double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8,
+                  double weight_decay = 0.0, bool decoupled = false);
+    void step(Arena& params, const Arena& grads) override;
+    std::string name() const override { return decoupled ? "adamw" : "adam"; }
+    std::vector<Arena*> stateBuffers(size_t n) override;
+    OpCost stepCost(size_t n) const override;
+};
+
+// AdamW is Adam with decoupled weight decay
+class AdamW : public Adam {
+public:
+    explicit AdamW(double learning_rate, double weight_decay = 0.01, double beta1 = 0.9, double beta2 = 0.999,
+                   double epsilon = 1e-8)
+        : Adam(learning_rate, beta1, beta2, epsilon, weight_decay, true) {}
+};
+
+// Creates an optimizer from its name, with default hyperparameters
+//
+// Parameters :
+// name : one of "sgd", "momentum", "nesterov", "rmsprop", "adam", "adamw"
+// learning_rate : the learning rate of the optimizer
+//
+// Throws std::invalid_argument if the name is unknown
+std::unique_ptr<Optimizer> makeOptimizer(const std::string& name, double learning_rate);
+
+#endif //OPTIMIZER_H
@@ -0,0 +1,171 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "perf_counters.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+
+// The type and the config of every counter, in the order of Counter
+struct EventConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+constexpr EventConfig events[counter_count] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int openEvent(const EventConfig& event, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    // The group starts counting as a whole, when its leader is enabled
+    attr.disabled = group < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED
+                       | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+std::string openError(int error) {
+    switch (error) {
+        case ENOENT:
+        case EOPNOTSUPP:
+            return "the processor (or the virtual machine) does not expose hardware counters";
+        case EACCES:
+        case EPERM:
+            return "not allowed to read them, see /proc/sys/kernel/perf_event_paranoid";
+        case ENOSYS:
+            return "the kernel has no perf events";
+        default:
+            return std::strerror(error);
+    }
+}
+
+#endif
+
+}
+
+CounterValues CounterValues::operator+(const CounterValues& other) const {
+    CounterValues sum;
+    for (size_t c = 0; c < counter_count; ++c) {
+        sum.counted[c] = counted[c] && other.counted[c];
+        sum.values[c] = sum.counted[c] ? values[c] + other.values[c] : 0.0;
+    }
+    return sum;
+}
+
+CounterValues CounterValues::operator-(const CounterValues& start) const {
+    CounterValues delta;
+    for (size_t c = 0; c < counter_count; ++c) {
+        delta.counted[c] = counted[c] && start.counted[c];
+        delta.values[c] = delta.counted[c] ? values[c] - start.values[c] : 0.0;
+    }
+    return delta;
+}
+
+PerfCounters::PerfCounters() {
+    fds.fill(-1);
+    const char* setting = std::getenv("DUMBRONS_COUNTERS");
+    if (setting && std::strcmp(setting, "0") == 0) {
+        reason = "turned off by DUMBRONS_COUNTERS=0";
+        return;
+    }
+#ifdef __linux__
+    fds[Cycles] = openEvent(events[Cycles], -1);
+    if (fds[Cycles] < 0) {
+        reason = openError(errno);
+        return;
+    }
+    for (size_t c = Cycles + 1; c < counter_count; ++c) {
+        fds[c] = openEvent(events[c], fds[Cycles]);
+    }
+    if (fds[Instructions] < 0) {
+        reason = "the instructions can't be counted";
+    }
+    for (size_t c = 0; c < counter_count; ++c) {
+        if (fds[c] >= 0 && ioctl(fds[c], PERF_EVENT_IOC_ID, &ids[c]) != 0) {
+            close(fds[c]);
+            fds[c] = -1;
+        }
+    }
+    ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    reason = "hardware counters are only read on Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+PerfCounters& PerfCounters::local() {
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+CounterValues PerfCounters::read() const {
+    CounterValues result;
+#ifdef __linux__
+    if (fds[Cycles] < 0) {
+        return result;
+    }
+    // The group is read at once : the number of values, the times it was enabled and running, then (value, id) pairs
+    uint64_t buffer[3 + 2 * counter_count];
+    ssize_t got = ::read(fds[Cycles], buffer, sizeof(buffer));
+    if (got < static_cast<ssize_t>(3 * sizeof(uint64_t)) || buffer[2] == 0) {
+        return result;
+    }
+    const double scale = static_cast<double>(buffer[1]) / static_cast<double>(buffer[2]);
+    const size_t values = std::min<size_t>(buffer[0], counter_count);
+    for (size_t v = 0; v < values; ++v) {
+        for (size_t c = 0; c < counter_count; ++c) {
+            if (fds[c] >= 0 && ids[c] == buffer[4 + 2 * v]) {
+                result.values[c] = static_cast<double>(buffer[3 + 2 * v]) * scale;
+                result.counted[c] = true;
+            }
+        }
+    }
+#endif
+    return result;
+}
+
+std::string PerfCounters::name(size_t counter) {
+    switch (counter) {
+        case Cycles: return "cycles";
+        case Instructions: return "instructions";
+        case L1Misses: return "L1 misses";
+        case LLCMisses: return "LLC misses";
+        case BranchMisses: return "branch misses";
+        default: return "unknown";
+    }
+}
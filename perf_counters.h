@@ -0,0 +1,78 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides PerfCounters : the hardware counters of the processor (cycles, instructions, L1 data cache misses,
+// last level cache misses and branch misses) for the calling thread, read through Linux perf_event_open.
+// The profiler reads them around every layer phase and every GEMM (see profiler.h) to tell a kernel that waits
+// for memory (low IPC, many misses) from one that is limited by its arithmetic.
+//
+// Counters are often not there : in a container or a virtual machine that does not expose them, when
+// /proc/sys/kernel/perf_event_paranoid forbids them, or on another system than Linux. Nothing fails then,
+// available() is false and unavailableReason() tells why. They can also be turned off with DUMBRONS_COUNTERS=0
+// in the environment, since every read is a system call.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// The events counted, in the order of CounterValues
+enum Counter : size_t {
+    Cycles = 0,
+    Instructions = 1,
+    L1Misses = 2,
+    LLCMisses = 3,
+    BranchMisses = 4,
+    counter_count = 5
+};
+
+// Values of the counters, and which of them are counted (a processor may not have all of them)
+// When the processor has more events to count than counters, the kernel takes turns between them and the
+// values are scaled to the whole time, so they are estimates
+struct CounterValues {
+    std::array<double, counter_count> values{};
+    std::array<bool, counter_count> counted{};
+
+    // The difference between two readings, only the counters counted by both are kept
+    CounterValues operator-(const CounterValues& start) const;
+
+    // The sum of the readings of two threads, only the counters counted by both are kept
+    CounterValues operator+(const CounterValues& other) const;
+};
+
+class PerfCounters {
+private:
+    std::array<int, counter_count> fds;
+    std::array<uint64_t, counter_count> ids{};
+    std::string reason;
+
+public:
+    // Opens the counters of the calling thread, they count its user space code from now on
+    // Never throws : the counters that can't be opened are not counted
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // The counters of the calling thread, opened the first time it asks for them
+    static PerfCounters& local();
+
+    // Whether the cycles and the instructions are counted, the other counters may still be missing
+    bool available() const { return fds[Cycles] >= 0 && fds[Instructions] >= 0; }
+
+    // Why the counters are not available, empty if they are
+    const std::string& unavailableReason() const { return reason; }
+
+    // The values of the counters since they were opened, nothing counted if they are not available
+    CounterValues read() const;
+
+    // Name of a counter, as printed in the summaries
+    static std::string name(size_t counter);
+};
+
+#endif //PERF_COUNTERS_H
@@ -0,0 +1,227 @@
+//
+// This file is part of a simple neural network library for C++.
+// It runs the performance regression tests : a few benchmarks (see benchmark.h) that cover the kernels,
+// one layer step and one epoch, compared against the results stored for this machine.
+// A test fails when a benchmark is slower than its baseline by more than the tolerance, and is skipped
+// when the machine has no baseline yet. The baseline is written with --update (the perf_baseline target).
+//
+// Usage : perftest --baseline-dir <dir> [--filter <text>] [--tolerance <fraction>] [--update]
+// --baseline-dir <dir>    : where the baselines are, <dir>/<host name>.json for this machine
+// --filter <text>         : only runs the benchmarks whose name contains the text
+// --tolerance <fraction>  : how much slower than its baseline a benchmark may be, 0.2 (20%) by default
+// --update                : writes the results as the new baseline instead of comparing them,
+//                           the benchmarks the filter skips keep their previous baseline
+//
+// A benchmark slower than the tolerance is timed again, it fails if it is still slower after 3 attempts
+// Exit code : 0 if every benchmark is within the tolerance, 1 if one is slower, 77 if there is no baseline
+//
+// This file is released under the MIT License.
+//
+
+#include "benchmark.h"
+#include "dataset.h"
+#include "gemm.h"
+#include "network.h"
+#include "sampler.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+
+namespace {
+
+// The exit code ctest reads as a skipped test (see SKIP_RETURN_CODE in CMakeLists.txt)
+constexpr int skipped = 77;
+
+// Number of times a benchmark slower than its baseline is timed before the test fails
+constexpr int attempts = 3;
+
+struct PerfOptions {
+    std::string baseline_dir;
+    std::string filter;
+    double tolerance = 0.2;
+    bool update = false;
+};
+
+PerfOptions parseOptions(int argc, char** argv) {
+    PerfOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--baseline-dir") {
+            options.baseline_dir = value();
+        } else if (arg == "--filter") {
+            options.filter = value();
+        } else if (arg == "--tolerance") {
+            options.tolerance = std::stod(value());
+            if (options.tolerance < 0.0) {
+                throw std::invalid_argument("The tolerance must not be negative");
+            }
+        } else if (arg == "--update") {
+            options.update = true;
+        } else {
+            throw std::invalid_argument("Unknown option : " + arg);
+        }
+    }
+    if (options.baseline_dir.empty()) {
+        throw std::invalid_argument("Missing --baseline-dir");
+    }
+    return options;
+}
+
+Matrix randomMatrix(size_t rows, size_t cols, std::mt19937& rng) {
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    Matrix m(rows, cols);
+    for (size_t i = 0; i < m.size(); ++i) {
+        m.data()[i] = dist(rng);
+    }
+    return m;
+}
+
+void runBenchmarks(Benchmark& bench) {
+    std::mt19937 rng(42);
+    const size_t batch = 32;
+
+    // The product of the forward pass of the first layer of the mlp, and a square one
+    {
+        Matrix w = randomMatrix(128, 784, rng);
+        Matrix x = randomMatrix(784, batch, rng);
+        Matrix y(128, batch);
+        bench.run("gemm/dense/NN/128x32x784", 2.0 * 128 * batch * 784, 0.0, [&] {
+            gemm(false, false, 128, batch, 784, 1.0, w.data(), 784, x.data(), batch, 0.0, y.data(), batch);
+        });
+        Matrix a = randomMatrix(256, 256, rng);
+        Matrix b = randomMatrix(256, 256, rng);
+        Matrix c(256, 256);
+        bench.run("gemm/square/NN/256x256x256", 2.0 * 256 * 256 * 256, 0.0, [&] {
+            gemm(false, false, 256, 256, 256, 1.0, a.data(), 256, b.data(), 256, 0.0, c.data(), 256);
+        });
+    }
+
+    // A forward and a backward pass of single layers
+    for (const auto& [name, spec] : {std::pair{"dense/784x128", LayerSpec::dense(784, 128, Activation::Sigmoid)},
+                                     std::pair{"conv/8x14x14-16x5x5", LayerSpec::conv2d(8, 14, 14, 16, 5, 1, 2, Activation::ReLU)}}) {
+        std::unique_ptr<Layer> layer = makeLayer(spec);
+        Matrix input = randomMatrix(layer->inputSize(), batch, rng);
+        Matrix grad = randomMatrix(layer->outputSize(), batch, rng);
+        bench.run(std::string("layer/") + name + "/32/step", 0.0, 0.0, [&] {
+            layer->forward(input);
+            layer->backward(grad);
+        });
+    }
+
+    // An epoch of the mlp on a small synthetic dataset : gathering the batches and training on them
+    {
+        const size_t count = 1024;
+        Dataset data(count, 784);
+        std::uniform_int_distribution<int> pixel(0, 255);
+        for (size_t i = 0; i < count * 784; ++i) {
+            data.mutablePixelData()[i] = static_cast<uint8_t>(pixel(rng));
+        }
+        for (size_t i = 0; i < count; ++i) {
+            data.mutableLabelData()[i] = static_cast<uint8_t>(i % 10);
+        }
+        Network net({LayerSpec::dense(784, 128, Activation::Sigmoid),
+                     LayerSpec::dense(128, 64, Activation::Sigmoid),
+                     LayerSpec::dense(64, 10, Activation::ReLU)}, Cost::MSE, 1e-6);
+        net.initialize(42);
+        BatchSampler sampler(count, batch);
+        sampler.shuffle(rng);
+        Matrix inputs(784, batch);
+        Matrix targets(10, batch);
+        bench.run("epoch/mlp/1024", 0.0, 0.0, [&] {
+            for (size_t b = 0; b < sampler.numBatches(); ++b) {
+                data.gather(sampler.batch(b), batch, inputs);
+                data.gatherTargets(sampler.batch(b), batch, 10, targets);
+                net.train(inputs, targets);
+            }
+        });
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    PerfOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Erreur : " << e.what() << std::endl;
+        return 1;
+    }
+    const std::string baseline_path = options.baseline_dir + "/" + hostName() + ".json";
+
+    std::map<std::string, BenchmarkResult> baseline;
+    try {
+        for (const BenchmarkResult& result : Benchmark::readJson(baseline_path)) {
+            baseline[result.name] = result;
+        }
+    } catch (const std::exception& e) {
+        if (!options.update) {
+            std::cout << "No baseline for this machine (" << e.what() << "), build the perf_baseline target to record one\n";
+            return skipped;
+        }
+    }
+
+    // Every benchmark is timed for a second, the medians of the short ones are then stable enough to compare
+    Benchmark bench(options.filter, 0.2, 1.0, 20);
+    runBenchmarks(bench);
+    bench.print(std::cout);
+
+    if (options.update) {
+        for (const BenchmarkResult& result : bench.getResults()) {
+            baseline[result.name] = result;
+        }
+        std::vector<BenchmarkResult> results;
+        for (const auto& [name, result] : baseline) {
+            results.push_back(result);
+        }
+        try {
+            Benchmark::writeJson(baseline_path, results);
+        } catch (const std::exception& e) {
+            std::cerr << "Erreur : " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Baseline written to " << baseline_path << "\n";
+        return 0;
+    }
+
+    // The throughput is compared, so a benchmark fails when its median time is more than 1 / (1 - tolerance)
+    // times the one of its baseline. A benchmark that looks slower is timed again, a machine busy with something
+    // else for a moment does not fail the test, a real slowdown stays slow every time.
+    // Being much faster only asks for a new baseline
+    bool slower = false;
+    for (const BenchmarkResult& result : bench.getResults()) {
+        auto found = baseline.find(result.name);
+        if (found == baseline.end()) {
+            std::cout << result.name << " : no baseline, build the perf_baseline target to record one\n";
+            continue;
+        }
+        double median = result.median;
+        for (int attempt = 1; attempt < attempts && found->second.median / median < 1.0 - options.tolerance; ++attempt) {
+            Benchmark again(result.name, 0.2, 1.0, 20);
+            runBenchmarks(again);
+            median = std::min(median, again.getResults().front().median);
+        }
+        double throughput = found->second.median / median;
+        std::cout << result.name << " : " << std::fixed << std::setprecision(1) << throughput * 100.0
+                  << "% of the baseline throughput";
+        if (throughput < 1.0 - options.tolerance) {
+            std::cout << ", slower than the tolerance of " << options.tolerance * 100.0 << "% in " << attempts
+                      << " attempts\n";
+            slower = true;
+        } else if (throughput > 1.0 + options.tolerance) {
+            std::cout << ", faster than the baseline, consider refreshing it\n";
+        } else {
+            std::cout << "\n";
+        }
+    }
+    return slower ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "plan.h"
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+// A buffer of the plan : its number of doubles, the first step that writes it and the last one that reads it,
+// and the slab of memory it was given
+struct Lifetime {
+    size_t size;
+    size_t first;
+    size_t last;
+    size_t slab;
+};
+
+constexpr size_t forever = std::numeric_limits<size_t>::max();
+
+// Gives every buffer a slab, in the order they are written. A slab is free for a buffer once the last step
+// of the buffer in it is before the first step of the new one (a step never reads and writes the same memory).
+// Among the free slabs the smallest one that is large enough is taken, otherwise the largest one is grown.
+// output : the size of each slab
+std::vector<size_t> assignSlabs(std::vector<Lifetime>& buffers) {
+    std::vector<size_t> order(buffers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buffers[a].first < buffers[b].first; });
+
+    std::vector<size_t> slab_size;
+    std::vector<size_t> free_after;
+    for (size_t i : order) {
+        Lifetime& buffer = buffers[i];
+        size_t best = forever;
+        for (size_t s = 0; s < slab_size.size(); ++s) {
+            if (free_after[s] >= buffer.first) {
+                continue;
+            }
+            if (best == forever) {
+                best = s;
+                continue;
+            }
+            bool fits = slab_size[s] >= buffer.size;
+            bool best_fits = slab_size[best] >= buffer.size;
+            if ((fits && (!best_fits || slab_size[s] < slab_size[best]))
+                || (!fits && !best_fits && slab_size[s] > slab_size[best])) {
+                best = s;
+            }
+        }
+        if (best == forever) {
+            best = slab_size.size();
+            slab_size.push_back(0);
+            free_after.push_back(0);
+        }
+        slab_size[best] = std::max(slab_size[best], buffer.size);
+        free_after[best] = buffer.last;
+        buffer.slab = best;
+    }
+    return slab_size;
+}
+
+}
+
+ExecutionPlan::ExecutionPlan() : memory(0), batch_size(0), training(false), unplanned(0) {}
+
+ExecutionPlan::ExecutionPlan(const std::vector<std::unique_ptr<Layer>>& layers, size_t batch_size, bool training)
+    : memory(0), batch_size(batch_size), training(training), unplanned(0)
+{
+    if (layers.empty()) {
+        throw std::invalid_argument("A plan needs at least one layer");
+    }
+    if (batch_size == 0) {
+        throw std::invalid_argument("The batch size of a plan must be at least 1");
+    }
+
+    // Fusion : an activation layer right after a layer that can take its activation disappears into it
+    for (const std::unique_ptr<Layer>& layer : layers) {
+        layer->fuseActivation(Activation::Identity);
+    }
+    for (size_t i = 0; i < layers.size(); ++i) {
+        steps.push_back(layers[i].get());
+        names.push_back(layers[i]->describe());
+        if (i + 1 < layers.size()) {
+            LayerSpec next = layers[i + 1]->spec();
+            if (next.kind == LayerKind::Activation && layers[i]->fuseActivation(next.activation)) {
+                names.back() += " + " + activationName(next.activation);
+                ++i;
+            }
+        }
+    }
+    for (size_t s = 0; s < steps.size(); ++s) {
+        forward_costs.push_back(steps[s]->forwardCost(batch_size));
+        backward_costs.push_back(steps[s]->backwardCost(batch_size, s > 0));
+        trace_names.push_back(Tracer::instance().intern(names[s]));
+    }
+
+    // The lifetimes of the buffers, in steps of the timeline of a batch :
+    // forward of step s at time s, the gradient of the output at time S, backward of step s at time 2S - s
+    // The output of the network stays valid after forward returns, it is never reused
+    const size_t count = steps.size();
+    std::vector<Lifetime> buffers;
+    for (size_t s = 0; s < count; ++s) {
+        size_t last = s + 1;
+        if (s + 1 == count) {
+            last = forever;
+        } else if (training) {
+            if (steps[s]->keepsOutput()) {
+                last = std::max(last, 2 * count - s);
+            }
+            if (steps[s + 1]->keepsInput()) {
+                last = std::max(last, 2 * count - (s + 1));
+            }
+        }
+        buffers.push_back({steps[s]->outputSize() * batch_size, s, last, 0});
+    }
+    if (training) {
+        // The gradient of the input of step s, written by its backward pass, read by the one of step s - 1
+        for (size_t s = count; s >= 1; --s) {
+            size_t size = (s == count ? steps[s - 1]->outputSize() : steps[s]->inputSize()) * batch_size;
+            size_t first = s == count ? count : 2 * count - s;
+            buffers.push_back({size, first, first + 1, 0});
+        }
+    }
+
+    std::vector<size_t> slab_size = assignSlabs(buffers);
+    std::vector<size_t> slab_offset(slab_size.size());
+    size_t total = 0;
+    for (size_t s = 0; s < slab_size.size(); ++s) {
+        slab_offset[s] = total;
+        total += Arena::padded(slab_size[s]);
+    }
+    for (const Lifetime& buffer : buffers) {
+        unplanned += buffer.size;
+    }
+    memory = Arena(total);
+
+    values.push_back(Matrix(0, 0));
+    for (size_t s = 0; s < count; ++s) {
+        double* start = memory.data() + slab_offset[buffers[s].slab];
+        values.push_back(Matrix::view(start, steps[s]->outputSize(), batch_size));
+    }
+    if (training) {
+        grads.resize(count + 1, Matrix(0, 0));
+        for (size_t s = count; s >= 1; --s) {
+            const Lifetime& buffer = buffers[count + (count - s)];
+            double* start = memory.data() + slab_offset[buffer.slab];
+            Matrix view = Matrix::view(start, buffer.size / batch_size, batch_size);
+            grads[s].swap(view);
+        }
+    }
+}
+
+const Matrix& ExecutionPlan::forward(const Matrix& input) {
+    if (steps.empty() || input.numCols() != batch_size) {
+        throw std::invalid_argument("The input must be a batch of " + std::to_string(batch_size) + " samples");
+    }
+
+    const Matrix* x = &input;
+    for (size_t s = 0; s < steps.size(); ++s) {
+        PROFILE_SCOPE(steps[s], names[s], training ? ProfilePhase::Forward : ProfilePhase::Inference, forward_costs[s]);
+        TRACE_SCOPE(training ? "forward" : "inference", trace_names[s]);
+        steps[s]->forwardInto(*x, values[s + 1]);
+        x = &values[s + 1];
+    }
+    return *x;
+}
+
+const Matrix& ExecutionPlan::output() const {
+    if (steps.empty()) {
+        throw std::logic_error("An empty plan has no output");
+    }
+    return values.back();
+}
+
+Matrix& ExecutionPlan::outputGradient() {
+    if (!training) {
+        throw std::logic_error("Only a training plan runs backward passes");
+    }
+    return grads.back();
+}
+
+void ExecutionPlan::backward() {
+    if (!training) {
+        throw std::logic_error("Only a training plan runs backward passes");
+    }
+    for (size_t s = steps.size(); s-- > 0;) {
+        PROFILE_SCOPE(steps[s], names[s], ProfilePhase::Backward, backward_costs[s]);
+        TRACE_SCOPE("backward", trace_names[s]);
+        steps[s]->backwardInto(grads[s + 1], s == 0 ? nullptr : &grads[s]);
+    }
+}
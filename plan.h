@@ -0,0 +1,98 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides an ExecutionPlan, what a Network is turned into to run batches of a given size :
+// - every activation layer that follows a Dense or a Conv2D is fused into it, the pair becomes one step
+// - every intermediate result (outputs of the steps, and their gradients when training) gets its buffer once,
+//   in one arena, and a buffer is reused as soon as no later step reads the one that was in it
+// Running the plan is then a flat loop over the steps, each writing into its buffer, with nothing allocated.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "layer.h"
+#include "trace.h"
+
+class ExecutionPlan {
+private:
+    // The layer each step runs, a fused activation layer has no step of its own
+    std::vector<Layer*> steps;
+
+    // For the profiler (see profiler.h) : what each step is ("dense 784x128 + sigmoid" for a fused
+    // activation), and the work of its forward and backward passes on a batch of the plan
+    std::vector<std::string> names;
+    std::vector<OpCost> forward_costs;
+    std::vector<OpCost> backward_costs;
+
+    // The names of the steps for the tracer (see trace.h), which keeps them after the plan is gone
+    std::vector<const char*> trace_names;
+
+    // values[s + 1] is the output of step s, grads[s] the gradient of the loss with respect to the input of step s
+    // (grads[steps.size()] with respect to the output of the network). They are views into memory.
+    // values[0] and grads[0] are never used : the input belongs to the caller, and nobody needs its gradient
+    std::vector<Matrix> values;
+    std::vector<Matrix> grads;
+    Arena memory;
+
+    size_t batch_size;
+    bool training;
+    size_t unplanned;
+
+public:
+    // An empty plan, for no batch size
+    ExecutionPlan();
+
+    // Builds the plan of a list of layers
+    // The layers are told which activations they take (see Layer::fuseActivation), the plan keeps pointers to them
+    //
+    // Parameters :
+    // layers : the layers of the network, from the input to the output, they must outlive the plan
+    // batch_size : number of samples of the batches the plan runs
+    // training : if true the plan also runs backward passes, the buffers backward reads are then kept alive
+    //            until it is done with them, so less memory is reused
+    //
+    // Throws std::invalid_argument if there is no layer or batch_size is 0
+    ExecutionPlan(const std::vector<std::unique_ptr<Layer>>& layers, size_t batch_size, bool training);
+
+    size_t batchSize() const { return batch_size; }
+    bool isTraining() const { return training; }
+    size_t numSteps() const { return steps.size(); }
+    const std::string& stepName(size_t s) const { return names.at(s); }
+
+    // Number of doubles of the buffers of the plan, and the number it would take without any reuse
+    size_t memorySize() const { return memory.size(); }
+    size_t unplannedSize() const { return unplanned; }
+
+    // Runs the forward pass of every step
+    //
+    // Parameters :
+    // input : the batch, of size (input size of the network, batchSize()), it must stay alive until backward
+    // output : the output of the network, kept by the plan until the next forward pass
+    //
+    // Throws std::invalid_argument if the input is not of the size of the plan
+    const Matrix& forward(const Matrix& input);
+
+    // The output of the network of the last forward pass, it stays there through the backward pass
+    //
+    // Throws std::logic_error if the plan has no step
+    const Matrix& output() const;
+
+    // Where the gradient of the loss with respect to the output of the network goes, before calling backward
+    //
+    // Throws std::logic_error if the plan is not a training plan
+    Matrix& outputGradient();
+
+    // Runs the backward pass of every step, from the output to the input, for the last forward pass
+    // Each layer leaves the gradients of its parameters where it was bound (see Layer::bind)
+    //
+    // Throws std::logic_error if the plan is not a training plan
+    void backward();
+};
+
+#endif //PLAN_H
@@ -0,0 +1,176 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+Pool2D::Pool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride)
+    : channels(channels), height(height), width(width), window(window), stride(stride),
+      out_height(0), out_width(0), batch(0)
+{
+    if (channels == 0 || height == 0 || width == 0 || window == 0 || stride == 0) {
+        throw std::invalid_argument("The sizes of a pooling layer must not be 0");
+    }
+    if (window > height || window > width) {
+        throw std::invalid_argument("The window of a pooling layer must fit in the images");
+    }
+    out_height = (height - window) / stride + 1;
+    out_width = (width - window) / stride + 1;
+}
+
+void Pool2D::prepare(const Matrix& input, const Matrix& output) {
+    checkForward(input, output);
+    batch = input.numCols();
+}
+
+void Pool2D::prepareBackward(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    checkBackward(dLoss_dOutput, dLoss_dInput, batch);
+    if (dLoss_dInput) {
+        std::fill(dLoss_dInput->data(), dLoss_dInput->data() + dLoss_dInput->size(), 0.0);
+    }
+}
+
+OpCost Pool2D::forwardCost(size_t n) const {
+    return {static_cast<double>(outputSize() * window * window * n), 8.0 * (inputSize() + outputSize()) * n};
+}
+
+OpCost Pool2D::backwardCost(size_t n, bool input_gradient) const {
+    if (!input_gradient) {
+        return {};
+    }
+    // dLoss/dInput is set to zero, then every output adds to its window
+    return {static_cast<double>(outputSize() * window * window * n), 8.0 * (2 * inputSize() + outputSize()) * n};
+}
+
+MaxPool2D::MaxPool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride)
+    : Pool2D(channels, height, width, window, stride) {}
+
+void MaxPool2D::forwardInto(const Matrix& input, Matrix& output) {
+    prepare(input, output);
+    const size_t n = input.numCols();
+    sources.resize(output.size());
+
+    // Each output row starts as the first row of its window, the other rows of the window replace
+    // the samples they are larger for
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t oy = 0; oy < out_height; ++oy) {
+            for (size_t ox = 0; ox < out_width; ++ox) {
+                const size_t o = (c * out_height + oy) * out_width + ox;
+                double* out = output.data() + o * n;
+                uint32_t* source = sources.data() + o * n;
+                const size_t first = (c * height + oy * stride) * width + ox * stride;
+                std::copy(input.data() + first * n, input.data() + (first + 1) * n, out);
+                std::fill(source, source + n, static_cast<uint32_t>(first));
+
+                for (size_t ky = 0; ky < window; ++ky) {
+                    for (size_t kx = 0; kx < window; ++kx) {
+                        const size_t r = first + ky * width + kx;
+                        const double* in = input.data() + r * n;
+                        for (size_t j = 0; j < n; ++j) {
+                            if (in[j] > out[j]) {
+                                out[j] = in[j];
+                                source[j] = static_cast<uint32_t>(r);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MaxPool2D::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    // Only the input that was the maximum of a window gets its gradient
+    prepareBackward(dLoss_dOutput, dLoss_dInput);
+    if (!dLoss_dInput) {
+        return;
+    }
+    const size_t n = batch;
+    const double* grad = dLoss_dOutput.data();
+    double* in_grad = dLoss_dInput->data();
+    for (size_t o = 0; o < outputSize(); ++o) {
+        for (size_t j = 0; j < n; ++j) {
+            in_grad[sources[o * n + j] * n + j] += grad[o * n + j];
+        }
+    }
+}
+
+OpCost MaxPool2D::forwardCost(size_t n) const {
+    OpCost cost = Pool2D::forwardCost(n);
+    cost.bytes += 4.0 * outputSize() * n;
+    return cost;
+}
+
+OpCost MaxPool2D::backwardCost(size_t n, bool input_gradient) const {
+    if (!input_gradient) {
+        return {};
+    }
+    return {static_cast<double>(outputSize() * n), (8.0 * (2 * inputSize() + outputSize()) + 4.0 * outputSize()) * n};
+}
+
+LayerSpec MaxPool2D::spec() const {
+    return LayerSpec::maxPool2d(channels, height, width, window, stride);
+}
+
+AvgPool2D::AvgPool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride)
+    : Pool2D(channels, height, width, window, stride) {}
+
+void AvgPool2D::forwardInto(const Matrix& input, Matrix& output) {
+    prepare(input, output);
+    const size_t n = input.numCols();
+    const double scale = 1.0 / static_cast<double>(window * window);
+
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t oy = 0; oy < out_height; ++oy) {
+            for (size_t ox = 0; ox < out_width; ++ox) {
+                double* out = output.data() + ((c * out_height + oy) * out_width + ox) * n;
+                const size_t first = (c * height + oy * stride) * width + ox * stride;
+                std::fill(out, out + n, 0.0);
+                for (size_t ky = 0; ky < window; ++ky) {
+                    for (size_t kx = 0; kx < window; ++kx) {
+                        const double* in = input.data() + (first + ky * width + kx) * n;
+                        for (size_t j = 0; j < n; ++j) {
+                            out[j] += in[j];
+                        }
+                    }
+                }
+                for (size_t j = 0; j < n; ++j) {
+                    out[j] *= scale;
+                }
+            }
+        }
+    }
+}
+
+void AvgPool2D::backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) {
+    // Every input of a window gets an equal share of the gradient of its output
+    prepareBackward(dLoss_dOutput, dLoss_dInput);
+    if (!dLoss_dInput) {
+        return;
+    }
+    const size_t n = batch;
+    const double scale = 1.0 / static_cast<double>(window * window);
+
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t oy = 0; oy < out_height; ++oy) {
+            for (size_t ox = 0; ox < out_width; ++ox) {
+                const double* grad = dLoss_dOutput.data() + ((c * out_height + oy) * out_width + ox) * n;
+                const size_t first = (c * height + oy * stride) * width + ox * stride;
+                for (size_t ky = 0; ky < window; ++ky) {
+                    for (size_t kx = 0; kx < window; ++kx) {
+                        double* in_grad = dLoss_dInput->data() + (first + ky * width + kx) * n;
+                        for (size_t j = 0; j < n; ++j) {
+                            in_grad[j] += scale * grad[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+LayerSpec AvgPool2D::spec() const {
+    return LayerSpec::avgPool2d(channels, height, width, window, stride);
+}
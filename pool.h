@@ -0,0 +1,83 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the pooling layers MaxPool2D and AvgPool2D, which shrink images by keeping the largest value
+// or the mean of every window, channel by channel. They have no parameters.
+// A pixel of every sample of a batch is a contiguous row of the input, so both work on whole rows at a time.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstdint>
+#include <vector>
+#include "layer.h"
+
+// What the two pooling layers share : the sizes of the images and of the windows
+// Neither keeps the input or the output of a forward pass for backward
+class Pool2D : public Layer {
+protected:
+    size_t channels;
+    size_t height;
+    size_t width;
+    size_t window;
+    size_t stride;
+    size_t out_height;
+    size_t out_width;
+
+    // Number of samples of the last forward pass
+    size_t batch;
+
+    // Checks the sizes of a forward pass and remembers its number of samples
+    void prepare(const Matrix& input, const Matrix& output);
+
+    // Checks the sizes of a backward pass and sets dLoss_dInput to zero
+    void prepareBackward(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput);
+
+public:
+    // Parameters :
+    // channels, height, width : the input images, a sample is a column of channels * height * width values
+    // window : size of the square window
+    // stride : number of pixels the window moves by, the window does not go over the edges of the images
+    //
+    // Throws std::invalid_argument if a size is 0 or the window is larger than the images
+    Pool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride);
+
+    size_t inputSize() const override { return channels * height * width; }
+    size_t outputSize() const override { return channels * out_height * out_width; }
+    size_t outputHeight() const { return out_height; }
+    size_t outputWidth() const { return out_width; }
+
+    // One operation per input of every window, forward and backward
+    OpCost forwardCost(size_t n) const override;
+    OpCost backwardCost(size_t n, bool input_gradient) const override;
+};
+
+class MaxPool2D : public Pool2D {
+private:
+    // For every output of every sample, the input row its maximum came from, where backward sends its gradient
+    std::vector<uint32_t> sources;
+
+public:
+    MaxPool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride);
+
+    void forwardInto(const Matrix& input, Matrix& output) override;
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+    LayerSpec spec() const override;
+
+    // The sources are written forward and read backward, backward only touches the maximum of each window
+    OpCost forwardCost(size_t n) const override;
+    OpCost backwardCost(size_t n, bool input_gradient) const override;
+};
+
+class AvgPool2D : public Pool2D {
+public:
+    AvgPool2D(size_t channels, size_t height, size_t width, size_t window, size_t stride);
+
+    void forwardInto(const Matrix& input, Matrix& output) override;
+    void backwardInto(const Matrix& dLoss_dOutput, Matrix* dLoss_dInput) override;
+    LayerSpec spec() const override;
+};
+
+#endif //POOL_H
@@ -0,0 +1,289 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "profiler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <numeric>
+
+namespace {
+
+// Heap allocations of each thread, counted by the operator new below
+thread_local uint64_t thread_allocations = 0;
+
+// Adds what a row recorded to a total, the calls are left as they are
+void addTo(ProfileRow& total, const ProfileRow& r) {
+    total.seconds += r.seconds;
+    total.flops += r.flops;
+    total.bytes += r.bytes;
+    total.allocations += r.allocations;
+    for (size_t c = 0; c < counter_count; ++c) {
+        total.counters.values[c] += r.counters.values[c];
+        total.counters.counted[c] = total.counters.counted[c] || r.counters.counted[c];
+    }
+}
+
+}
+
+#ifdef DUMBRONS_PROFILE
+
+// The global allocation functions are replaced to count the allocations, everything else is what the standard
+// library does : malloc, and aligned_alloc for the over-aligned types (the arenas)
+void* operator new(std::size_t size) {
+    ++thread_allocations;
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    ++thread_allocations;
+    // aligned_alloc wants a size that is a multiple of the alignment
+    const std::size_t alignment = static_cast<std::size_t>(align);
+    const std::size_t rounded = (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void* p = std::aligned_alloc(alignment, rounded)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+#endif
+
+Profiler::Profiler() {
+    // No task yet : every counter is counted, at 0
+    worker_counters.counted.fill(true);
+}
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::record(const void* key, const std::string& name, ProfilePhase phase, double seconds,
+                      const OpCost& cost, uint64_t allocations, const CounterValues* counters) {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t row = 0;
+    while (row < rows.size() && (keys[row] != key || rows[row].phase != phase)) {
+        ++row;
+    }
+    if (row == rows.size()) {
+        keys.push_back(key);
+        ProfileRow added;
+        added.name = name;
+        added.phase = phase;
+        rows.push_back(added);
+    }
+    ProfileRow& r = rows[row];
+    ++r.calls;
+    r.seconds += seconds;
+    r.flops += cost.flops;
+    r.bytes += cost.bytes;
+    r.allocations += allocations;
+    if (counters) {
+        for (size_t c = 0; c < counter_count; ++c) {
+            r.counters.values[c] += counters->values[c];
+            r.counters.counted[c] = r.counters.counted[c] || counters->counted[c];
+        }
+    }
+}
+
+std::vector<ProfileRow> Profiler::getRows() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return rows;
+}
+
+void Profiler::print(std::ostream& out, const std::string& title) const {
+    std::vector<ProfileRow> sorted = getRows();
+    if (sorted.empty()) {
+        return;
+    }
+    // By phase, and in the order they were first recorded within a phase : the order of the layers
+    std::stable_sort(sorted.begin(), sorted.end(), [](const ProfileRow& a, const ProfileRow& b) {
+        return a.phase < b.phase;
+    });
+    // The kernels run inside the layers, their time is not added again
+    const double total = std::accumulate(sorted.begin(), sorted.end(), 0.0, [](double sum, const ProfileRow& r) {
+        return r.phase == ProfilePhase::Kernel ? sum : sum + r.seconds;
+    });
+    const bool counted = std::any_of(sorted.begin(), sorted.end(), [](const ProfileRow& r) {
+        return r.counters.counted[Cycles] && r.counters.counted[Instructions];
+    });
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    auto line = [&](const std::string& name, const std::string& phase, const ProfileRow& r) {
+        out << std::left << std::setw(36) << name << std::setw(11) << phase << std::right << std::setw(8);
+        if (r.calls > 0) {
+            out << r.calls;
+        } else {
+            out << "-";
+        }
+        out << std::setw(11) << r.seconds * 1e3
+            << std::setw(8) << (total > 0.0 ? 100.0 * r.seconds / total : 0.0);
+        if (r.flops > 0.0 && r.seconds > 0.0) {
+            out << std::setw(10) << r.flops / r.seconds * 1e-9;
+        } else {
+            out << std::setw(10) << "-";
+        }
+        if (r.bytes > 0.0 && r.seconds > 0.0) {
+            out << std::setw(9) << r.bytes / r.seconds * 1e-9;
+        } else {
+            out << std::setw(9) << "-";
+        }
+        if (r.flops > 0.0 && r.bytes > 0.0) {
+            out << std::setw(9) << r.flops / r.bytes;
+        } else {
+            out << std::setw(9) << "-";
+        }
+        out << std::setw(10) << r.allocations;
+        if (counted) {
+            // IPC, then the misses per thousand instructions
+            const CounterValues& v = r.counters;
+            const double instructions = v.values[Instructions];
+            if (v.counted[Cycles] && v.counted[Instructions] && v.values[Cycles] > 0.0) {
+                out << std::setw(7) << instructions / v.values[Cycles];
+            } else {
+                out << std::setw(7) << "-";
+            }
+            for (size_t c : {L1Misses, LLCMisses, BranchMisses}) {
+                if (v.counted[c] && v.counted[Instructions] && instructions > 0.0) {
+                    out << std::setw(10) << 1000.0 * v.values[c] / instructions;
+                } else {
+                    out << std::setw(10) << "-";
+                }
+            }
+        }
+        out << "\n";
+    };
+
+    out << "Profile of " << title << "\n";
+    out << std::left << std::setw(36) << "layer" << std::setw(11) << "phase" << std::right
+        << std::setw(8) << "calls" << std::setw(11) << "ms" << std::setw(8) << "time %"
+        << std::setw(10) << "GFLOP/s" << std::setw(9) << "GB/s" << std::setw(9) << "FLOP/B"
+        << std::setw(10) << "allocs";
+    if (counted) {
+        out << std::setw(7) << "IPC" << std::setw(10) << "L1 MPKI" << std::setw(10) << "LLC MPKI"
+            << std::setw(10) << "br MPKI";
+    }
+    out << "\n";
+    out << std::fixed << std::setprecision(2);
+    for (const ProfileRow& r : sorted) {
+        line(r.name, phaseName(r.phase), r);
+    }
+
+    // The totals of the phases, the calls of a phase are the ones of its first row (once per step), except for the kernels
+    ProfileRow all;
+    for (size_t first = 0; first < sorted.size();) {
+        size_t end = first;
+        ProfileRow phase_total;
+        phase_total.phase = sorted[first].phase;
+        phase_total.calls = sorted[first].calls;
+        for (; end < sorted.size() && sorted[end].phase == phase_total.phase; ++end) {
+            addTo(phase_total, sorted[end]);
+            // Every kernel call is a call of its own
+            if (phase_total.phase == ProfilePhase::Kernel && end > first) {
+                phase_total.calls += sorted[end].calls;
+            }
+        }
+        line("total", phaseName(phase_total.phase), phase_total);
+        if (phase_total.phase != ProfilePhase::Kernel) {
+            addTo(all, phase_total);
+        }
+        first = end;
+    }
+    line("total", "all", all);
+    if (!counted) {
+        std::string reason = PerfCounters::local().unavailableReason();
+        out << "No hardware counters" << (reason.empty() ? "" : " : " + reason) << "\n";
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void Profiler::addWorkerCounters(const CounterValues& task) {
+    std::lock_guard<std::mutex> guard(worker_lock);
+    worker_counters = worker_counters + task;
+}
+
+CounterValues Profiler::workerCounters() const {
+    std::lock_guard<std::mutex> guard(worker_lock);
+    return worker_counters;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    keys.clear();
+    rows.clear();
+}
+
+uint64_t Profiler::allocations() {
+    return thread_allocations;
+}
+
+std::string Profiler::phaseName(ProfilePhase phase) {
+    switch (phase) {
+        case ProfilePhase::Inference: return "inference";
+        case ProfilePhase::Forward: return "forward";
+        case ProfilePhase::Loss: return "loss";
+        case ProfilePhase::Backward: return "backward";
+        case ProfilePhase::Update: return "update";
+        case ProfilePhase::Kernel: return "kernel";
+    }
+    return "unknown";
+}
+
+ProfileScope::ProfileScope(const void* key, std::string name, ProfilePhase phase, const OpCost& cost)
+    : key(key), name(std::move(name)), phase(phase), cost(cost), start_allocations(Profiler::allocations()),
+      counters(PerfCounters::local()), start_counters(counters.read() + Profiler::instance().workerCounters()),
+      start(std::chrono::steady_clock::now()) {}
+
+ProfileScope::~ProfileScope() {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t allocations = Profiler::allocations() - start_allocations;
+    if (counters.available()) {
+        CounterValues delta = counters.read() + Profiler::instance().workerCounters() - start_counters;
+        Profiler::instance().record(key, name, phase, seconds, cost, allocations, &delta);
+    } else {
+        Profiler::instance().record(key, name, phase, seconds, cost, allocations);
+    }
+}
+
+ProfileTask::ProfileTask() : counters(PerfCounters::local()), start_counters(counters.read()) {}
+
+ProfileTask::~ProfileTask() {
+    // Added even without counters : the calls then leave them out instead of counting only their own thread
+    Profiler::instance().addWorkerCounters(counters.read() - start_counters);
+}
@@ -0,0 +1,180 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the profiler : the wall time, the work (floating point operations and bytes moved) and the heap
+// allocations of every layer in every phase of a training step (forward, loss, backward, update), summed until
+// the summary table is printed, with the GFLOP/s and the arithmetic intensity (FLOP/byte) each layer achieved.
+// The GEMMs are also profiled on their own, as kernels. When the hardware counters can be read (see
+// perf_counters.h) the summary also has the IPC and the cache and branch misses per thousand instructions.
+// The counters of a call are those of its thread, plus those of the tasks the workers of the scheduler ran
+// meanwhile : a large GEMM is cut into tiles computed on the workers. A task run for another thread at the
+// same time (a loader for example) is counted in the call as well.
+//
+// The library records into it through the PROFILE_* macros below, which only do something when it is built
+// with DUMBRONS_PROFILE (cmake -DDUMBRONS_PROFILE=ON). Otherwise they expand to nothing : their arguments are
+// not even evaluated, and a normal build runs exactly the code it ran without them.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "perf_counters.h"
+
+// The values are the order of the phases in the summary
+enum class ProfilePhase : uint32_t {
+    Inference = 0,
+    Forward = 1,
+    Loss = 2,
+    Backward = 3,
+    Update = 4,
+    // The GEMMs called by the layers of the other phases, their time is already counted there
+    Kernel = 5
+};
+
+// The work of an operation : its floating point operations, and the bytes it reads and writes,
+// counting every array once (what it costs if nothing stays in the caches between two operations)
+struct OpCost {
+    double flops = 0.0;
+    double bytes = 0.0;
+};
+
+// What was recorded for one layer (or the loss, or the optimizer) in one phase
+struct ProfileRow {
+    std::string name;
+    ProfilePhase phase = ProfilePhase::Forward;
+    uint64_t calls = 0;
+    double seconds = 0.0;
+    double flops = 0.0;
+    double bytes = 0.0;
+    uint64_t allocations = 0;
+    // The hardware counters summed over the calls, when they were read
+    CounterValues counters;
+};
+
+class Profiler {
+private:
+    // The rows are found by who recorded them (a layer, the network...) and the phase, in the order they came
+    std::vector<const void*> keys;
+    std::vector<ProfileRow> rows;
+    mutable std::mutex lock;
+
+    // The counters summed over every task the workers ran (see PROFILE_TASK)
+    CounterValues worker_counters;
+    mutable std::mutex worker_lock;
+
+    Profiler();
+
+public:
+    // The profiler of the program, every thread records into it
+    static Profiler& instance();
+
+    // Adds a call to the row of key in a phase, the row is created (with that name) by the first call
+    //
+    // Parameters :
+    // key : who made the call, a layer for example
+    // name : the name printed for the row
+    // seconds, cost, allocations : what the call took
+    // counters : the hardware counters of the call, or null when they are not available
+    void record(const void* key, const std::string& name, ProfilePhase phase, double seconds, const OpCost& cost,
+                uint64_t allocations, const CounterValues* counters = nullptr);
+
+    // Adds the counters of a task run by a worker of the scheduler
+    void addWorkerCounters(const CounterValues& task);
+
+    // The counters of every task the workers ran, a call reads them at its start and at its end
+    CounterValues workerCounters() const;
+
+    // A copy of the rows recorded since the last reset
+    std::vector<ProfileRow> getRows() const;
+
+    // Prints the summary of the rows : for every layer in every phase the calls, the time, its share of the
+    // total time, the GFLOP/s, the GB/s, the arithmetic intensity (FLOP/byte) and the allocations, then the
+    // totals of every phase (the kernels are left out of the total of all the phases, they are part of them)
+    // With the hardware counters, also the IPC and the L1, LLC and branch misses per thousand instructions,
+    // otherwise why they are not there. Nothing is printed if nothing was recorded
+    //
+    // Parameters :
+    // out : where the table is written
+    // title : the first line of the table, "epoch 3" for example
+    void print(std::ostream& out, const std::string& title) const;
+
+    // Forgets every row
+    void reset();
+
+    // Number of heap allocations made by the calling thread since it started
+    // Always 0 when the library is not built with DUMBRONS_PROFILE, the allocations are then not counted
+    static uint64_t allocations();
+
+    // Name of a phase, as printed in the summary
+    static std::string phaseName(ProfilePhase phase);
+};
+
+// Records the time and the allocations from its construction to its destruction
+class ProfileScope {
+private:
+    const void* key;
+    std::string name;
+    ProfilePhase phase;
+    OpCost cost;
+    uint64_t start_allocations;
+    PerfCounters& counters;
+    CounterValues start_counters;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ProfileScope(const void* key, std::string name, ProfilePhase phase, const OpCost& cost);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// Adds the hardware counters of a task, from its construction to its destruction, to those of the workers
+class ProfileTask {
+private:
+    PerfCounters& counters;
+    CounterValues start_counters;
+
+public:
+    ProfileTask();
+    ~ProfileTask();
+
+    ProfileTask(const ProfileTask&) = delete;
+    ProfileTask& operator=(const ProfileTask&) = delete;
+};
+
+#ifdef DUMBRONS_PROFILE
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Profiles the rest of the enclosing block as a call of key in a phase, for the work cost (an OpCost)
+#define PROFILE_SCOPE(key, name, phase, cost) \
+    ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)((key), (name), (phase), (cost))
+
+// Counts the rest of the enclosing block as the task of a worker, in the counters of the calls running meanwhile
+#define PROFILE_TASK() ProfileTask PROFILE_CONCAT(profile_task_, __LINE__)
+
+// Prints the summary of what was recorded under a title, then starts again from nothing
+#define PROFILE_REPORT(out, title) \
+    do { \
+        Profiler::instance().print((out), (title)); \
+        Profiler::instance().reset(); \
+    } while (0)
+
+#else
+
+#define PROFILE_SCOPE(key, name, phase, cost) do {} while (0)
+#define PROFILE_TASK() do {} while (0)
+#define PROFILE_REPORT(out, title) do {} while (0)
+
+#endif
+
+#endif //PROFILER_H
@@ -0,0 +1,365 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "reference.h"
+#include "arena.h"
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// What the forward and backward passes share : the sizes of the layer and of its images
+struct Shape {
+    size_t in_size;
+    size_t out_size;
+    size_t out_height = 0;
+    size_t out_width = 0;
+    size_t weights = 0;
+};
+
+Shape shapeOf(const LayerSpec& spec) {
+    Shape shape{};
+    switch (spec.kind) {
+        case LayerKind::Dense:
+            shape.in_size = spec.in_size;
+            shape.out_size = spec.out_size;
+            shape.weights = spec.in_size * spec.out_size;
+            break;
+        case LayerKind::Conv2D:
+            shape.out_height = (spec.height + 2 * spec.padding - spec.window) / spec.stride + 1;
+            shape.out_width = (spec.width + 2 * spec.padding - spec.window) / spec.stride + 1;
+            shape.in_size = spec.channels * spec.height * spec.width;
+            shape.out_size = spec.filters * shape.out_height * shape.out_width;
+            shape.weights = spec.filters * spec.channels * spec.window * spec.window;
+            break;
+        case LayerKind::MaxPool2D:
+        case LayerKind::AvgPool2D:
+            shape.out_height = (spec.height - spec.window) / spec.stride + 1;
+            shape.out_width = (spec.width - spec.window) / spec.stride + 1;
+            shape.in_size = spec.channels * spec.height * spec.width;
+            shape.out_size = spec.channels * shape.out_height * shape.out_width;
+            break;
+        case LayerKind::Activation:
+        case LayerKind::Softmax:
+            shape.in_size = spec.in_size;
+            shape.out_size = spec.in_size;
+            break;
+    }
+    return shape;
+}
+
+// The input row of pixel (y, x) of channel c, or -1 when (y, x) is in the padding
+long inputRow(const LayerSpec& spec, size_t c, long y, long x) {
+    if (y < 0 || x < 0 || y >= static_cast<long>(spec.height) || x >= static_cast<long>(spec.width)) {
+        return -1;
+    }
+    return static_cast<long>((c * spec.height + y) * spec.width + x);
+}
+
+// The input row of the pixel at (ky, kx) in the window of output pixel (oy, ox) of channel c
+long windowRow(const LayerSpec& spec, size_t c, size_t oy, size_t ox, size_t ky, size_t kx) {
+    long y = static_cast<long>(oy * spec.stride + ky) - static_cast<long>(spec.padding);
+    long x = static_cast<long>(ox * spec.stride + kx) - static_cast<long>(spec.padding);
+    return inputRow(spec, c, y, x);
+}
+
+// The input row a max pooling window takes its value from, for one sample : the first largest one
+size_t maxRow(const LayerSpec& spec, const Matrix& input, size_t c, size_t oy, size_t ox, size_t s) {
+    size_t best = static_cast<size_t>(windowRow(spec, c, oy, ox, 0, 0));
+    for (size_t ky = 0; ky < spec.window; ++ky) {
+        for (size_t kx = 0; kx < spec.window; ++kx) {
+            size_t r = static_cast<size_t>(windowRow(spec, c, oy, ox, ky, kx));
+            if (input(r, s) > input(best, s)) {
+                best = r;
+            }
+        }
+    }
+    return best;
+}
+
+}
+
+namespace reference {
+
+Matrix multiply(const Matrix& a, const Matrix& b) {
+    if (a.numCols() != b.numRows()) {
+        throw std::invalid_argument("In order to perform A • B, cols(A) must match rows(B)");
+    }
+
+    Matrix m(a.numRows(), b.numCols(), 0.0);
+
+    for (size_t i = 0; i < a.numRows(); ++i) {
+        for (size_t j = 0; j < b.numCols(); ++j) {
+            for (size_t k = 0; k < a.numCols(); ++k) {
+                m(i, j) += a(i, k) * b(k, j);
+            }
+        }
+    }
+
+    return m;
+}
+
+Matrix transpose(const Matrix& m) {
+    Matrix t(m.numCols(), m.numRows());
+
+    for (size_t i = 0; i < m.numRows(); ++i) {
+        for (size_t j = 0; j < m.numCols(); ++j) {
+            t(j, i) = m(i, j);
+        }
+    }
+
+    return t;
+}
+
+Matrix add(const Matrix& a, const Matrix& b) {
+    if (a.numRows() != b.numRows() || a.numCols() != b.numCols()) {
+        throw std::invalid_argument("Matrices must have the same dimensions to be added");
+    }
+
+    Matrix m(a.numRows(), a.numCols());
+
+    for (size_t i = 0; i < a.numRows(); ++i) {
+        for (size_t j = 0; j < a.numCols(); ++j) {
+            m(i, j) = a(i, j) + b(i, j);
+        }
+    }
+
+    return m;
+}
+
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc, double* magnitude) {
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            double sum = 0.0;
+            double size = 0.0;
+            for (size_t p = 0; p < k; ++p) {
+                double a_ip = trans_a ? a[p * lda + i] : a[i * lda + p];
+                double b_pj = trans_b ? b[j * ldb + p] : b[p * ldb + j];
+                sum += a_ip * b_pj;
+                size += std::fabs(a_ip * b_pj);
+            }
+            double previous = beta == 0.0 ? 0.0 : beta * c[i * ldc + j];
+            c[i * ldc + j] = alpha * sum + previous;
+            if (magnitude) {
+                magnitude[i * ldc + j] = std::fabs(alpha) * size + std::fabs(previous);
+            }
+        }
+    }
+}
+
+Matrix forward(const LayerSpec& spec, const double* params, const Matrix& input) {
+    const Shape shape = shapeOf(spec);
+    if (input.numRows() != shape.in_size) {
+        throw std::invalid_argument("The input must have " + std::to_string(shape.in_size) + " rows");
+    }
+    const size_t n = input.numCols();
+    const double* weights = params;
+    const double* biases = params + Arena::padded(shape.weights);
+    Matrix output(shape.out_size, n);
+
+    switch (spec.kind) {
+        case LayerKind::Dense:
+            for (size_t i = 0; i < spec.out_size; ++i) {
+                for (size_t s = 0; s < n; ++s) {
+                    double z = biases[i];
+                    for (size_t j = 0; j < spec.in_size; ++j) {
+                        z += weights[i * spec.in_size + j] * input(j, s);
+                    }
+                    output(i, s) = z;
+                }
+            }
+            break;
+        case LayerKind::Conv2D:
+            for (size_t f = 0; f < spec.filters; ++f) {
+                for (size_t oy = 0; oy < shape.out_height; ++oy) {
+                    for (size_t ox = 0; ox < shape.out_width; ++ox) {
+                        const size_t o = (f * shape.out_height + oy) * shape.out_width + ox;
+                        for (size_t s = 0; s < n; ++s) {
+                            double z = biases[f];
+                            for (size_t c = 0; c < spec.channels; ++c) {
+                                for (size_t ky = 0; ky < spec.window; ++ky) {
+                                    for (size_t kx = 0; kx < spec.window; ++kx) {
+                                        long r = windowRow(spec, c, oy, ox, ky, kx);
+                                        if (r >= 0) {
+                                            size_t w = (f * spec.channels + c) * spec.window * spec.window
+                                                       + ky * spec.window + kx;
+                                            z += weights[w] * input(r, s);
+                                        }
+                                    }
+                                }
+                            }
+                            output(o, s) = z;
+                        }
+                    }
+                }
+            }
+            break;
+        case LayerKind::MaxPool2D:
+        case LayerKind::AvgPool2D:
+            for (size_t c = 0; c < spec.channels; ++c) {
+                for (size_t oy = 0; oy < shape.out_height; ++oy) {
+                    for (size_t ox = 0; ox < shape.out_width; ++ox) {
+                        const size_t o = (c * shape.out_height + oy) * shape.out_width + ox;
+                        for (size_t s = 0; s < n; ++s) {
+                            if (spec.kind == LayerKind::MaxPool2D) {
+                                output(o, s) = input(maxRow(spec, input, c, oy, ox, s), s);
+                                continue;
+                            }
+                            double sum = 0.0;
+                            for (size_t ky = 0; ky < spec.window; ++ky) {
+                                for (size_t kx = 0; kx < spec.window; ++kx) {
+                                    sum += input(windowRow(spec, c, oy, ox, ky, kx), s);
+                                }
+                            }
+                            output(o, s) = sum / static_cast<double>(spec.window * spec.window);
+                        }
+                    }
+                }
+            }
+            break;
+        case LayerKind::Activation:
+            output = input;
+            break;
+        case LayerKind::Softmax:
+            for (size_t s = 0; s < n; ++s) {
+                double largest = input(0, s);
+                for (size_t i = 1; i < shape.in_size; ++i) {
+                    largest = std::max(largest, input(i, s));
+                }
+                double sum = 0.0;
+                for (size_t i = 0; i < shape.in_size; ++i) {
+                    sum += std::exp(input(i, s) - largest);
+                }
+                for (size_t i = 0; i < shape.in_size; ++i) {
+                    output(i, s) = std::exp(input(i, s) - largest) / sum;
+                }
+            }
+            return output;
+    }
+
+    // The activation, one value at a time
+    std::function<double(double)> activation = activationFunction(spec.activation);
+    for (size_t i = 0; i < output.numRows(); ++i) {
+        for (size_t s = 0; s < n; ++s) {
+            output(i, s) = activation(output(i, s));
+        }
+    }
+    return output;
+}
+
+Matrix backward(const LayerSpec& spec, const double* params, const Matrix& input, const Matrix& dLoss_dOutput,
+                double* grads) {
+    const Shape shape = shapeOf(spec);
+    const Matrix output = forward(spec, params, input);
+    if (dLoss_dOutput.numRows() != output.numRows() || dLoss_dOutput.numCols() != output.numCols()) {
+        throw std::invalid_argument("dLoss/dOutput must match output dimensions");
+    }
+    const size_t n = input.numCols();
+    const double* weights = params;
+    double* grad_weights = grads;
+    double* grad_biases = grads + Arena::padded(shape.weights);
+    Matrix dLoss_dInput(shape.in_size, n, 0.0);
+
+    // deltas = dActivation(outputs) * dLoss/dOutput, softmax mixes the values of a sample instead
+    Matrix deltas(output.numRows(), n);
+    if (spec.kind == LayerKind::Softmax) {
+        for (size_t s = 0; s < n; ++s) {
+            double dot = 0.0;
+            for (size_t i = 0; i < shape.out_size; ++i) {
+                dot += dLoss_dOutput(i, s) * output(i, s);
+            }
+            for (size_t i = 0; i < shape.out_size; ++i) {
+                dLoss_dInput(i, s) = output(i, s) * (dLoss_dOutput(i, s) - dot);
+            }
+        }
+        return dLoss_dInput;
+    }
+    std::function<double(double)> derivative = activationDerivative(spec.activation);
+    for (size_t i = 0; i < output.numRows(); ++i) {
+        for (size_t s = 0; s < n; ++s) {
+            deltas(i, s) = derivative(output(i, s)) * dLoss_dOutput(i, s);
+        }
+    }
+
+    switch (spec.kind) {
+        case LayerKind::Dense:
+            for (size_t i = 0; i < spec.out_size; ++i) {
+                double bias = 0.0;
+                for (size_t s = 0; s < n; ++s) {
+                    bias += deltas(i, s);
+                }
+                grad_biases[i] = bias;
+                for (size_t j = 0; j < spec.in_size; ++j) {
+                    double weight = 0.0;
+                    for (size_t s = 0; s < n; ++s) {
+                        weight += deltas(i, s) * input(j, s);
+                        dLoss_dInput(j, s) += weights[i * spec.in_size + j] * deltas(i, s);
+                    }
+                    grad_weights[i * spec.in_size + j] = weight;
+                }
+            }
+            break;
+        case LayerKind::Conv2D:
+            for (size_t w = 0; w < shape.weights; ++w) {
+                grad_weights[w] = 0.0;
+            }
+            for (size_t f = 0; f < spec.filters; ++f) {
+                grad_biases[f] = 0.0;
+                for (size_t oy = 0; oy < shape.out_height; ++oy) {
+                    for (size_t ox = 0; ox < shape.out_width; ++ox) {
+                        const size_t o = (f * shape.out_height + oy) * shape.out_width + ox;
+                        for (size_t s = 0; s < n; ++s) {
+                            grad_biases[f] += deltas(o, s);
+                            for (size_t c = 0; c < spec.channels; ++c) {
+                                for (size_t ky = 0; ky < spec.window; ++ky) {
+                                    for (size_t kx = 0; kx < spec.window; ++kx) {
+                                        long r = windowRow(spec, c, oy, ox, ky, kx);
+                                        if (r >= 0) {
+                                            size_t w = (f * spec.channels + c) * spec.window * spec.window
+                                                       + ky * spec.window + kx;
+                                            grad_weights[w] += deltas(o, s) * input(r, s);
+                                            dLoss_dInput(r, s) += weights[w] * deltas(o, s);
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            break;
+        case LayerKind::MaxPool2D:
+        case LayerKind::AvgPool2D:
+            for (size_t c = 0; c < spec.channels; ++c) {
+                for (size_t oy = 0; oy < shape.out_height; ++oy) {
+                    for (size_t ox = 0; ox < shape.out_width; ++ox) {
+                        const size_t o = (c * shape.out_height + oy) * shape.out_width + ox;
+                        for (size_t s = 0; s < n; ++s) {
+                            if (spec.kind == LayerKind::MaxPool2D) {
+                                dLoss_dInput(maxRow(spec, input, c, oy, ox, s), s) += deltas(o, s);
+                                continue;
+                            }
+                            for (size_t ky = 0; ky < spec.window; ++ky) {
+                                for (size_t kx = 0; kx < spec.window; ++kx) {
+                                    dLoss_dInput(windowRow(spec, c, oy, ox, ky, kx), s)
+                                        += deltas(o, s) / static_cast<double>(spec.window * spec.window);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            break;
+        case LayerKind::Activation:
+            dLoss_dInput = deltas;
+            break;
+        case LayerKind::Softmax:
+            break;
+    }
+    return dLoss_dInput;
+}
+
+}
@@ -0,0 +1,59 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the reference backend : the kernels of the library written the first, naive way, one value
+// at a time and straight from their definition (the triple loop of the first Matrix::operator*, the activations
+// through their std::function, a convolution as a sum over its window...). Nothing here is fast, it is what the
+// optimized kernels are checked against (see difftest.cpp), so it must stay as simple as it is.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include "layer.h"
+#include "matrix.h"
+
+namespace reference {
+
+// The first Matrix::operator*, Matrix::transpose and Matrix::operator+ of the library
+//
+// Throws std::invalid_argument if the sizes do not match
+Matrix multiply(const Matrix& a, const Matrix& b);
+Matrix transpose(const Matrix& m);
+Matrix add(const Matrix& a, const Matrix& b);
+
+// C = alpha * op(A) * op(B) + beta * C, with the same arguments as gemm (see gemm.h), one dot product at a time
+// beta = 0 ignores the previous values of C, as gemm does
+//
+// Parameters :
+// magnitude : if not null, receives for every value of C the sum of the absolute values of the terms it is made of
+//             (|alpha| * sum |a| * |b|, plus |beta * c|), with the layout of C : the scale of its rounding errors
+void gemm(bool trans_a, bool trans_b, size_t m, size_t n, size_t k,
+          double alpha, const double* a, size_t lda, const double* b, size_t ldb,
+          double beta, double* c, size_t ldc, double* magnitude = nullptr);
+
+// The forward pass of the layer a spec describes, for a batch with one sample per column
+//
+// Parameters :
+// spec : the layer, its activation must be chosen by id
+// params : its parameters, with the layout of Layer::bind (the weights, then the biases after the padded weights),
+//          unused for a layer without parameters
+// input : the batch
+// output : the outputs of the layer
+//
+// Throws std::invalid_argument if the input is not of the input size of the layer
+Matrix forward(const LayerSpec& spec, const double* params, const Matrix& input);
+
+// The backward pass of the same layer, for the same batch
+//
+// Parameters :
+// dLoss_dOutput : the gradient of the loss with respect to the outputs
+// grads : receives the gradients of the parameters summed over the batch, with the layout of params
+// output : the gradient of the loss with respect to the input
+Matrix backward(const LayerSpec& spec, const double* params, const Matrix& input, const Matrix& dLoss_dOutput,
+                double* grads);
+
+}
+
+#endif //REFERENCE_H
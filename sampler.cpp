@@ -0,0 +1,30 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "sampler.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+BatchSampler::BatchSampler(size_t count, size_t batch_size, bool drop_last)
+    : order(count), batch_size(batch_size), drop_last(drop_last)
+{
+    if (batch_size == 0) {
+        throw std::invalid_argument("The batch size must be at least 1");
+    }
+    std::iota(order.begin(), order.end(), 0);
+}
+
+void BatchSampler::shuffle(std::mt19937& generator) {
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), generator);
+}
+
+size_t BatchSampler::numBatches() const {
+    return drop_last ? order.size() / batch_size : (order.size() + batch_size - 1) / batch_size;
+}
+
+size_t BatchSampler::batchSize(size_t b) const {
+    return std::min(batch_size, order.size() - b * batch_size);
+}
@@ -0,0 +1,52 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a BatchSampler class that splits the samples of a dataset into shuffled mini-batches.
+// A batch is only a list of sample indices, the samples themselves are gathered from the dataset
+// straight into the buffers of the batch loader, which the network trains on (see Dataset::gather and loader.h).
+//
+// This file is released under the MIT License.
+//
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstddef>
+#include <random>
+#include <vector>
+
+class BatchSampler {
+private:
+    std::vector<size_t> order;
+    size_t batch_size;
+    bool drop_last;
+
+public:
+    // Creates a sampler over count samples, in their order until the first shuffle
+    //
+    // Parameters :
+    // count : number of samples in the dataset
+    // batch_size : number of samples per batch
+    // drop_last : if true the last incomplete batch is left out, so every batch has batch_size samples
+    //
+    // Throws std::invalid_argument if batch_size is 0
+    BatchSampler(size_t count, size_t batch_size, bool drop_last = true);
+
+    // Draws a new order of the samples
+    // The order is drawn from the identity each time, so it only depends on the state of the generator :
+    // restoring the generator (for example from a checkpoint) gives the same batches again
+    //
+    // Parameters :
+    // generator : the random number generator used to shuffle
+    void shuffle(std::mt19937& generator);
+
+    // Number of batches in an epoch
+    size_t numBatches() const;
+
+    // Indices of the samples of the bth batch, batchSize(b) of them, without bounds checking
+    const size_t* batch(size_t b) const { return order.data() + b * batch_size; }
+
+    // Number of samples in the bth batch, batch_size except for the last one when drop_last is false
+    size_t batchSize(size_t b) const;
+};
+
+#endif //SAMPLER_H
@@ -0,0 +1,356 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "scheduler.h"
+#include "profiler.h"
+#include "trace.h"
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// The scheduler a worker belongs to, and its index, null for the other threads
+thread_local const Scheduler* worker_of = nullptr;
+thread_local size_t worker_index = 0;
+
+// Times a worker looks for a task again before it goes to sleep
+constexpr size_t spin_rounds = 64;
+
+// The queues start with room for this many tasks, they grow when they need more
+constexpr size_t initial_capacity = 256;
+
+// How the scheduler of the program will be made, and whether it was
+std::mutex global_lock;
+SchedulerOptions global_options;
+bool global_started = false;
+
+size_t defaultThreads() {
+    const char* setting = std::getenv("DUMBRONS_THREADS");
+    if (setting) {
+        char* end = nullptr;
+        unsigned long threads = std::strtoul(setting, &end, 10);
+        if (end != setting && *end == '\0' && threads > 0) {
+            return threads;
+        }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Pins the calling thread to the index-th core it is allowed to run on (counting around)
+void pinThread(size_t index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    size_t target = index % static_cast<size_t>(CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && target-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+}
+
+void Scheduler::WorkQueue::pushBack(const Task& task) {
+    std::lock_guard<std::mutex> guard(lock);
+    const size_t n = count.load(std::memory_order_relaxed);
+    if (n == ring.size()) {
+        // The tasks are moved to a ring twice as large, in order from the front
+        std::vector<Task> larger(std::max(initial_capacity, 2 * ring.size()));
+        for (size_t i = 0; i < n; ++i) {
+            larger[i] = ring[(head + i) % ring.size()];
+        }
+        ring.swap(larger);
+        head = 0;
+    }
+    ring[(head + n) % ring.size()] = task;
+    count.store(n + 1, std::memory_order_relaxed);
+}
+
+bool Scheduler::WorkQueue::popBack(Task& task, const TaskGroup* only) {
+    std::lock_guard<std::mutex> guard(lock);
+    const size_t n = count.load(std::memory_order_relaxed);
+    if (n == 0) {
+        return false;
+    }
+    const Task& last = ring[(head + n - 1) % ring.size()];
+    if (only && last.group != only) {
+        return false;
+    }
+    task = last;
+    count.store(n - 1, std::memory_order_relaxed);
+    return true;
+}
+
+bool Scheduler::WorkQueue::popFront(Task& task, const TaskGroup* only) {
+    std::lock_guard<std::mutex> guard(lock);
+    const size_t n = count.load(std::memory_order_relaxed);
+    if (n == 0) {
+        return false;
+    }
+    if (!only) {
+        task = ring[head];
+        head = (head + 1) % ring.size();
+        count.store(n - 1, std::memory_order_relaxed);
+        return true;
+    }
+    // The oldest task of the group, the tasks after it move up to fill its place
+    for (size_t i = 0; i < n; ++i) {
+        if (ring[(head + i) % ring.size()].group == only) {
+            task = ring[(head + i) % ring.size()];
+            for (size_t j = i; j + 1 < n; ++j) {
+                ring[(head + j) % ring.size()] = ring[(head + j + 1) % ring.size()];
+            }
+            count.store(n - 1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+TaskGroup::TaskGroup(Scheduler& scheduler) : scheduler(scheduler), pending(0), failed(false) {}
+
+TaskGroup::TaskGroup() : TaskGroup(Scheduler::instance()) {}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // Nobody waited for the group, nobody is told
+    }
+}
+
+void TaskGroup::run(std::function<void()> function) {
+    functions.push_back(std::make_unique<std::function<void()>>(std::move(function)));
+    pending.fetch_add(1, std::memory_order_relaxed);
+    scheduler.push(Task{&TaskGroup::runFunction, functions.back().get(), 0, 0, this});
+}
+
+void TaskGroup::wait() {
+    // The waiting thread is one of the threads of the scheduler meanwhile
+    // A worker runs any task, the other threads only the tasks of this group : a task of another thread
+    // (a batch of the loader while the trainer waits for a product) could hold them up for long
+    const size_t local = scheduler.localQueue();
+    const TaskGroup* only = worker_of == &scheduler ? nullptr : this;
+    Task task;
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (scheduler.findTask(local, task, only)) {
+            scheduler.execute(task);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    functions.clear();
+
+    // The group can be used again
+    std::exception_ptr first;
+    first.swap(error);
+    failed.store(false, std::memory_order_relaxed);
+    if (first) {
+        std::rethrow_exception(first);
+    }
+}
+
+void TaskGroup::fail(std::exception_ptr exception) {
+    std::lock_guard<std::mutex> guard(error_lock);
+    if (!error) {
+        error = std::move(exception);
+    }
+    failed.store(true, std::memory_order_relaxed);
+}
+
+void TaskGroup::runFunction(Scheduler&, const Task& task) {
+    (*static_cast<std::function<void()>*>(task.context))();
+}
+
+Scheduler::Scheduler(const SchedulerOptions& options)
+    : workers(0), queued(0), sleepers(0), stopping(false)
+{
+    const size_t total = options.threads == 0 ? defaultThreads() : options.threads;
+    workers = total - 1;
+    queues = std::make_unique<WorkQueue[]>(numQueues());
+    slots = std::make_shared<ExternalSlots>();
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back(&Scheduler::workerLoop, this, w, options.pin);
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping.store(true);
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+Scheduler& Scheduler::instance() {
+    static Scheduler scheduler([] {
+        std::lock_guard<std::mutex> guard(global_lock);
+        global_started = true;
+        return global_options;
+    }());
+    return scheduler;
+}
+
+void Scheduler::configure(const SchedulerOptions& options) {
+    std::lock_guard<std::mutex> guard(global_lock);
+    if (global_started) {
+        throw std::logic_error("The scheduler is already running, it must be configured before its first use");
+    }
+    global_options = options;
+}
+
+size_t Scheduler::localQueue() const {
+    if (worker_of == this) {
+        return worker_index;
+    }
+    // The queues the thread took, given back when it ends
+    struct Held {
+        std::vector<std::pair<std::shared_ptr<ExternalSlots>, size_t>> taken;
+        ~Held() {
+            for (auto& [table, index] : taken) {
+                table->taken[index].store(false, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Held held;
+    for (const auto& [table, index] : held.taken) {
+        if (table == slots) {
+            return workers + index;
+        }
+    }
+    for (size_t index = 0; index < external_slots; ++index) {
+        bool expected = false;
+        if (slots->taken[index].compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            held.taken.emplace_back(slots, index);
+            return workers + index;
+        }
+    }
+    return workers + external_slots;
+}
+
+void Scheduler::push(const Task& task) {
+    queues[localQueue()].pushBack(task);
+    queued.fetch_add(1);
+    // A worker going to sleep counts itself before it looks at queued one last time, under the lock :
+    // either it sees this task, or it is already waiting when it is notified
+    if (sleepers.load() > 0) {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        wake.notify_one();
+    }
+}
+
+bool Scheduler::findTask(size_t local, Task& task, const TaskGroup* only) {
+    if (queued.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    if (queues[local].popBack(task, only)) {
+        queued.fetch_sub(1);
+        return true;
+    }
+    // The thieves start from different queues, so they do not all fight over the same one
+    thread_local size_t next_victim = worker_index;
+    const size_t count = numQueues();
+    for (size_t i = 0; i < count; ++i) {
+        size_t victim = (next_victim + i) % count;
+        if (victim != local && queues[victim].count.load(std::memory_order_relaxed) > 0
+            && queues[victim].popFront(task, only)) {
+            next_victim = victim;
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    next_victim = (next_victim + 1) % count;
+    return false;
+}
+
+void Scheduler::execute(const Task& task) {
+    TaskGroup& group = *task.group;
+    if (!group.hasFailed()) {
+        try {
+            task.run(*this, task);
+        } catch (...) {
+            group.fail(std::current_exception());
+        }
+    }
+    // The group may be gone as soon as its last task is counted, it is not touched after
+    group.pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void Scheduler::runRange(Scheduler& scheduler, const Task& task) {
+    const RangeJob& job = *static_cast<const RangeJob*>(task.context);
+    const WorkQueue& local = scheduler.queues[scheduler.localQueue()];
+    size_t begin = task.begin;
+    size_t end = task.end;
+    while (begin < end) {
+        if (task.group->hasFailed()) {
+            return;
+        }
+        // Half of what is left is offered to the others when this thread has nothing left for them to take
+        if (end - begin >= 2 * job.grain && local.count.load(std::memory_order_relaxed) == 0) {
+            size_t middle = begin + (end - begin) / 2;
+            task.group->pending.fetch_add(1, std::memory_order_relaxed);
+            scheduler.push(Task{&Scheduler::runRange, task.context, middle, end, task.group});
+            end = middle;
+            continue;
+        }
+        // A rest shorter than two grains is not cut, so no piece is shorter than a grain
+        size_t last = end - begin < 2 * job.grain ? end : begin + job.grain;
+        job.invoke(job.body, begin, last);
+        begin = last;
+    }
+}
+
+void Scheduler::workerLoop(size_t index, bool pin) {
+    worker_of = this;
+    worker_index = index;
+    if (pin) {
+        // The first core is left to the thread that started the scheduler
+        pinThread(index + 1);
+    }
+    TRACE_THREAD("worker " + std::to_string(index + 1));
+
+    Task task;
+    size_t idle = 0;
+    while (!stopping.load(std::memory_order_acquire)) {
+        if (findTask(index, task)) {
+            TRACE_SCOPE("scheduler", "task");
+            PROFILE_TASK();
+            execute(task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < spin_rounds) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        sleepers.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> lock(sleep_lock);
+            wake.wait(lock, [this] { return queued.load() > 0 || stopping.load(); });
+        }
+        sleepers.fetch_sub(1);
+        idle = 0;
+    }
+}
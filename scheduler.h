@@ -0,0 +1,234 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the Scheduler : the one pool of worker threads everything parallel in the library runs on
+// (the GEMMs, the augmentation of the batches, the parsing of the datasets, the evaluation), so they never
+// compete with each other for the cores.
+// Every worker has its own deque of tasks : it takes the last task it pushed (still in its caches), and a worker
+// with nothing to do steals the oldest task of another one (the largest piece of a split loop).
+// A thread waiting for its tasks runs tasks instead of blocking, so a parallel loop inside a task (nested
+// parallelism) adds work to the pool, never threads.
+// The other threads using the scheduler (the trainer, the loader, the stages of the evaluator) get a deque of
+// their own too. While they wait, they only run the tasks of the group they wait for, never a task of another
+// thread that could hold them up.
+//
+// parallelFor splits a loop lazily : a thread cuts its range in half and offers the other half only when its own
+// deque is empty, so a loop is cut into as many pieces as there are idle threads to take them, not more.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Scheduler;
+class TaskGroup;
+
+// How the scheduler of the program is made (see Scheduler::configure)
+struct SchedulerOptions {
+    // Number of threads running tasks, the thread waiting for them included : threads - 1 workers are started
+    // 0 takes the DUMBRONS_THREADS environment variable, or every hardware thread without it
+    size_t threads = 0;
+    // Pins every worker to its own core (on Linux), so it keeps its caches
+    bool pin = false;
+};
+
+// What the deques hold : a range of a parallel loop, or a function of a task group.
+// It is copied in and out of the deques, the loops and the functions it points to stay where they are
+struct Task {
+    void (*run)(Scheduler& scheduler, const Task& task);
+    void* context;
+    size_t begin;
+    size_t end;
+    TaskGroup* group;
+};
+
+// A set of tasks that are waited for together
+// Tasks may be added and waited for only by the thread that made the group
+class TaskGroup {
+private:
+    Scheduler& scheduler;
+    std::atomic<size_t> pending;
+    std::atomic<bool> failed;
+    std::mutex error_lock;
+    std::exception_ptr error;
+    std::vector<std::unique_ptr<std::function<void()>>> functions;
+
+    friend class Scheduler;
+
+    static void runFunction(Scheduler& scheduler, const Task& task);
+
+public:
+    explicit TaskGroup(Scheduler& scheduler);
+    TaskGroup();
+
+    // Waits for the tasks that are left, their exceptions are dropped
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Adds a task, any thread of the scheduler may run it
+    void run(std::function<void()> function);
+
+    // Runs tasks until every task of the group is done
+    //
+    // Throws the first exception thrown by a task of the group, the tasks not started yet are then skipped
+    void wait();
+
+    // Whether a task of the group threw, the long tasks may check it to give up early
+    bool hasFailed() const { return failed.load(std::memory_order_relaxed); }
+
+    // Records an exception thrown by a task of the group, only the first one is kept
+    void fail(std::exception_ptr exception);
+};
+
+class Scheduler {
+private:
+    // A deque of tasks, locked : the tasks are coarse (a block of a GEMM, a few images), a lock-free deque
+    // would not be measurably faster. The owner pushes and pops at the back, the thieves take from the front
+    struct alignas(64) WorkQueue {
+        std::mutex lock;
+        std::vector<Task> ring;
+        size_t head = 0;
+        // Written under the lock, read without it to know whether the queue looks empty
+        std::atomic<size_t> count{0};
+
+        void pushBack(const Task& task);
+        // A group, if given, only takes a task of that group : the last one if it is, the oldest one of it
+        bool popBack(Task& task, const TaskGroup* only);
+        bool popFront(Task& task, const TaskGroup* only);
+    };
+
+    // Number of threads that are not workers (the trainer, the loaders...) that get a queue of their own
+    static constexpr size_t external_slots = 16;
+
+    // Which queues of the threads that are not workers are taken
+    // It is shared with the threads holding one, so they can give it back after the scheduler is gone
+    struct ExternalSlots {
+        std::atomic<bool> taken[external_slots] = {};
+    };
+
+    // One queue per worker, one for each of the first external_slots other threads using the scheduler,
+    // then one shared by the threads beyond them
+    std::unique_ptr<WorkQueue[]> queues;
+    size_t workers;
+    std::vector<std::thread> threads;
+    std::shared_ptr<ExternalSlots> slots;
+
+    // Tasks in all the queues, and the workers that went to sleep because there were none
+    std::atomic<size_t> queued;
+    std::atomic<size_t> sleepers;
+    std::atomic<bool> stopping;
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+
+    void workerLoop(size_t index, bool pin);
+
+    // The queue the calling thread pushes to : its own, taken the first time it uses the scheduler
+    // (the shared one when all are taken)
+    size_t localQueue() const;
+
+    // Number of queues, the shared one included
+    size_t numQueues() const { return workers + external_slots + 1; }
+
+    // Takes a task : the last one of the local queue, or the oldest one of another queue
+    // A group, if given, only takes the tasks of that group
+    bool findTask(size_t local, Task& task, const TaskGroup* only = nullptr);
+
+    // Runs a task and counts it as done in its group
+    void execute(const Task& task);
+
+    // A range of a parallel loop : the loop, and the smallest piece worth cutting off
+    struct RangeJob {
+        void (*invoke)(const void* body, size_t begin, size_t end);
+        const void* body;
+        size_t grain;
+    };
+    static void runRange(Scheduler& scheduler, const Task& task);
+
+    friend class TaskGroup;
+
+public:
+    // Starts the workers
+    //
+    // Parameters :
+    // options : the number of threads (0 as in SchedulerOptions) and whether the workers are pinned
+    explicit Scheduler(const SchedulerOptions& options = SchedulerOptions());
+
+    // Stops the workers, the tasks must all have been waited for
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // The scheduler of the program, started the first time it is asked for
+    static Scheduler& instance();
+
+    // Sets how the scheduler of the program will be made, before anything used it
+    //
+    // Throws std::logic_error if it was already started
+    static void configure(const SchedulerOptions& options);
+
+    // Number of threads running tasks : the workers, and the thread waiting for them
+    size_t numThreads() const { return workers + 1; }
+
+    // Queues a task of a group
+    void push(const Task& task);
+
+    // Calls body(first, last) on pieces of [begin, end) covering it once, on the threads of the scheduler,
+    // and returns when they are all done. The pieces are at least grain long (except the last one),
+    // a grain of 0 picks one from the length of the range and the number of threads.
+    // A range shorter than two grains, or a scheduler without workers, runs on the calling thread alone.
+    //
+    // Parameters :
+    // begin, end : the range of the loop
+    // grain : the smallest piece, it should be long enough for the body to be worth a task (a few microseconds)
+    // body : a function of (size_t first, size_t last), called concurrently on pieces that do not overlap
+    //
+    // Throws the first exception thrown by the body, the pieces not started yet are then skipped
+    template <typename Body>
+    void parallelFor(size_t begin, size_t end, size_t grain, const Body& body);
+};
+
+template <typename Body>
+void Scheduler::parallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+    if (begin >= end) {
+        return;
+    }
+    const size_t length = end - begin;
+    if (grain == 0) {
+        // About eight pieces per thread when everything is split, so the stealing can even out the load
+        grain = std::max<size_t>(1, length / (8 * numThreads()));
+    }
+    if (workers == 0 || length < 2 * grain) {
+        body(begin, end);
+        return;
+    }
+
+    // The whole range is the first task, run here : it is split as the other threads come for work
+    RangeJob job{[](const void* b, size_t first, size_t last) { (*static_cast<const Body*>(b))(first, last); },
+                 &body, grain};
+    TaskGroup group(*this);
+    group.pending.store(1, std::memory_order_relaxed);
+    execute(Task{&Scheduler::runRange, &job, begin, end, &group});
+    group.wait();
+}
+
+// parallelFor on the scheduler of the program
+template <typename Body>
+void parallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+    Scheduler::instance().parallelFor(begin, end, grain, body);
+}
+
+#endif //SCHEDULER_H
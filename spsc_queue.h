@@ -0,0 +1,121 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a bounded lock-free queue between exactly one producer thread and one consumer thread.
+// The values live in a ring, the producer only writes the tail and the consumer only writes the head,
+// so neither ever waits for a lock. Used to join the stages of a pipeline (see Evaluator).
+// A thread that waits on the queue spins a little, then sleeps until the other side pushes, pops or wakes it.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class SpscQueue {
+private:
+    std::vector<T> ring;
+    size_t mask;
+
+    // The head and the tail are on their own cache lines, so the two threads do not keep taking the line from each other
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+    // Counts the pushes, the pops and the calls to wake, a waiting thread sleeps until it changes
+    alignas(64) std::atomic<uint32_t> events;
+
+    // Number of tries before a wait goes to sleep : the other stage is often about to hand a value over
+    static constexpr int spins = 64;
+
+    void signal() {
+        events.fetch_add(1, std::memory_order_release);
+        events.notify_all();
+    }
+
+    // Tries attempt until it succeeds, or until stop is true
+    template <typename Attempt>
+    bool waitFor(Attempt attempt, const std::atomic<bool>& stop) {
+        for (int i = 0; i < spins; ++i) {
+            if (attempt()) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+        while (true) {
+            // Read before the try, so a push, a pop or a wake that comes after the try ends the sleep
+            uint32_t seen = events.load(std::memory_order_acquire);
+            if (attempt()) {
+                return true;
+            }
+            if (stop.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            events.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+public:
+    // Parameters :
+    // capacity : the number of values the queue can hold, rounded up to a power of 2
+    explicit SpscQueue(size_t capacity) : head(0), tail(0), events(0) {
+        size_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        ring.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Adds a value at the end of the queue, only called by the producer
+    // output : false if the queue is full, the value is then not added
+    bool tryPush(const T& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == ring.size()) {
+            return false;
+        }
+        ring[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // Takes the value at the front of the queue, only called by the consumer
+    // output : false if the queue is empty, value is then left as it was
+    bool tryPop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = ring[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // Same as tryPush and tryPop, but wait until they succeed or stop becomes true
+    // A thread that sets stop calls wake afterwards, so a wait that is asleep sees it
+    // output : false if they gave up because of stop
+    bool push(const T& value, const std::atomic<bool>& stop) {
+        return waitFor([&] { return tryPush(value); }, stop);
+    }
+
+    bool pop(T& value, const std::atomic<bool>& stop) {
+        return waitFor([&] { return tryPop(value); }, stop);
+    }
+
+    // Wakes the thread waiting on the queue, if any, so it looks at its stop flag again
+    void wake() {
+        signal();
+    }
+};
+
+#endif //SPSC_QUEUE_H
@@ -0,0 +1,178 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "stream.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Reads exactly bytes at offset, retrying on short reads
+void readAt(int fd, void* to, size_t bytes, uint64_t offset, const std::string& path) {
+    uint8_t* p = static_cast<uint8_t*>(to);
+    while (bytes > 0) {
+        ssize_t got = ::pread(fd, p, bytes, static_cast<off_t>(offset));
+        if (got <= 0) {
+            throw std::runtime_error("Can't read " + path);
+        }
+        p += got;
+        bytes -= static_cast<size_t>(got);
+        offset += static_cast<uint64_t>(got);
+    }
+}
+
+}
+
+ShardStream::ShardStream(std::vector<std::string> shard_paths, size_t shuffle_buffer, size_t chunk_bytes)
+    : paths(std::move(shard_paths)), features(0), total(0),
+      capacity(shuffle_buffer), buffered(0), remaining(0),
+      chunk_samples(0), chunk_count(0), chunk_next(0),
+      shard(0), fd(-1), shard_next(0)
+{
+    if (paths.empty()) {
+        throw std::invalid_argument("A stream needs at least one shard");
+    }
+    if (capacity == 0) {
+        throw std::invalid_argument("The shuffle buffer must hold at least one sample");
+    }
+
+    // Only the headers are read here
+    for (const std::string& path : paths) {
+        DatasetFileInfo info = Dataset::readBinaryInfo(path);
+        if (shards.empty()) {
+            features = info.features;
+        } else if (info.features != features) {
+            throw std::runtime_error(path + " does not have the same number of features as " + paths.front());
+        }
+        total += info.count;
+        shards.push_back(info);
+    }
+
+    buffer_pixels.resize(capacity * features);
+    buffer_labels.resize(capacity);
+    chunk_samples = std::max<size_t>(1, chunk_bytes / std::max<size_t>(1, features));
+    chunk_pixels.resize(chunk_samples * features);
+    chunk_labels.resize(chunk_samples);
+
+    rewind();
+}
+
+ShardStream::~ShardStream() {
+    closeShard();
+}
+
+void ShardStream::closeShard() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void ShardStream::rewind() {
+    closeShard();
+    shard = 0;
+    shard_next = 0;
+    chunk_count = 0;
+    chunk_next = 0;
+    buffered = 0;
+    remaining = total;
+}
+
+bool ShardStream::readChunk() {
+    while (shard < shards.size()) {
+        const DatasetFileInfo& info = shards[shard];
+        if (shard_next == info.count) {
+            // The shard is consumed, it is closed and the stream moves to the next one
+            closeShard();
+            ++shard;
+            shard_next = 0;
+            continue;
+        }
+
+        const std::string& path = paths[shard];
+        if (fd < 0) {
+            fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Can't open " + path);
+            }
+#ifdef POSIX_FADV_SEQUENTIAL
+            // The kernel reads ahead of us while the batches are trained
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        }
+
+        size_t count = static_cast<size_t>(std::min<uint64_t>(chunk_samples, info.count - shard_next));
+        uint64_t pixels_offset = info.pixels_offset + shard_next * features;
+        readAt(fd, chunk_labels.data(), count, info.labels_offset + shard_next, path);
+        readAt(fd, chunk_pixels.data(), count * features, pixels_offset, path);
+#ifdef POSIX_FADV_DONTNEED
+        // What was read is never read again in this pass, it does not need to stay in the page cache
+        ::posix_fadvise(fd, static_cast<off_t>(pixels_offset), static_cast<off_t>(count * features), POSIX_FADV_DONTNEED);
+#endif
+
+        shard_next += count;
+        chunk_count = count;
+        chunk_next = 0;
+        return true;
+    }
+    return false;
+}
+
+bool ShardStream::readSample(uint8_t* pixels, uint8_t& label) {
+    if (chunk_next == chunk_count && !readChunk()) {
+        return false;
+    }
+    std::memcpy(pixels, chunk_pixels.data() + chunk_next * features, features);
+    label = chunk_labels[chunk_next];
+    ++chunk_next;
+    return true;
+}
+
+size_t ShardStream::next(size_t n, Matrix& inputs, Matrix& targets, size_t classes,
+                         std::mt19937& generator, double scale) {
+    // The buffer is filled at the start of a pass
+    if (buffered == 0 && remaining == total) {
+        while (buffered < capacity && readSample(&buffer_pixels[buffered * features], buffer_labels[buffered])) {
+            ++buffered;
+        }
+    }
+
+    size_t count = std::min(n, remaining);
+    if (inputs.numRows() != features || inputs.numCols() != count) {
+        inputs = Matrix(features, count);
+    }
+    if (targets.numRows() != classes || targets.numCols() != count) {
+        targets = Matrix(classes, count);
+    }
+    double* values = inputs.data();
+    double* one_hot = targets.data();
+    std::fill(one_hot, one_hot + classes * count, 0.0);
+
+    for (size_t j = 0; j < count; ++j) {
+        // Draw a sample out of the buffer
+        size_t r = std::uniform_int_distribution<size_t>(0, buffered - 1)(generator);
+        uint8_t* src = &buffer_pixels[r * features];
+        if (buffer_labels[r] >= classes) {
+            throw std::out_of_range("Label out of the classes in the shards");
+        }
+        for (size_t f = 0; f < features; ++f) {
+            values[f * count + j] = src[f] * scale;
+        }
+        one_hot[buffer_labels[r] * count + j] = 1.0;
+
+        // Its place is taken by the next sample of the shards, or by the last sample of the buffer at the end
+        if (!readSample(src, buffer_labels[r])) {
+            --buffered;
+            if (r != buffered) {
+                std::memcpy(src, &buffer_pixels[buffered * features], features);
+                buffer_labels[r] = buffer_labels[buffered];
+            }
+        }
+        --remaining;
+    }
+    return count;
+}
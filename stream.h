@@ -0,0 +1,97 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides a ShardStream that trains on datasets larger than the memory : the samples are read from a
+// list of shards (binary dataset files, see Dataset::saveBinary, a CSV cache is one) one after the other,
+// by large sequential reads, and shuffled inside a buffer of bounded size.
+// A consumed part of a shard is dropped from the page cache and a consumed shard is closed, so the memory
+// used is the shuffle buffer plus one read chunk, whatever the size of the dataset.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include "dataset.h"
+#include "matrix.h"
+
+class ShardStream {
+private:
+    std::vector<std::string> paths;
+    std::vector<DatasetFileInfo> shards;
+    size_t features;
+    size_t total;
+
+    // The shuffle buffer : up to capacity samples, the first buffered ones are valid
+    size_t capacity;
+    std::vector<uint8_t> buffer_pixels;
+    std::vector<uint8_t> buffer_labels;
+    size_t buffered;
+    size_t remaining;
+
+    // The chunk read last from the current shard, and where the stream is in it
+    size_t chunk_samples;
+    std::vector<uint8_t> chunk_pixels;
+    std::vector<uint8_t> chunk_labels;
+    size_t chunk_count;
+    size_t chunk_next;
+
+    // The shard being read : its index, its file descriptor (-1 when closed) and the next sample to read from it
+    size_t shard;
+    int fd;
+    uint64_t shard_next;
+
+    // Copies the next sample of the shards into pixels and label, returns false at the end of the last shard
+    bool readSample(uint8_t* pixels, uint8_t& label);
+
+    // Reads the next chunk of the current shard, moving to the next shard at the end of one
+    bool readChunk();
+    void closeShard();
+
+public:
+    // Opens a stream over shards, read in the order given
+    //
+    // Parameters :
+    // paths : the shards, binary dataset files that all have the same number of features
+    // shuffle_buffer : number of samples of the shuffle buffer, the more the closer to a full shuffle
+    // chunk_bytes : size of the reads from the shards, rounded down to whole samples
+    //
+    // Throws std::invalid_argument if there is no shard or the shuffle buffer is empty,
+    // std::runtime_error if a shard is not a dataset file or the shards do not have the same number of features
+    ShardStream(std::vector<std::string> paths, size_t shuffle_buffer, size_t chunk_bytes = size_t(8) << 20);
+    ~ShardStream();
+
+    ShardStream(const ShardStream&) = delete;
+    ShardStream& operator=(const ShardStream&) = delete;
+
+    // Number of samples in all the shards, and number of features of a sample
+    size_t size() const { return total; }
+    size_t numFeatures() const { return features; }
+
+    // Starts a new pass over the shards, from the beginning of the first one
+    void rewind();
+
+    // Takes the next batch of the pass : each sample is drawn at random from the shuffle buffer and replaced by
+    // the next sample read from the shards. The same generator state gives the same batches.
+    // The samples are written like Dataset::gather and Dataset::gatherTargets do, one column per sample.
+    //
+    // Parameters :
+    // n : number of samples wanted, fewer are returned at the end of the pass
+    // inputs : the batch, resized to (numFeatures(), count) if it does not have this size
+    // targets : the one-hot targets, resized to (classes, count) if it does not have this size
+    // classes : number of classes (10 for MNIST)
+    // generator : draws the samples out of the shuffle buffer
+    // scale : factor applied to every value, 1 / 255 by default to normalize the pixels to [0, 1]
+    // output : count, the number of samples in the batch, 0 once the pass is over
+    //
+    // Throws std::runtime_error if a shard can't be read, std::out_of_range if a label is not below classes
+    size_t next(size_t n, Matrix& inputs, Matrix& targets, size_t classes,
+                std::mt19937& generator, double scale = 1.0 / 255.0);
+};
+
+#endif //STREAM_H
@@ -2,6 +2,9 @@
 // Created by mazen on 08/06/2025.
 //
 
+// The tests rely on assert, keep it even in release builds
+#undef NDEBUG
+
 #include <iostream>
 #include <cassert>
 #include "matrix.h"
@@ -58,6 +61,20 @@ int main() {
     assert(E(0, 0) == 6.0);
     printf("Test 8 passed.\n");
 
+    // Views read and write memory they don't own, copies of a view own their values
+    double raw[6] = {1.0, 2.0, 3.0, 4.0, 5.0, 6.0};
+    Matrix V = Matrix::view(raw, 2, 3);
+    assert(V.isView() && V(1, 0) == 4.0);
+    V(0, 0) = 10.0;
+    assert(raw[0] == 10.0);
+    V = B;
+    assert(raw[5] == 2.0);
+    Matrix W = V;
+    assert(!W.isView());
+    W(0, 0) = 0.0;
+    assert(raw[0] == 2.0);
+    printf("Test 9 passed.\n");
+
     printf("================ Success ===============");
     return 0;
 }
@@ -0,0 +1,141 @@
+//
+// This file is released under the MIT License.
+//
+
+#include "trace.h"
+#include "benchmark.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace {
+
+uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+}
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+TraceBuffer& Tracer::local() {
+    // The buffers belong to the tracer, a thread that ends leaves its events for the trace
+    thread_local TraceBuffer* buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> guard(lock);
+        buffers.push_back(std::make_unique<TraceBuffer>());
+        buffer = buffers.back().get();
+        buffer->ring.resize(capacity);
+        buffer->thread_id = static_cast<uint32_t>(buffers.size());
+    }
+    return *buffer;
+}
+
+void Tracer::record(const char* category, const char* name, char phase) {
+    // Acquire : the rings and the origin set by start are seen with the flag
+    if (!active.load(std::memory_order_acquire)) {
+        return;
+    }
+    TraceBuffer& buffer = local();
+    if (buffer.ring.empty()) {
+        return;
+    }
+    // Only this thread writes the count, the release makes the event visible to write() with it
+    uint64_t n = buffer.written.load(std::memory_order_relaxed);
+    buffer.ring[n & (buffer.ring.size() - 1)] = {category, name, now() - origin, phase};
+    buffer.written.store(n + 1, std::memory_order_release);
+}
+
+void Tracer::start(size_t events_per_thread) {
+    if (events_per_thread == 0) {
+        throw std::invalid_argument("A trace needs room for at least one event per thread");
+    }
+    // Other threads may be writing into the rings while it records
+    if (active.load(std::memory_order_acquire)) {
+        throw std::logic_error("The tracer is already recording");
+    }
+    // The rings are powers of 2, so an event finds its place with a mask
+    size_t size = 1;
+    while (size < events_per_thread) {
+        size *= 2;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = size;
+    for (std::unique_ptr<TraceBuffer>& buffer : buffers) {
+        buffer->ring.assign(size, TraceEvent{});
+        buffer->written.store(0, std::memory_order_relaxed);
+    }
+    origin = now();
+    active.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() {
+    active.store(false, std::memory_order_release);
+}
+
+void Tracer::nameThread(const std::string& name) {
+    TraceBuffer& buffer = local();
+    std::lock_guard<std::mutex> guard(lock);
+    buffer.thread_name = name;
+}
+
+const char* Tracer::intern(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    // The nodes of a set never move, the pointer stays valid
+    return names.insert(name).first->c_str();
+}
+
+void Tracer::write(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Can't write the trace to " + path);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    auto separate = [&] {
+        file << (first ? "\n" : ",\n");
+        first = false;
+    };
+    for (const std::unique_ptr<TraceBuffer>& buffer : buffers) {
+        if (!buffer->thread_name.empty()) {
+            separate();
+            file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->thread_id
+                 << ", \"args\": {\"name\": " << jsonString(buffer->thread_name) << "}}";
+        }
+        if (buffer->ring.empty()) {
+            continue;
+        }
+        const uint64_t written = buffer->written.load(std::memory_order_acquire);
+        const uint64_t size = buffer->ring.size();
+        const uint64_t oldest = written > size ? written - size : 0;
+
+        // When the ring wrapped, the ends of the events that were dropped come first, they have nothing to match
+        size_t depth = 0;
+        for (uint64_t i = oldest; i < written; ++i) {
+            const TraceEvent& event = buffer->ring[i & (size - 1)];
+            if (event.phase == 'B') {
+                ++depth;
+            } else if (depth == 0) {
+                continue;
+            } else {
+                --depth;
+            }
+            separate();
+            file << "{\"name\": " << jsonString(event.name) << ", \"cat\": " << jsonString(event.category)
+                 << ", \"ph\": \"" << event.phase << "\", \"ts\": " << event.time / 1000.0
+                 << ", \"pid\": 1, \"tid\": " << buffer->thread_id << "}";
+        }
+    }
+    file << "\n]}\n";
+    if (!file) {
+        throw std::runtime_error("Can't write the trace to " + path);
+    }
+}
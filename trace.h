@@ -0,0 +1,144 @@
+//
+// This file is part of a simple neural network library for C++.
+// It provides the tracer : a timeline of what every thread of the program does (the batches and the layers
+// of the training, the stages of the loader, the optimizer steps, the checkpoints...), written as a Chrome
+// trace-event JSON file that chrome://tracing and https://ui.perfetto.dev open. It shows where the trainer waits
+// for the loader, or the loader for the trainer.
+//
+// Every thread writes its begin and end events into a ring of its own, without any lock : recording an event
+// is reading the clock and writing 32 bytes. When a ring is full its oldest events are dropped.
+// The library records through the TRACE_* macros below, which only do something when it is built with
+// DUMBRONS_TRACE (cmake -DDUMBRONS_TRACE=ON), otherwise they expand to nothing.
+//
+// This file is released under the MIT License.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// A begin ('B') or end ('E') event, the names must live until the trace is written (literals, or see Tracer::intern)
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    uint64_t time;  // nanoseconds since the tracer started
+    char phase;
+};
+
+// The events of one thread, only that thread writes them
+struct TraceBuffer {
+    std::vector<TraceEvent> ring;
+    // Number of events written since the tracer started, the last ring.size() of them are in the ring
+    std::atomic<uint64_t> written{0};
+    uint32_t thread_id = 0;
+    std::string thread_name;
+};
+
+class Tracer {
+private:
+    static inline std::atomic<bool> active{false};
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::set<std::string> names;
+    size_t capacity = 0;
+    uint64_t origin = 0;
+
+    Tracer() = default;
+
+    // The buffer of the calling thread, created the first time the thread records something
+    TraceBuffer& local();
+
+    void record(const char* category, const char* name, char phase);
+
+public:
+    // The tracer of the program, every thread records into it
+    static Tracer& instance();
+
+    // Whether events are recorded, a cheap check done before every event
+    // record checks again with acquire, so it sees the rings start set up before it writes into them
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    // Starts recording, the events of a previous recording are forgotten
+    // The rings of the threads are replaced without them knowing : it must be called before the traced threads
+    // start, or while none of them can record (between a stop and the next start, they must all be idle)
+    //
+    // Parameters :
+    // events_per_thread : the size of the ring of every thread, its oldest events are dropped once it is full
+    //
+    // Throws std::invalid_argument if events_per_thread is 0, std::logic_error if the tracer is already recording
+    void start(size_t events_per_thread = 1 << 18);
+
+    // Stops recording, the events stay until the next start
+    void stop();
+
+    // Records the beginning and the end of something the calling thread does, they must be nested
+    void begin(const char* category, const char* name) { record(category, name, 'B'); }
+    void end(const char* category, const char* name) { record(category, name, 'E'); }
+
+    // Names the calling thread in the trace ("trainer", "loader"...), threads without one are shown by number
+    void nameThread(const std::string& name);
+
+    // A copy of a name that lives as long as the program, for the names that are not literals
+    // The same name always gives the same pointer
+    const char* intern(const std::string& name);
+
+    // Writes the events of every thread as a Chrome trace-event JSON file
+    // The traced threads should be idle (or stopped), an event written during the copy may be lost
+    //
+    // Parameters :
+    // path : the file written
+    //
+    // Throws std::runtime_error if the file can't be written
+    void write(const std::string& path);
+};
+
+// Records a begin event at its construction and the matching end event at its destruction
+class TraceScope {
+private:
+    const char* category;
+    const char* name;
+    bool recording;
+
+public:
+    TraceScope(const char* category, const char* name) : category(category), name(name), recording(Tracer::enabled()) {
+        if (recording) {
+            Tracer::instance().begin(category, name);
+        }
+    }
+    ~TraceScope() {
+        if (recording) {
+            Tracer::instance().end(category, name);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#ifdef DUMBRONS_TRACE
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Traces the rest of the enclosing block, category and name are C strings that outlive the trace
+#define TRACE_SCOPE(category, name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)((category), (name))
+
+// Names the calling thread in the trace
+#define TRACE_THREAD(name) Tracer::instance().nameThread(name)
+
+#else
+
+#define TRACE_SCOPE(category, name) do {} while (0)
+#define TRACE_THREAD(name) do {} while (0)
+
+#endif
+
+#endif //TRACE_H